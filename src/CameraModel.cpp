@@ -0,0 +1,279 @@
+//============================================================================
+// Name        : CameraModel.cpp
+// Copyright   : GWU Research
+// Description : Pinhole camera model and back-projection ray table
+//============================================================================
+
+#include "CameraModel.h"
+
+// C/C++
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+
+// Fixed point iterations of the undistortion (converged well below a
+// thousandth of a pixel for Kinect-like lenses)
+static const int kUNDISTORT_ITERATIONS = 20;
+
+// Ray cache file header
+static const char kCACHE_MAGIC[8] = { 'R', 'A', 'Y', 'C', 'A', 'C', 'H', 'E' };
+static const int kCACHE_VERSION = 1;
+
+
+/**
+ * @brief Intrinsics of a centered camera with the given fields of view
+ *        (no distortion)
+ *
+ * @param width_   Image width (pixels)
+ * @param height_  Image height (pixels)
+ * @param fov_x    Horizontal field of view (radians)
+ * @param fov_y    Vertical field of view (radians)
+ */
+PinholeIntrinsics PinholeIntrinsics::from_fov(int width_, int height_, float fov_x, float fov_y) {
+
+    PinholeIntrinsics intrinsics;
+    memset(&intrinsics, 0, sizeof(intrinsics));
+    intrinsics.width = width_;
+    intrinsics.height = height_;
+    intrinsics.fx = width_ / (2.0f * tanf(fov_x * 0.5f));
+    intrinsics.fy = height_ / (2.0f * tanf(fov_y * 0.5f));
+    intrinsics.cx = width_ * 0.5f;
+    intrinsics.cy = height_ * 0.5f;
+    return intrinsics;
+}
+
+
+/**
+ * @brief Reads the intrinsics from a calibration file: one "name value"
+ *        pair per line (width height fx fy cx cy, optionally k1 k2 k3 p1
+ *        p2), '#' starts a comment
+ *
+ * @param path        Calibration file
+ * @param intrinsics  Output intrinsics (unchanged on failure)
+ *
+ * @returns True when the file holds a complete camera
+ */
+bool PinholeIntrinsics::load(const std::string& path, PinholeIntrinsics& intrinsics) {
+
+    PinholeIntrinsics camera;
+    memset(&camera, 0, sizeof(camera));
+    float width = 0, height = 0;
+    const char* const names[] = { "width", "height", "fx", "fy", "cx", "cy", "k1", "k2", "k3", "p1", "p2" };
+    float* const fields[] = { &width, &height, &camera.fx, &camera.fy, &camera.cx, &camera.cy,
+                              &camera.k1, &camera.k2, &camera.k3, &camera.p1, &camera.p2 };
+    unsigned found = 0;
+    if (!read_calibration_file(path, names, fields, sizeof(fields) / sizeof(fields[0]), found)) {
+        return false;
+    }
+
+    // width height fx fy cx cy are required
+    camera.width = (int)width;
+    camera.height = (int)height;
+    if ((found & 0x3Fu) != 0x3Fu || camera.width <= 0 || camera.height <= 0 ||
+        camera.fx <= 0 || camera.fy <= 0) {
+        std::cerr << "[Error][PinholeIntrinsics::load] Incomplete camera in " << path << std::endl;
+        return false;
+    }
+    intrinsics = camera;
+    return true;
+}
+
+
+/**
+ * @brief Reads "name value" pairs from a calibration file, one per line,
+ *        '#' starts a comment
+ *
+ * @param path    Calibration file
+ * @param names   Accepted names
+ * @param fields  Value of each name
+ * @param count   Number of names
+ * @param found   Output bit n set when names[n] was read
+ *
+ * @returns False when the file cannot be read or holds an unknown name
+ */
+bool read_calibration_file(const std::string& path, const char* const* names, float* const* fields,
+                           int count, unsigned& found) {
+
+    FILE* file = fopen(path.c_str(), "r");
+    if (file == NULL) {
+        std::cerr << "[Error][CameraModel] Unable to open " << path << std::endl;
+        return false;
+    }
+
+    found = 0;
+    char line[256];
+    bool valid = true;
+    while (valid && fgets(line, sizeof(line), file)) {
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char name[32];
+        double value;
+        const int read = sscanf(line, "%31s %lf", name, &value);
+        if (read <= 0) {
+            continue;
+        }
+        int f = 0;
+        while (f < count && strcmp(name, names[f]) != 0) {
+            f++;
+        }
+        if (read != 2 || f == count) {
+            std::cerr << "[Error][CameraModel] Invalid line in " << path << ": " << line << std::endl;
+            valid = false;
+            break;
+        }
+        *fields[f] = (float)value;
+        found |= 1u << f;
+    }
+    fclose(file);
+    return valid;
+}
+
+
+bool PinholeIntrinsics::operator==(const PinholeIntrinsics& other) const {
+
+    return width == other.width && height == other.height &&
+           fx == other.fx && fy == other.fy && cx == other.cx && cy == other.cy &&
+           k1 == other.k1 && k2 == other.k2 && k3 == other.k3 && p1 == other.p1 && p2 == other.p2;
+}
+
+
+/**
+ * @brief RayTable constructor (empty until the first update)
+ */
+RayTable::RayTable() :
+built(false) {
+}
+
+
+/**
+ * @brief Rebuilds the table when the intrinsics (or the resolution) differ
+ *        from the ones it was built for. Distorted maps are read from the
+ *        cache file when it holds the same intrinsics, otherwise computed
+ *        and written to it.
+ *
+ * @param intrinsics_  Camera intrinsics
+ * @param cache_path   Cache of the distorted maps (empty: no cache)
+ *
+ * @returns True when the table was rebuilt
+ */
+bool RayTable::update(const PinholeIntrinsics& intrinsics_, const std::string& cache_path) {
+
+    if (built && intrinsics == intrinsics_) {
+        return false;
+    }
+    intrinsics = intrinsics_;
+    built = true;
+
+    if (!intrinsics.distorted()) {
+        map_x.clear();
+        map_y.clear();
+        slope_x.resize(intrinsics.width);
+        slope_y.resize(intrinsics.height);
+        for (int u = 0; u < intrinsics.width; u++) {
+            slope_x[u] = (u - intrinsics.cx) / intrinsics.fx;
+        }
+        for (int v = 0; v < intrinsics.height; v++) {
+            slope_y[v] = (v - intrinsics.cy) / intrinsics.fy;
+        }
+        return true;
+    }
+
+    slope_x.clear();
+    slope_y.clear();
+    if (cache_path.empty() || !load_cache(cache_path)) {
+        compute_maps();
+        if (!cache_path.empty()) {
+            save_cache(cache_path);
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Undistorted ray of every pixel (iterative inversion of the
+ *        distortion model)
+ */
+void RayTable::compute_maps() {
+
+    const int width = intrinsics.width;
+    const int height = intrinsics.height;
+    const double k1 = intrinsics.k1, k2 = intrinsics.k2, k3 = intrinsics.k3;
+    const double p1 = intrinsics.p1, p2 = intrinsics.p2;
+    map_x.resize((size_t)width * height);
+    map_y.resize((size_t)width * height);
+
+    #pragma omp parallel for
+    for (int v = 0; v < height; v++) {
+        const double yd = (v - intrinsics.cy) / intrinsics.fy;
+        for (int u = 0; u < width; u++) {
+            const double xd = (u - intrinsics.cx) / intrinsics.fx;
+            // solve distort(x, y) = (xd, yd), starting from the distorted point
+            double x = xd, y = yd;
+            for (int it = 0; it < kUNDISTORT_ITERATIONS; it++) {
+                const double r2 = x * x + y * y;
+                const double radial = 1.0 + r2 * (k1 + r2 * (k2 + r2 * k3));
+                const double dx = 2.0 * p1 * x * y + p2 * (r2 + 2.0 * x * x);
+                const double dy = p1 * (r2 + 2.0 * y * y) + 2.0 * p2 * x * y;
+                x = (xd - dx) / radial;
+                y = (yd - dy) / radial;
+            }
+            map_x[(size_t)v * width + u] = (float)x;
+            map_y[(size_t)v * width + u] = (float)y;
+        }
+    }
+}
+
+
+/**
+ * @brief Reads the maps from a cache file written for the same intrinsics
+ */
+bool RayTable::load_cache(const std::string& path) {
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    char magic[sizeof(kCACHE_MAGIC)];
+    int version = 0;
+    PinholeIntrinsics cached;
+    bool valid = fread(magic, sizeof(magic), 1, file) == 1 &&
+                 memcmp(magic, kCACHE_MAGIC, sizeof(magic)) == 0 &&
+                 fread(&version, sizeof(version), 1, file) == 1 && version == kCACHE_VERSION &&
+                 fread(&cached, sizeof(cached), 1, file) == 1 && cached == intrinsics;
+    if (valid) {
+        const size_t size = (size_t)intrinsics.width * intrinsics.height;
+        map_x.resize(size);
+        map_y.resize(size);
+        valid = fread(map_x.data(), sizeof(float), size, file) == size &&
+                fread(map_y.data(), sizeof(float), size, file) == size;
+    }
+    fclose(file);
+    return valid;
+}
+
+
+/**
+ * @brief Writes the maps with their intrinsics to a cache file
+ */
+bool RayTable::save_cache(const std::string& path) const {
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        std::cerr << "[Error][RayTable] Unable to write the ray cache " << path << std::endl;
+        return false;
+    }
+    const size_t size = map_x.size();
+    const bool valid = fwrite(kCACHE_MAGIC, sizeof(kCACHE_MAGIC), 1, file) == 1 &&
+                       fwrite(&kCACHE_VERSION, sizeof(kCACHE_VERSION), 1, file) == 1 &&
+                       fwrite(&intrinsics, sizeof(intrinsics), 1, file) == 1 &&
+                       fwrite(map_x.data(), sizeof(float), size, file) == size &&
+                       fwrite(map_y.data(), sizeof(float), size, file) == size;
+    fclose(file);
+    return valid;
+}
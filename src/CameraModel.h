@@ -0,0 +1,163 @@
+//============================================================================
+// Name        : CameraModel.h
+// Copyright   : GWU Research
+// Description : Pinhole camera model and back-projection ray table
+//============================================================================
+
+#pragma once
+
+// C/C++
+#include <string>
+#include <vector>
+
+
+// Pinhole intrinsics of a camera (pixels) with Brown-Conrady lens distortion
+struct PinholeIntrinsics {
+    int     width;
+    int     height;
+    float   fx, fy;         // Focal lengths
+    float   cx, cy;         // Principal point
+    float   k1, k2, k3;     // Radial distortion
+    float   p1, p2;         // Tangential distortion
+
+    /**
+     * @brief Intrinsics of a centered camera with the given fields of view
+     *        (no distortion)
+     *
+     * @param width_   Image width (pixels)
+     * @param height_  Image height (pixels)
+     * @param fov_x    Horizontal field of view (radians)
+     * @param fov_y    Vertical field of view (radians)
+     */
+    static PinholeIntrinsics from_fov(int width_, int height_, float fov_x, float fov_y);
+
+    /**
+     * @brief Reads the intrinsics from a calibration file: one "name value"
+     *        pair per line (width height fx fy cx cy, optionally k1 k2 k3 p1
+     *        p2), '#' starts a comment
+     *
+     * @param path        Calibration file
+     * @param intrinsics  Output intrinsics (unchanged on failure)
+     *
+     * @returns True when the file holds a complete camera
+     */
+    static bool load(const std::string& path, PinholeIntrinsics& intrinsics);
+
+    /**
+     * @brief Pixel of a normalized image point (x / z, y / z), distortion included
+     */
+    inline void project(float x, float y, float& u, float& v) const {
+        const float r2 = x * x + y * y;
+        const float radial = 1.0f + r2 * (k1 + r2 * (k2 + r2 * k3));
+        u = fx * (x * radial + 2.0f * p1 * x * y + p2 * (r2 + 2.0f * x * x)) + cx;
+        v = fy * (y * radial + p1 * (r2 + 2.0f * y * y) + 2.0f * p2 * x * y) + cy;
+    }
+
+    inline bool distorted() const {
+        return k1 != 0 || k2 != 0 || k3 != 0 || p1 != 0 || p2 != 0;
+    }
+
+    bool operator==(const PinholeIntrinsics& other) const;
+    inline bool operator!=(const PinholeIntrinsics& other) const { return !(*this == other); }
+};
+
+
+/**
+ * @brief Reads "name value" pairs from a calibration file, one per line,
+ *        '#' starts a comment
+ *
+ * @param path    Calibration file
+ * @param names   Accepted names
+ * @param fields  Value of each name
+ * @param count   Number of names
+ * @param found   Output bit n set when names[n] was read
+ *
+ * @returns False when the file cannot be read or holds an unknown name
+ */
+bool read_calibration_file(const std::string& path, const char* const* names, float* const* fields,
+                           int count, unsigned& found);
+
+
+// Back-projection rays of a camera: a pixel (u, v) at depth z is the point
+// (z * ray_x, z * ray_y, z). Without distortion the slopes only depend on the
+// column and the row (width + height floats, stays in cache); with distortion
+// every pixel has its undistorted ray in two width x height maps, which can be
+// kept in a cache file so they are computed once per calibration.
+class RayTable {
+
+public:
+
+    /**
+     * @brief RayTable constructor (empty until the first update)
+     */
+    RayTable();
+
+
+    /**
+     * @brief Rebuilds the table when the intrinsics (or the resolution) differ
+     *        from the ones it was built for. Distorted maps are read from the
+     *        cache file when it holds the same intrinsics, otherwise computed
+     *        and written to it.
+     *
+     * @param intrinsics_  Camera intrinsics
+     * @param cache_path   Cache of the distorted maps (empty: no cache)
+     *
+     * @returns True when the table was rebuilt
+     */
+    bool update(const PinholeIntrinsics& intrinsics_, const std::string& cache_path = std::string());
+
+
+    /**
+     * @brief 3D point of a pixel at depth z
+     */
+    inline void back_project(int u, int v, float z, float& x, float& y) const {
+        if (map_x.empty()) {
+            x = z * slope_x[u];
+            y = z * slope_y[v];
+        }
+        else {
+            const int i = v * intrinsics.width + u;
+            x = z * map_x[i];
+            y = z * map_y[i];
+        }
+    }
+
+
+    // Separable slopes, only valid without distortion
+    inline const float* get_slope_x() const { return slope_x.data(); }
+    inline const float* get_slope_y() const { return slope_y.data(); }
+
+    // Per-pixel rays (NULL without distortion)
+    inline const float* get_map_x() const { return map_x.empty() ? NULL : map_x.data(); }
+    inline const float* get_map_y() const { return map_y.empty() ? NULL : map_y.data(); }
+
+    inline const PinholeIntrinsics& get_intrinsics() const { return intrinsics; }
+
+private:
+
+    /**
+     * @brief Undistorted ray of every pixel (iterative inversion of the
+     *        distortion model)
+     */
+    void compute_maps();
+
+
+    /**
+     * @brief Reads the maps from a cache file written for the same intrinsics
+     */
+    bool load_cache(const std::string& path);
+
+
+    /**
+     * @brief Writes the maps with their intrinsics to a cache file
+     */
+    bool save_cache(const std::string& path) const;
+
+
+    PinholeIntrinsics   intrinsics;     // Intrinsics of the current table
+    bool                built;
+    std::vector<float>  slope_x;        // x / z of each column (no distortion)
+    std::vector<float>  slope_y;        // y / z of each row (no distortion)
+    std::vector<float>  map_x;          // x / z of each pixel (distortion)
+    std::vector<float>  map_y;          // y / z of each pixel (distortion)
+};
@@ -0,0 +1,358 @@
+//============================================================================
+// Name        : CenterSeeding.cpp
+// Copyright   : GWU Research
+// Description : Parallel k-means++ and k-means|| seeding
+//============================================================================
+
+#include "CenterSeeding.h"
+
+// C/C++
+#include <algorithm>
+
+
+// Valid points per task of the prefix sum
+static const int kSCAN_BLOCK = 16384;
+
+
+/**
+ * @brief Uniform number in [0,1) from a 64 bit key (splitmix64), lets every
+ *        point draw its own number without sharing a generator between threads
+ */
+static inline double hash_uniform(unsigned long long key) {
+
+    key += 0x9E3779B97F4A7C15ull;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ull;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+    key = key ^ (key >> 31);
+    return (key >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * @brief Squared distance between two points of the frame
+ */
+static inline float distance2(const FrameStore& points, int i, float cx, float cy, float cz) {
+
+    const float dx = points.x[i] - cx;
+    const float dy = points.y[i] - cy;
+    const float dz = points.z[i] - cz;
+    return dx*dx + dy*dy + dz*dz;
+}
+
+
+/**
+ * @brief CenterSeeding constructor
+ *
+ * @param seed  Seed of the random generator
+ */
+CenterSeeding::CenterSeeding(unsigned int seed) :
+rng(seed) {
+}
+
+
+/**
+ * @brief k-means++ seeding with local trials: each new center is the best
+ *        of num_local_tries D^2 samples (smallest potential)
+ *
+ * @param points           Registered frame (valid_index must be built)
+ * @param first            Position in the valid list of the first center
+ * @param k                Number of centers
+ * @param num_local_tries  Samples tried per center
+ * @param centers          Output center positions (k entries)
+ */
+void CenterSeeding::kmeanspp(const FrameStore& points, int first, int k, int num_local_tries, vec3* centers) {
+
+    const int* valid_index = points.valid_index;
+    reset_distances(points, first);
+    centers[0] = vec3(points.x[valid_index[first]], points.y[valid_index[first]], points.z[valid_index[first]]);
+
+    for (int c = 1; c < k; c++) {
+
+        // the best of the local trials is the one with the smallest potential
+        const double total = build_prefix();
+        double best_potential = -1;
+        int best = first;
+        for (int trial = 0; trial < num_local_tries; trial++) {
+            const int candidate = sample(total);
+            const double potential = trial_potential(points, candidate);
+            if (best_potential < 0 || potential < best_potential) {
+                best_potential = potential;
+                best = candidate;
+            }
+        }
+
+        centers[c] = vec3(points.x[valid_index[best]], points.y[valid_index[best]], points.z[valid_index[best]]);
+        update_distances(points, &best, 1, -1);
+    }
+}
+
+
+/**
+ * @brief k-means|| seeding (Bahmani et al.): a few rounds where every point
+ *        is picked independently with probability oversampling*D^2/potential,
+ *        then a weighted k-means++ over the picked candidates
+ *
+ * @param points        Registered frame (valid_index must be built)
+ * @param first         Position in the valid list of the first center
+ * @param k             Number of centers
+ * @param rounds        Number of sampling rounds
+ * @param oversampling  Expected number of candidates per round (in k units)
+ * @param centers       Output center positions (k entries)
+ */
+void CenterSeeding::kmeans_parallel(const FrameStore& points, int first, int k, int rounds,
+                                    float oversampling, vec3* centers) {
+
+    const int num_valid = points.num_valid;
+    const int* valid_index = points.valid_index;
+    const int num_blocks = (num_valid + kSCAN_BLOCK - 1) / kSCAN_BLOCK;
+
+    // 1. oversampling rounds, the picks of a block are kept in block order
+    std::vector<int> candidates(1, first);
+    std::vector< std::vector<int> > block_picks(num_blocks);
+    double potential = reset_distances(points, first);
+    for (int round = 0; round < rounds && potential > 0; round++) {
+
+        const double scale = oversampling * k / potential;
+        const unsigned long long round_key = ((unsigned long long)rng() << 32) | rng();
+        #pragma omp parallel for
+        for (int block = 0; block < num_blocks; block++) {
+            const int begin = block * kSCAN_BLOCK;
+            const int end = std::min(begin + kSCAN_BLOCK, num_valid);
+            block_picks[block].clear();
+            for (int n = begin; n < end; n++) {
+                if (hash_uniform(round_key ^ (unsigned long long)n) < scale * closest_dist[n]) {
+                    block_picks[block].push_back(n);
+                }
+            }
+        }
+
+        const int first_new = (int)candidates.size();
+        for (int block = 0; block < num_blocks; block++) {
+            candidates.insert(candidates.end(), block_picks[block].begin(), block_picks[block].end());
+        }
+        if ((int)candidates.size() == first_new) {
+            continue;
+        }
+        potential = update_distances(points, &candidates[first_new], (int)candidates.size() - first_new, first_new);
+    }
+
+    // 2. weight of a candidate = number of points closer to it than to any other candidate
+    const int num_candidates = (int)candidates.size();
+    std::vector<double> weight(num_candidates, 0.0);
+    #pragma omp parallel
+    {
+        std::vector<int> local(num_candidates, 0);
+        #pragma omp for
+        for (int n = 0; n < num_valid; n++) {
+            local[closest_candidate[n]]++;
+        }
+        #pragma omp critical
+        for (int c = 0; c < num_candidates; c++) {
+            weight[c] += local[c];
+        }
+    }
+
+    // 3. weighted k-means++ over the candidates (a few hundred points, serial)
+    std::vector<vec3> position(num_candidates);
+    for (int c = 0; c < num_candidates; c++) {
+        const int i = valid_index[candidates[c]];
+        position[c] = vec3(points.x[i], points.y[i], points.z[i]);
+    }
+    std::vector<double> candidate_dist(num_candidates);
+    for (int c = 0; c < num_candidates; c++) {
+        const vec3 d = position[c] - position[0];
+        candidate_dist[c] = d.x*d.x + d.y*d.y + d.z*d.z;
+    }
+    centers[0] = position[0];
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (int j = 1; j < k; j++) {
+
+        double total = 0;
+        for (int c = 0; c < num_candidates; c++) {
+            total += weight[c] * candidate_dist[c];
+        }
+        if (total <= 0) {
+            // fewer distinct candidates than centers, fall back on D^2 over the frame
+            const int n = sample(build_prefix());
+            centers[j] = vec3(points.x[valid_index[n]], points.y[valid_index[n]], points.z[valid_index[n]]);
+            update_distances(points, &n, 1, -1);
+            continue;
+        }
+
+        double r = uniform(rng) * total;
+        int pick = num_candidates - 1;
+        for (int c = 0; c < num_candidates; c++) {
+            r -= weight[c] * candidate_dist[c];
+            if (r < 0) {
+                pick = c;
+                break;
+            }
+        }
+
+        centers[j] = position[pick];
+        for (int c = 0; c < num_candidates; c++) {
+            const vec3 d = position[c] - position[pick];
+            candidate_dist[c] = std::min(candidate_dist[c], (double)(d.x*d.x + d.y*d.y + d.z*d.z));
+        }
+    }
+}
+
+
+/**
+ * @brief Uniform seeding: k distinct valid points drawn with equal
+ *        probability (partial Fisher-Yates shuffle of the valid list)
+ *
+ * @param points   Registered frame (valid_index must be built, k <= num_valid)
+ * @param k        Number of centers
+ * @param centers  Output center positions (k entries)
+ */
+void CenterSeeding::uniform(const FrameStore& points, int k, vec3* centers) {
+
+    const int num_valid = points.num_valid;
+    shuffled.assign(points.valid_index, points.valid_index + num_valid);
+    for (int j = 0; j < k && j < num_valid; j++) {
+        std::uniform_int_distribution<int> pick(j, num_valid - 1);
+        std::swap(shuffled[j], shuffled[pick(rng)]);
+        const int i = shuffled[j];
+        centers[j] = vec3(points.x[i], points.y[i], points.z[i]);
+    }
+}
+
+
+/**
+ * @brief Sets closest_dist to the squared distance of every valid point
+ *        to the given point, returns the potential
+ */
+double CenterSeeding::reset_distances(const FrameStore& points, int center) {
+
+    const int num_valid = points.num_valid;
+    const int* valid_index = points.valid_index;
+    closest_dist.resize(num_valid);
+    closest_candidate.resize(num_valid);
+
+    const int c = valid_index[center];
+    const float cx = points.x[c], cy = points.y[c], cz = points.z[c];
+    double potential = 0;
+    #pragma omp parallel for reduction(+:potential)
+    for (int n = 0; n < num_valid; n++) {
+        closest_dist[n] = distance2(points, valid_index[n], cx, cy, cz);
+        closest_candidate[n] = 0;
+        potential += closest_dist[n];
+    }
+    return potential;
+}
+
+
+/**
+ * @brief Lowers closest_dist with the given points, returns the potential.
+ *        When first_candidate >= 0 the points that got closer remember the
+ *        candidate number (first_candidate + position in centers).
+ */
+double CenterSeeding::update_distances(const FrameStore& points, const int* centers, int count, int first_candidate) {
+
+    const int num_valid = points.num_valid;
+    const int* valid_index = points.valid_index;
+
+    std::vector<vec3> position(count);
+    for (int c = 0; c < count; c++) {
+        const int i = valid_index[centers[c]];
+        position[c] = vec3(points.x[i], points.y[i], points.z[i]);
+    }
+
+    double potential = 0;
+    #pragma omp parallel for reduction(+:potential)
+    for (int n = 0; n < num_valid; n++) {
+        const int i = valid_index[n];
+        double best = closest_dist[n];
+        for (int c = 0; c < count; c++) {
+            const double d = distance2(points, i, position[c].x, position[c].y, position[c].z);
+            if (d < best) {
+                best = d;
+                if (first_candidate >= 0) {
+                    closest_candidate[n] = first_candidate + c;
+                }
+            }
+        }
+        closest_dist[n] = best;
+        potential += best;
+    }
+    return potential;
+}
+
+
+/**
+ * @brief Potential if the given point was added as a center (closest_dist
+ *        is left untouched)
+ */
+double CenterSeeding::trial_potential(const FrameStore& points, int center) const {
+
+    const int num_valid = points.num_valid;
+    const int* valid_index = points.valid_index;
+    const int c = valid_index[center];
+    const float cx = points.x[c], cy = points.y[c], cz = points.z[c];
+
+    double potential = 0;
+    #pragma omp parallel for reduction(+:potential)
+    for (int n = 0; n < num_valid; n++) {
+        potential += std::min((double)distance2(points, valid_index[n], cx, cy, cz), closest_dist[n]);
+    }
+    return potential;
+}
+
+
+/**
+ * @brief Parallel inclusive prefix sum of closest_dist into prefix,
+ *        returns the total
+ */
+double CenterSeeding::build_prefix() {
+
+    const int num_valid = (int)closest_dist.size();
+    const int num_blocks = (num_valid + kSCAN_BLOCK - 1) / kSCAN_BLOCK;
+    prefix.resize(num_valid);
+    block_sum.resize(num_blocks + 1);
+
+    // 1. scan of each block
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kSCAN_BLOCK;
+        const int end = std::min(begin + kSCAN_BLOCK, num_valid);
+        double sum = 0;
+        for (int n = begin; n < end; n++) {
+            sum += closest_dist[n];
+            prefix[n] = sum;
+        }
+        block_sum[block + 1] = sum;
+    }
+
+    // 2. exclusive scan of the block totals
+    block_sum[0] = 0;
+    for (int block = 0; block < num_blocks; block++) {
+        block_sum[block + 1] += block_sum[block];
+    }
+
+    // 3. each block adds the total of the blocks before it
+    #pragma omp parallel for
+    for (int block = 1; block < num_blocks; block++) {
+        const int begin = block * kSCAN_BLOCK;
+        const int end = std::min(begin + kSCAN_BLOCK, num_valid);
+        const double offset = block_sum[block];
+        for (int n = begin; n < end; n++) {
+            prefix[n] += offset;
+        }
+    }
+    return block_sum[num_blocks];
+}
+
+
+/**
+ * @brief Draws a position in the valid list with probability proportional
+ *        to its D^2 weight
+ */
+int CenterSeeding::sample(double total) {
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double r = uniform(rng) * total;
+    const int n = (int)(std::upper_bound(prefix.begin(), prefix.end(), r) - prefix.begin());
+    return std::min(n, (int)prefix.size() - 1);
+}
@@ -0,0 +1,117 @@
+//============================================================================
+// Name        : CenterSeeding.h
+// Copyright   : GWU Research
+// Description : Parallel k-means++ and k-means|| seeding
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+#include "vec3.h"
+
+// C/C++
+#include <random>
+#include <vector>
+
+
+// Seeds the k-means centers from the valid points of a frame.
+// Both modes sample points with probability proportional to D^2, the squared
+// distance to the closest center chosen so far. The D^2 weights live in a
+// prefix sum built in parallel, so a sample is a binary search. All the
+// per-point arrays are kept between frames and only grow.
+class CenterSeeding {
+
+public:
+
+    /**
+     * @brief CenterSeeding constructor
+     *
+     * @param seed  Seed of the random generator
+     */
+    explicit CenterSeeding(unsigned int seed = 5489u);
+
+
+    /**
+     * @brief k-means++ seeding with local trials: each new center is the best
+     *        of num_local_tries D^2 samples (smallest potential)
+     *
+     * @param points           Registered frame (valid_index must be built)
+     * @param first            Position in the valid list of the first center
+     * @param k                Number of centers
+     * @param num_local_tries  Samples tried per center
+     * @param centers          Output center positions (k entries)
+     */
+    void kmeanspp(const FrameStore& points, int first, int k, int num_local_tries, vec3* centers);
+
+
+    /**
+     * @brief k-means|| seeding (Bahmani et al.): a few rounds where every point
+     *        is picked independently with probability oversampling*D^2/potential,
+     *        then a weighted k-means++ over the picked candidates
+     *
+     * @param points        Registered frame (valid_index must be built)
+     * @param first         Position in the valid list of the first center
+     * @param k             Number of centers
+     * @param rounds        Number of sampling rounds
+     * @param oversampling  Expected number of candidates per round (in k units)
+     * @param centers       Output center positions (k entries)
+     */
+    void kmeans_parallel(const FrameStore& points, int first, int k, int rounds,
+                         float oversampling, vec3* centers);
+
+
+    /**
+     * @brief Uniform seeding: k distinct valid points drawn with equal
+     *        probability (partial Fisher-Yates shuffle of the valid list)
+     *
+     * @param points   Registered frame (valid_index must be built, k <= num_valid)
+     * @param k        Number of centers
+     * @param centers  Output center positions (k entries)
+     */
+    void uniform(const FrameStore& points, int k, vec3* centers);
+
+private:
+
+    /**
+     * @brief Sets closest_dist to the squared distance of every valid point
+     *        to the given point, returns the potential
+     */
+    double reset_distances(const FrameStore& points, int center);
+
+
+    /**
+     * @brief Lowers closest_dist with the given points, returns the potential.
+     *        When first_candidate >= 0 the points that got closer remember the
+     *        candidate number (first_candidate + position in centers).
+     */
+    double update_distances(const FrameStore& points, const int* centers, int count, int first_candidate);
+
+
+    /**
+     * @brief Potential if the given point was added as a center (closest_dist
+     *        is left untouched)
+     */
+    double trial_potential(const FrameStore& points, int center) const;
+
+
+    /**
+     * @brief Parallel inclusive prefix sum of closest_dist into prefix,
+     *        returns the total
+     */
+    double build_prefix();
+
+
+    /**
+     * @brief Draws a position in the valid list with probability proportional
+     *        to its D^2 weight
+     */
+    int sample(double total);
+
+
+    std::vector<double> closest_dist;       // D^2 of each valid point
+    std::vector<double> prefix;             // Inclusive prefix sum of closest_dist
+    std::vector<double> block_sum;          // Per-block totals of the prefix sum
+    std::vector<int>    closest_candidate;  // Closest k-means|| candidate of each valid point
+    std::vector<int>    shuffled;           // Valid list shuffled by the uniform seeding
+    std::mt19937        rng;
+};
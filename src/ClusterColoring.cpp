@@ -0,0 +1,177 @@
+//============================================================================
+// Name        : ClusterColoring.cpp
+// Copyright   : GWU Research
+// Description : Fused cluster palette to BGRX output kernels
+//============================================================================
+
+#include "ClusterColoring.h"
+
+// C/C++
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+
+/**
+ * @brief Packs a color into RGBQUAD byte order (blue, green, red, reserved)
+ */
+static inline unsigned int pack_bgrx(float r, float g, float b) {
+
+    const unsigned int ur = (unsigned int)std::min(std::max(r + 0.5f, 0.0f), 255.0f);
+    const unsigned int ug = (unsigned int)std::min(std::max(g + 0.5f, 0.0f), 255.0f);
+    const unsigned int ub = (unsigned int)std::min(std::max(b + 0.5f, 0.0f), 255.0f);
+    return ub | (ug << 8) | (ur << 16);
+}
+
+
+/**
+ * @brief Builds the palette from the cluster colors (0-255 per channel)
+ *
+ * @param colors  Cluster colors
+ * @param k_      Number of clusters
+ */
+void ClusterPalette::set(const vec3* colors, int k_) {
+
+    k = k_;
+    r.resize(k);
+    g.resize(k);
+    b.resize(k);
+    bgrx.resize(k);
+    for (int j = 0; j < k; j++) {
+        r[j] = colors[j].x;
+        g[j] = colors[j].y;
+        b[j] = colors[j].z;
+        bgrx[j] = pack_bgrx(r[j], g[j], b[j]);
+    }
+}
+
+
+/**
+ * @brief Hard labels: one table lookup per pixel
+ */
+static void color_labels(const FrameStore& points, const ClusterPalette& palette,
+                         int begin, int count, unsigned int* bgrx) {
+
+    const unsigned int k = (unsigned int)palette.k;
+    const unsigned int* table = palette.bgrx.data();
+    const int end = begin + count;
+    for (int i = begin; i < end; i++) {
+        const unsigned int label = (unsigned int)points.label[i];
+        bgrx[i] = (points.mask[i] && label < k) ? table[label] : 0;
+    }
+}
+
+
+/**
+ * @brief Scalar membership blend
+ */
+static void color_weighted_scalar(const FrameStore& points, const ClusterPalette& palette,
+                                  int begin, int count, unsigned int* bgrx) {
+
+    const size_t plane = points.size;
+    const int end = begin + count;
+    for (int i = begin; i < end; i++) {
+        if (!points.mask[i]) {
+            bgrx[i] = 0;
+            continue;
+        }
+        float r = 0, g = 0, b = 0;
+        for (int j = 0; j < palette.k; j++) {
+            const float u = points.membership[j * plane + i];
+            r += u * palette.r[j];
+            g += u * palette.g[j];
+            b += u * palette.b[j];
+        }
+        bgrx[i] = pack_bgrx(r, g, b);
+    }
+}
+
+
+/**
+ * @brief SSE4.2 membership blend, 4 pixels at once
+ */
+KERNEL_TARGET_SSE42 static void color_weighted_sse42(const FrameStore& points, const ClusterPalette& palette,
+                                 int begin, int count, unsigned int* bgrx) {
+
+    const size_t plane = points.size;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max_channel = _mm_set1_ps(255.0f);
+    const int end = begin + count;
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 r = zero, g = zero, b = zero;
+        for (int j = 0; j < palette.k; j++) {
+            const __m128 u = _mm_loadu_ps(points.membership + j * plane + i);
+            r = _mm_add_ps(r, _mm_mul_ps(u, _mm_set1_ps(palette.r[j])));
+            g = _mm_add_ps(g, _mm_mul_ps(u, _mm_set1_ps(palette.g[j])));
+            b = _mm_add_ps(b, _mm_mul_ps(u, _mm_set1_ps(palette.b[j])));
+        }
+        const __m128i ir = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(r, zero), max_channel));
+        const __m128i ig = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(g, zero), max_channel));
+        const __m128i ib = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(b, zero), max_channel));
+        const __m128i packed = _mm_or_si128(ib, _mm_or_si128(_mm_slli_epi32(ig, 8), _mm_slli_epi32(ir, 16)));
+
+        // bool mask bytes to a 32 bit lane mask
+        int mask_bytes;
+        memcpy(&mask_bytes, points.mask + i, sizeof(mask_bytes));
+        const __m128i valid = _mm_cmpgt_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(mask_bytes)), _mm_setzero_si128());
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bgrx + i), _mm_and_si128(packed, valid));
+    }
+    color_weighted_scalar(points, palette, i, end - i, bgrx);
+}
+
+
+/**
+ * @brief AVX2 membership blend, 8 pixels at once
+ */
+KERNEL_TARGET_AVX2 static void color_weighted_avx2(const FrameStore& points, const ClusterPalette& palette,
+                                int begin, int count, unsigned int* bgrx) {
+
+    const size_t plane = points.size;
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 max_channel = _mm256_set1_ps(255.0f);
+    const int end = begin + count;
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 r = zero, g = zero, b = zero;
+        for (int j = 0; j < palette.k; j++) {
+            const __m256 u = _mm256_loadu_ps(points.membership + j * plane + i);
+            r = _mm256_fmadd_ps(u, _mm256_set1_ps(palette.r[j]), r);
+            g = _mm256_fmadd_ps(u, _mm256_set1_ps(palette.g[j]), g);
+            b = _mm256_fmadd_ps(u, _mm256_set1_ps(palette.b[j]), b);
+        }
+        const __m256i ir = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(r, zero), max_channel));
+        const __m256i ig = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(g, zero), max_channel));
+        const __m256i ib = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(b, zero), max_channel));
+        const __m256i packed = _mm256_or_si256(ib, _mm256_or_si256(_mm256_slli_epi32(ig, 8), _mm256_slli_epi32(ir, 16)));
+
+        // bool mask bytes to a 32 bit lane mask
+        const __m128i mask_bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(points.mask + i));
+        const __m256i valid = _mm256_cmpgt_epi32(_mm256_cvtepu8_epi32(mask_bytes), _mm256_setzero_si256());
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(bgrx + i), _mm256_and_si256(packed, valid));
+    }
+    color_weighted_scalar(points, palette, i, end - i, bgrx);
+}
+
+
+/**
+ * @brief Returns the coloring kernel for the given instruction set; the
+ *        weighted kernels blend the palette by the membership planes, the
+ *        others look up the hard label
+ */
+ColoringKernel select_coloring_kernel(KERNEL_ISA isa, bool weighted) {
+
+    if (!weighted) {
+        return color_labels;
+    }
+    switch (isa) {
+    case KERNEL_AVX2:
+        return color_weighted_avx2;
+    case KERNEL_SSE42:
+        return color_weighted_sse42;
+    default:
+        return color_weighted_scalar;
+    }
+}
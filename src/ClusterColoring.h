@@ -0,0 +1,56 @@
+//============================================================================
+// Name        : ClusterColoring.h
+// Copyright   : GWU Research
+// Description : Fused cluster palette to BGRX output kernels
+//============================================================================
+
+#pragma once
+
+#include "ClusteringKernels.h"
+#include "FrameStore.h"
+#include "vec3.h"
+
+// C/C++
+#include <vector>
+
+
+// Cluster colors, planar floats for the membership blend and packed BGRX
+// (RGBQUAD byte order) for the hard label lookup
+struct ClusterPalette {
+
+    ClusterPalette() : k(0) {}
+
+    /**
+     * @brief Builds the palette from the cluster colors (0-255 per channel)
+     *
+     * @param colors  Cluster colors
+     * @param k_      Number of clusters
+     */
+    void set(const vec3* colors, int k_);
+
+    int k;
+    std::vector<float>          r, g, b;    // Channel of each cluster
+    std::vector<unsigned int>   bgrx;       // Packed color of each cluster
+};
+
+
+/**
+ * @brief Writes the cluster color of a range of pixels as packed BGRX,
+ *        invalid pixels are black
+ *
+ * @param points   Registered frame (labels or membership planes)
+ * @param palette  Cluster colors
+ * @param begin    First pixel
+ * @param count    Number of pixels
+ * @param bgrx     Output image, indexed by pixel
+ */
+typedef void (*ColoringKernel)(const FrameStore& points, const ClusterPalette& palette,
+                               int begin, int count, unsigned int* bgrx);
+
+
+/**
+ * @brief Returns the coloring kernel for the given instruction set; the
+ *        weighted kernels blend the palette by the membership planes, the
+ *        others look up the hard label
+ */
+ColoringKernel select_coloring_kernel(KERNEL_ISA isa, bool weighted);
@@ -0,0 +1,404 @@
+//============================================================================
+// Name        : ClusterReduction.cpp
+// Copyright   : GWU Research
+// Description : Parallel per-cluster sums for the k-means centroid update
+//============================================================================
+
+#include "ClusterReduction.h"
+
+// C/C++
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+
+// the partial sums are cache line aligned so the threads never share a line,
+// outside MSVC they come from posix_memalign
+static ClusterSum* allocate_sums(int count) {
+#ifdef _MSC_VER
+    return static_cast<ClusterSum*>(_aligned_malloc(count * sizeof(ClusterSum), kCACHE_LINE));
+#else
+    void* memory = NULL;
+    if (posix_memalign(&memory, kCACHE_LINE, count * sizeof(ClusterSum)) != 0) {
+        memory = NULL;
+    }
+    return static_cast<ClusterSum*>(memory);
+#endif
+}
+
+static void release_sums(ClusterSum* sums) {
+#ifdef _MSC_VER
+    _aligned_free(sums);
+#else
+    free(sums);
+#endif
+}
+
+
+/**
+ * @brief ClusterReduction constructor
+ */
+ClusterReduction::ClusterReduction() :
+partial(NULL),
+capacity(0),
+num_slots(0),
+num_clusters(0) {
+}
+
+
+/**
+ * @brief ClusterReduction destructor
+ */
+ClusterReduction::~ClusterReduction() {
+
+    if (partial) {
+        release_sums(partial);
+    }
+}
+
+
+/**
+ * @brief Clears all the partial sums
+ *
+ * @param num_slots_     Number of partial sums (threads or blocks)
+ * @param num_clusters_  Number of clusters
+ */
+void ClusterReduction::reset(int num_slots_, int num_clusters_) {
+
+    num_slots = num_slots_;
+    num_clusters = num_clusters_;
+
+    const int required = num_slots * num_clusters;
+    if (required > capacity) {
+        if (partial) {
+            release_sums(partial);
+        }
+        partial = allocate_sums(required);
+        capacity = required;
+    }
+    memset(partial, 0, required * sizeof(ClusterSum));
+}
+
+
+/**
+ * @brief Adds the listed points to the partial sums of a slot, using the
+ *        current point labels (weighted by points.weight when set)
+ *
+ * @param slot    Partial sum to update
+ * @param points  Registered frame
+ * @param index   Point indices (valid points)
+ * @param count   Number of indices
+ * @param dist    Distance of each point to its center, indexed by point (may be NULL)
+ */
+void ClusterReduction::accumulate(int slot, const FrameStore& points, const int* index, int count,
+                                  const float* dist) {
+
+    ClusterSum* sums = slot_sums(slot);
+    if (points.weight) {
+        for (int n = 0; n < count; n++) {
+            const int i = index[n];
+            const double w = points.weight[i];
+            ClusterSum& sum = sums[points.label[i]];
+            sum.x += w * points.x[i];
+            sum.y += w * points.y[i];
+            sum.z += w * points.z[i];
+            sum.weight += w;
+            sum.count++;
+            if (dist) {
+                sum.inertia += w * dist[i] * dist[i];
+            }
+        }
+        return;
+    }
+
+    for (int n = 0; n < count; n++) {
+        const int i = index[n];
+        ClusterSum& sum = sums[points.label[i]];
+        sum.x += points.x[i];
+        sum.y += points.y[i];
+        sum.z += points.z[i];
+        sum.count++;
+        if (dist) {
+            sum.inertia += dist[i] * dist[i];
+        }
+    }
+}
+
+
+/**
+ * @brief Same sums as accumulate, plus the colors, normals and position
+ *        products of the points for the cluster statistics
+ *
+ * @param slot    Partial sum to update
+ * @param points  Registered frame
+ * @param index   Point indices (valid points)
+ * @param count   Number of indices
+ * @param dist    Distance of each point to its center, indexed by point (may be NULL)
+ */
+void ClusterReduction::accumulate_moments(int slot, const FrameStore& points, const int* index, int count,
+                                          const float* dist) {
+
+    ClusterSum* sums = slot_sums(slot);
+    for (int n = 0; n < count; n++) {
+        const int i = index[n];
+        const double w = points.weight ? points.weight[i] : 1.0;
+        const double x = points.x[i], y = points.y[i], z = points.z[i];
+        ClusterSum& sum = sums[points.label[i]];
+        sum.x += w * x;
+        sum.y += w * y;
+        sum.z += w * z;
+        sum.xx += w * x * x;
+        sum.xy += w * x * y;
+        sum.xz += w * x * z;
+        sum.yy += w * y * y;
+        sum.yz += w * y * z;
+        sum.zz += w * z * z;
+        sum.r += w * points.r[i];
+        sum.g += w * points.g[i];
+        sum.b += w * points.b[i];
+        sum.nx += w * points.nx[i];
+        sum.ny += w * points.ny[i];
+        sum.nz += w * points.nz[i];
+        // unweighted points leave the weight at zero, merge then divides by the
+        // count, which is all the temporal mode patches
+        if (points.weight) {
+            sum.weight += w;
+        }
+        sum.count++;
+        if (dist) {
+            sum.inertia += w * dist[i] * dist[i];
+        }
+    }
+}
+
+
+/**
+ * @brief Adds the listed points to the partial sums of a slot, weighting
+ *        each point by membership^m for every cluster (fuzzy c-means)
+ *
+ * @param slot        Partial sum to update
+ * @param points      Registered frame
+ * @param index       Point indices (valid points)
+ * @param count       Number of indices
+ * @param membership  Membership planes (points.size entries per cluster)
+ * @param fuzzifier   Fuzzifier m
+ * @param dist        sqrt of the point objective, indexed by point (may be NULL)
+ */
+void ClusterReduction::accumulate_fuzzy(int slot, const FrameStore& points, const int* index, int count,
+                                        const float* membership, float fuzzifier, const float* dist) {
+
+    ClusterSum* sums = slot_sums(slot);
+    for (int j = 0; j < num_clusters; j++) {
+        const float* membership_j = membership + (size_t)j * points.size;
+        ClusterSum& sum = sums[j];
+        for (int n = 0; n < count; n++) {
+            const int i = index[n];
+            const float u = membership_j[i];
+            double w = (fuzzifier == 2.0f) ? u * u : pow(u, fuzzifier);
+            if (points.weight) {
+                w *= points.weight[i];
+            }
+            sum.weight += w;
+            sum.x += w * points.x[i];
+            sum.y += w * points.y[i];
+            sum.z += w * points.z[i];
+            sum.r += w * points.r[i];
+            sum.g += w * points.g[i];
+            sum.b += w * points.b[i];
+            sum.nx += w * points.nx[i];
+            sum.ny += w * points.ny[i];
+            sum.nz += w * points.nz[i];
+        }
+    }
+
+    for (int n = 0; n < count; n++) {
+        const int i = index[n];
+        ClusterSum& sum = sums[points.label[i]];
+        sum.count++;
+        if (dist) {
+            sum.inertia += (points.weight ? points.weight[i] : 1.0f) * dist[i] * dist[i];
+        }
+    }
+}
+
+
+/**
+ * @brief Merges the weighted partial sums in slot order into the center
+ *        attributes (clusters without weight keep their attributes)
+ *
+ * @param centers  Centers to update
+ */
+void ClusterReduction::merge_fuzzy(KernelCenters& centers) const {
+
+    for (int j = 0; j < num_clusters; j++) {
+        ClusterSum total;
+        memset(&total, 0, sizeof(total));
+        for (int slot = 0; slot < num_slots; slot++) {
+            const ClusterSum& sum = partial[(size_t)slot * num_clusters + j];
+            total.weight += sum.weight;
+            total.x += sum.x;
+            total.y += sum.y;
+            total.z += sum.z;
+            total.r += sum.r;
+            total.g += sum.g;
+            total.b += sum.b;
+            total.nx += sum.nx;
+            total.ny += sum.ny;
+            total.nz += sum.nz;
+        }
+
+        if (total.weight > 0) {
+            const double inv_weight = 1.0 / total.weight;
+            centers.px[j] = float(total.x * inv_weight);
+            centers.py[j] = float(total.y * inv_weight);
+            centers.pz[j] = float(total.z * inv_weight);
+            centers.cr[j] = float(total.r * inv_weight);
+            centers.cg[j] = float(total.g * inv_weight);
+            centers.cb[j] = float(total.b * inv_weight);
+            centers.nx[j] = float(total.nx * inv_weight);
+            centers.ny[j] = float(total.ny * inv_weight);
+            centers.nz[j] = float(total.nz * inv_weight);
+        }
+    }
+}
+
+
+/**
+ * @brief Merges the partial sums in slot order and returns the means
+ *
+ * @param centers  Output cluster means ((0,0,0) for empty clusters)
+ * @param counts   Output number of points per cluster (may be NULL)
+ */
+void ClusterReduction::merge(vec3* centers, int* counts) const {
+
+    for (int j = 0; j < num_clusters; j++) {
+        double x = 0, y = 0, z = 0, weight = 0;
+        int count = 0;
+        for (int slot = 0; slot < num_slots; slot++) {
+            const ClusterSum& sum = partial[(size_t)slot * num_clusters + j];
+            x += sum.x;
+            y += sum.y;
+            z += sum.z;
+            weight += sum.weight;
+            count += sum.count;
+        }
+
+        // weighted points (voxels) are averaged by weight, the others by count
+        const double total = (weight > 0) ? weight : count;
+        if (count) {
+            centers[j] = vec3(float(x / total), float(y / total), float(z / total));
+        }
+        else {
+            centers[j] = vec3(0, 0, 0);
+        }
+        if (counts) {
+            counts[j] = count;
+        }
+    }
+}
+
+
+/**
+ * @brief Merges the moments summed by accumulate_moments in slot order
+ *        into the statistics of every cluster (mean, covariance, oriented
+ *        box, mean color and normal)
+ *
+ * @param stats  Output statistics, one per cluster
+ */
+void ClusterReduction::merge_moments(ClusterStats* stats) const {
+
+    for (int j = 0; j < num_clusters; j++) {
+        ClusterSum total;
+        memset(&total, 0, sizeof(total));
+        for (int slot = 0; slot < num_slots; slot++) {
+            const ClusterSum& sum = partial[(size_t)slot * num_clusters + j];
+            total.x += sum.x;
+            total.y += sum.y;
+            total.z += sum.z;
+            total.xx += sum.xx;
+            total.xy += sum.xy;
+            total.xz += sum.xz;
+            total.yy += sum.yy;
+            total.yz += sum.yz;
+            total.zz += sum.zz;
+            total.r += sum.r;
+            total.g += sum.g;
+            total.b += sum.b;
+            total.nx += sum.nx;
+            total.ny += sum.ny;
+            total.nz += sum.nz;
+            total.weight += sum.weight;
+            total.count += sum.count;
+        }
+
+        ClusterStats& cluster = stats[j];
+        cluster = ClusterStats();
+        // weighted points (voxels) are averaged by weight, the others by count
+        const double total_weight = (total.weight > 0) ? total.weight : total.count;
+        cluster.count = total.count;
+        cluster.weight = total_weight;
+        if (total.count == 0 || total_weight <= 0) {
+            continue;
+        }
+
+        const double inv_weight = 1.0 / total_weight;
+        const double mean[3] = { total.x * inv_weight, total.y * inv_weight, total.z * inv_weight };
+        cluster.mean = vec3(float(mean[0]), float(mean[1]), float(mean[2]));
+        cluster.color = vec3(float(total.r * inv_weight), float(total.g * inv_weight), float(total.b * inv_weight));
+
+        const double length = sqrt(total.nx * total.nx + total.ny * total.ny + total.nz * total.nz);
+        if (length > 0) {
+            cluster.normal = vec3(float(total.nx / length), float(total.ny / length), float(total.nz / length));
+        }
+
+        // covariance = E[p p^T] - mean mean^T
+        const double products[3][3] = {
+            { total.xx, total.xy, total.xz },
+            { total.xy, total.yy, total.yz },
+            { total.xz, total.yz, total.zz } };
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                cluster.covariance[r][c] = float(products[r][c] * inv_weight - mean[r] * mean[c]);
+            }
+        }
+        compute_oriented_box(cluster);
+    }
+}
+
+
+/**
+ * @brief Total of the squared point-to-center distances over all the slots
+ */
+double ClusterReduction::inertia() const {
+
+    double total = 0;
+    for (int n = 0; n < num_slots * num_clusters; n++) {
+        total += partial[n].inertia;
+    }
+    return total;
+}
+
+
+/**
+ * @brief Adds the merged partial sums of another reduction (same number of
+ *        clusters) to the first slot of this one
+ *
+ * @param partials  Reduction to fold in
+ */
+void ClusterReduction::absorb(const ClusterReduction& partials) {
+
+    for (int slot = 0; slot < partials.num_slots; slot++) {
+        const ClusterSum* sums = partials.partial + (size_t)slot * partials.num_clusters;
+        for (int j = 0; j < num_clusters; j++) {
+            partial[j].x += sums[j].x;
+            partial[j].y += sums[j].y;
+            partial[j].z += sums[j].z;
+            partial[j].inertia += sums[j].inertia;
+            partial[j].weight += sums[j].weight;
+            partial[j].count += sums[j].count;
+        }
+    }
+}
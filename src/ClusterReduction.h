@@ -0,0 +1,164 @@
+//============================================================================
+// Name        : ClusterReduction.h
+// Copyright   : GWU Research
+// Description : Parallel per-cluster sums for the k-means centroid update
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+#include "ClusteringKernels.h"
+#include "ClusterStatistics.h"
+#include "vec3.h"
+
+
+// Size of a cache line, partial sums never share one
+static const int kCACHE_LINE = 64;
+
+
+// Running sums of one cluster, padded to whole cache lines so that two
+// threads never write to the same line
+struct alignas(kCACHE_LINE) ClusterSum {
+    double  x, y, z;        // Sum of the point positions (membership weighted in fuzzy mode)
+    double  inertia;        // Sum of the squared point-to-center distances
+    double  weight;         // Sum of the memberships^m (fuzzy mode) or point weights (weighted points)
+    double  r, g, b;        // Sum of the weighted point colors (fuzzy mode, moments)
+    double  nx, ny, nz;     // Sum of the weighted point normals (fuzzy mode, moments)
+    double  xx, xy, xz;     // Sum of the weighted position products (moments)
+    double  yy, yz, zz;
+    int     count;          // Number of points (hard labels)
+};
+
+
+// Per-slot partial sums of the centroid update.
+// A slot is either a thread (fast mode) or a fixed block of the valid point
+// list (deterministic mode). In both cases the slots are merged in slot order,
+// so with per-block slots the result is bit-identical for any thread count.
+class ClusterReduction {
+
+public:
+
+    /**
+     * @brief ClusterReduction constructor
+     */
+    ClusterReduction();
+
+
+    /**
+     * @brief ClusterReduction destructor
+     */
+    ~ClusterReduction();
+
+
+    /**
+     * @brief Clears all the partial sums
+     *
+     * @param num_slots_     Number of partial sums (threads or blocks)
+     * @param num_clusters_  Number of clusters
+     */
+    void reset(int num_slots_, int num_clusters_);
+
+
+    /**
+     * @brief Adds the listed points to the partial sums of a slot, using the
+     *        current point labels (weighted by points.weight when set)
+     *
+     * @param slot    Partial sum to update
+     * @param points  Registered frame
+     * @param index   Point indices (valid points)
+     * @param count   Number of indices
+     * @param dist    Distance of each point to its center, indexed by point (may be NULL)
+     */
+    void accumulate(int slot, const FrameStore& points, const int* index, int count,
+                    const float* dist = NULL);
+
+
+    /**
+     * @brief Same sums as accumulate, plus the colors, normals and position
+     *        products of the points for the cluster statistics
+     *
+     * @param slot    Partial sum to update
+     * @param points  Registered frame
+     * @param index   Point indices (valid points)
+     * @param count   Number of indices
+     * @param dist    Distance of each point to its center, indexed by point (may be NULL)
+     */
+    void accumulate_moments(int slot, const FrameStore& points, const int* index, int count,
+                            const float* dist = NULL);
+
+
+    /**
+     * @brief Adds the listed points to the partial sums of a slot, weighting
+     *        each point by membership^m for every cluster (fuzzy c-means)
+     *
+     * @param slot        Partial sum to update
+     * @param points      Registered frame
+     * @param index       Point indices (valid points)
+     * @param count       Number of indices
+     * @param membership  Membership planes (points.size entries per cluster)
+     * @param fuzzifier   Fuzzifier m
+     * @param dist        sqrt of the point objective, indexed by point (may be NULL)
+     */
+    void accumulate_fuzzy(int slot, const FrameStore& points, const int* index, int count,
+                          const float* membership, float fuzzifier, const float* dist = NULL);
+
+
+    /**
+     * @brief Merges the weighted partial sums in slot order into the center
+     *        attributes (clusters without weight keep their attributes)
+     *
+     * @param centers  Centers to update
+     */
+    void merge_fuzzy(KernelCenters& centers) const;
+
+
+    /**
+     * @brief Merges the partial sums in slot order and returns the means
+     *
+     * @param centers  Output cluster means ((0,0,0) for empty clusters)
+     * @param counts   Output number of points per cluster (may be NULL)
+     */
+    void merge(vec3* centers, int* counts) const;
+
+
+    /**
+     * @brief Merges the moments summed by accumulate_moments in slot order
+     *        into the statistics of every cluster (mean, covariance, oriented
+     *        box, mean color and normal)
+     *
+     * @param stats  Output statistics, one per cluster
+     */
+    void merge_moments(ClusterStats* stats) const;
+
+
+    /**
+     * @brief Total of the squared point-to-center distances over all the slots
+     */
+    double inertia() const;
+
+
+    /**
+     * @brief Adds the merged partial sums of another reduction (same number of
+     *        clusters) to the first slot of this one
+     *
+     * @param partials  Reduction to fold in
+     */
+    void absorb(const ClusterReduction& partials);
+
+
+    /**
+     * @brief Partial sums of a slot
+     */
+    inline ClusterSum* slot_sums(int slot) {
+        return partial + (size_t)slot * num_clusters;
+    }
+
+private:
+    ClusterSum* partial;        // num_slots x num_clusters partial sums
+    int         capacity;       // Allocated partial sums
+    int         num_slots;
+    int         num_clusters;
+
+    ClusterReduction(const ClusterReduction&);
+    ClusterReduction& operator=(const ClusterReduction&);
+};
@@ -0,0 +1,119 @@
+//============================================================================
+// Name        : ClusterStatistics.cpp
+// Copyright   : GWU Research
+// Description : Per-cluster geometry (moments, PCA oriented boxes)
+//============================================================================
+
+#include "ClusterStatistics.h"
+
+// C/C++
+#include <cmath>
+#include <utility>
+
+
+// Jacobi sweeps, 3x3 matrices converge to double precision in 4-6
+static const int kJACOBI_SWEEPS = 16;
+
+
+/**
+ * @brief Eigen-decomposition of a symmetric 3x3 matrix (cyclic Jacobi)
+ *
+ * @param matrix   Symmetric matrix
+ * @param values   Output eigenvalues, sorted largest first
+ * @param vectors  Output unit eigenvectors (vectors[n] goes with values[n])
+ */
+void symmetric_eigen_3x3(const double matrix[3][3], double values[3], double vectors[3][3]) {
+
+    double a[3][3], v[3][3];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            a[r][c] = matrix[r][c];
+            v[r][c] = (r == c) ? 1.0 : 0.0;
+        }
+    }
+
+    for (int sweep = 0; sweep < kJACOBI_SWEEPS; sweep++) {
+        const double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        const double diag = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+        if (off <= 1e-30 * diag || off == 0) {
+            break;
+        }
+        // rotate away each off-diagonal entry in turn
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                if (a[p][q] == 0) {
+                    continue;
+                }
+                const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                const double t = ((theta >= 0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                const double c = 1.0 / sqrt(t * t + 1.0);
+                const double s = t * c;
+                for (int k = 0; k < 3; k++) {
+                    const double akp = a[k][p], akq = a[k][q];
+                    a[k][p] = c * akp - s * akq;
+                    a[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    const double apk = a[p][k], aqk = a[q][k];
+                    a[p][k] = c * apk - s * aqk;
+                    a[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    const double vkp = v[k][p], vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    // eigenvectors are the columns of v, sort them by eigenvalue
+    int order[3] = { 0, 1, 2 };
+    for (int n = 0; n < 2; n++) {
+        for (int m = n + 1; m < 3; m++) {
+            if (a[order[m]][order[m]] > a[order[n]][order[n]]) {
+                std::swap(order[n], order[m]);
+            }
+        }
+    }
+    for (int n = 0; n < 3; n++) {
+        values[n] = a[order[n]][order[n]];
+        for (int k = 0; k < 3; k++) {
+            vectors[n][k] = v[k][order[n]];
+        }
+    }
+}
+
+
+/**
+ * @brief Fills the covariance derived fields of a cluster (eigenvalues, box
+ *        axes and half extents) from its covariance. The box covers the
+ *        points of a uniform distribution with that covariance: half extent
+ *        sqrt(3 * eigenvalue) along each axis.
+ *
+ * @param stats  Cluster with count and covariance set
+ */
+void compute_oriented_box(ClusterStats& stats) {
+
+    double matrix[3][3], values[3], vectors[3][3];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            matrix[r][c] = stats.covariance[r][c];
+        }
+    }
+    symmetric_eigen_3x3(matrix, values, vectors);
+
+    float extent[3];
+    for (int n = 0; n < 3; n++) {
+        // rounding can leave a flat cluster with a tiny negative eigenvalue
+        const double value = (values[n] > 0) ? values[n] : 0.0;
+        stats.eigenvalues[n] = float(value);
+        extent[n] = float(sqrt(3.0 * value));
+        stats.axes[n] = vec3(float(vectors[n][0]), float(vectors[n][1]), float(vectors[n][2]));
+    }
+    // third axis from the first two keeps the frame right handed
+    const vec3& e0 = stats.axes[0];
+    const vec3& e1 = stats.axes[1];
+    stats.axes[2] = vec3(e0.y * e1.z - e0.z * e1.y, e0.z * e1.x - e0.x * e1.z, e0.x * e1.y - e0.y * e1.x);
+    stats.half_extents = vec3(extent[0], extent[1], extent[2]);
+}
@@ -0,0 +1,44 @@
+//============================================================================
+// Name        : ClusterStatistics.h
+// Copyright   : GWU Research
+// Description : Per-cluster geometry (moments, PCA oriented boxes)
+//============================================================================
+
+#pragma once
+
+#include "vec3.h"
+
+
+// Geometry of one cluster, from the moments summed by the centroid update
+struct ClusterStats {
+    int     count;              // Number of points (0: empty cluster, the rest is zero)
+    double  weight;             // Total point weight (count for unweighted frames)
+    vec3    mean;               // Mean position
+    float   covariance[3][3];   // Position covariance
+    float   eigenvalues[3];     // Covariance eigenvalues, largest first
+    vec3    axes[3];            // Oriented box axes (unit eigenvectors, right handed)
+    vec3    half_extents;       // Oriented box half sizes along the axes
+    vec3    color;              // Mean color
+    vec3    normal;             // Mean normal (unit length, zero when the normals cancel)
+};
+
+
+/**
+ * @brief Eigen-decomposition of a symmetric 3x3 matrix (cyclic Jacobi)
+ *
+ * @param matrix   Symmetric matrix
+ * @param values   Output eigenvalues, sorted largest first
+ * @param vectors  Output unit eigenvectors (vectors[n] goes with values[n])
+ */
+void symmetric_eigen_3x3(const double matrix[3][3], double values[3], double vectors[3][3]);
+
+
+/**
+ * @brief Fills the covariance derived fields of a cluster (eigenvalues, box
+ *        axes and half extents) from its covariance. The box covers the
+ *        points of a uniform distribution with that covariance: half extent
+ *        sqrt(3 * eigenvalue) along each axis.
+ *
+ * @param stats  Cluster with count and covariance set
+ */
+void compute_oriented_box(ClusterStats& stats);
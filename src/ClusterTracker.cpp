@@ -0,0 +1,234 @@
+//============================================================================
+// Name        : ClusterTracker.cpp
+// Copyright   : GWU Research
+// Description : Frame to frame tracking of the cluster centroids
+//============================================================================
+
+#include "ClusterTracker.h"
+
+// C/C++
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+/**
+ * @brief Minimum cost assignment of a square matrix (Hungarian method with
+ *        potentials, O(n^3))
+ *
+ * @param costs       n x n costs, row major
+ * @param n           Matrix size
+ * @param assignment  Output column of every row
+ */
+void solve_assignment(const double* costs, int n, int* assignment) {
+
+    // 1-based potentials u (rows), v (columns); match[c] is the row of column c
+    std::vector<double> u(n + 1, 0.0), v(n + 1, 0.0), min_slack(n + 1);
+    std::vector<int> match(n + 1, 0), way(n + 1, 0);
+    std::vector<bool> used(n + 1);
+
+    for (int row = 1; row <= n; row++) {
+        match[0] = row;
+        int column = 0;
+        std::fill(min_slack.begin(), min_slack.end(), DBL_MAX);
+        std::fill(used.begin(), used.end(), false);
+        // grow an alternating path until it reaches a free column
+        do {
+            used[column] = true;
+            const int r = match[column];
+            double delta = DBL_MAX;
+            int next = 0;
+            for (int c = 1; c <= n; c++) {
+                if (used[c]) {
+                    continue;
+                }
+                const double slack = costs[(size_t)(r - 1) * n + (c - 1)] - u[r] - v[c];
+                if (slack < min_slack[c]) {
+                    min_slack[c] = slack;
+                    way[c] = column;
+                }
+                if (min_slack[c] < delta) {
+                    delta = min_slack[c];
+                    next = c;
+                }
+            }
+            for (int c = 0; c <= n; c++) {
+                if (used[c]) {
+                    u[match[c]] += delta;
+                    v[c] -= delta;
+                }
+                else {
+                    min_slack[c] -= delta;
+                }
+            }
+            column = next;
+        } while (match[column] != 0);
+        // flip the path
+        do {
+            const int previous = way[column];
+            match[column] = match[previous];
+            column = previous;
+        } while (column != 0);
+    }
+
+    for (int c = 1; c <= n; c++) {
+        assignment[match[c] - 1] = c - 1;
+    }
+}
+
+
+/**
+ * @brief ClusterTracker constructor
+ *
+ * @param params_  Association weights
+ */
+ClusterTracker::ClusterTracker(const TrackerParams& params_) :
+params(params_),
+next_id(0) {
+}
+
+
+/**
+ * @brief Drops all the tracks
+ */
+void ClusterTracker::reset() {
+
+    tracks.clear();
+}
+
+
+/**
+ * @brief Association cost of a cluster with a track
+ */
+float ClusterTracker::cost(const ClusterStats& cluster, const ClusterTrack& track) const {
+
+    // the track is expected where its velocity takes it
+    const float steps = float(track.missed + 1);
+    const float dx = cluster.mean.x - (track.position.x + track.velocity.x * steps);
+    const float dy = cluster.mean.y - (track.position.y + track.velocity.y * steps);
+    const float dz = cluster.mean.z - (track.position.z + track.velocity.z * steps);
+    const float dr = cluster.color.x - track.color.x;
+    const float dg = cluster.color.y - track.color.y;
+    const float db = cluster.color.z - track.color.z;
+    const float size_change = fabsf(logf(float(cluster.count) / std::max(track.size, 1.0f)));
+
+    return sqrtf(dx*dx + dy*dy + dz*dz) / params.position_scale +
+           sqrtf(dr*dr + dg*dg + db*db) / params.color_scale +
+           size_change * params.size_weight;
+}
+
+
+/**
+ * @brief Matches the clusters of a frame with the tracks and updates them;
+ *        empty clusters are not matched
+ *
+ * @param stats         Statistics of each cluster
+ * @param num_clusters  Number of clusters
+ */
+void ClusterTracker::update(const ClusterStats* stats, int num_clusters) {
+
+    // square matrix: clusters x tracks, padded with "no match" entries
+    const int num_tracks = (int)tracks.size();
+    const int n = std::max(num_clusters, num_tracks);
+    const double no_match = params.max_cost;
+    costs.assign((size_t)n * n, no_match);
+    for (int j = 0; j < num_clusters; j++) {
+        if (stats[j].count == 0) {
+            continue;
+        }
+        for (int t = 0; t < num_tracks; t++) {
+            costs[(size_t)j * n + t] = std::min(double(cost(stats[j], tracks[t])), 2.0 * no_match);
+        }
+    }
+    assignment.resize(n);
+    solve_assignment(&costs[0], n, &assignment[0]);
+
+    for (int t = 0; t < num_tracks; t++) {
+        tracks[t].cluster = -1;
+    }
+    for (int j = 0; j < num_clusters; j++) {
+        const ClusterStats& cluster = stats[j];
+        if (cluster.count == 0) {
+            continue;
+        }
+        const int t = assignment[j];
+        if (t < num_tracks && costs[(size_t)j * n + t] < no_match) {
+            // matched: blend the motion since the last sighting into the velocity
+            ClusterTrack& track = tracks[t];
+            const float steps = float(track.missed + 1);
+            const float a = params.velocity_smoothing;
+            const vec3 motion((cluster.mean.x - track.position.x) / steps,
+                              (cluster.mean.y - track.position.y) / steps,
+                              (cluster.mean.z - track.position.z) / steps);
+            track.velocity = (track.age > 0) ?
+                vec3(a * motion.x + (1 - a) * track.velocity.x,
+                     a * motion.y + (1 - a) * track.velocity.y,
+                     a * motion.z + (1 - a) * track.velocity.z) : motion;
+            track.cluster = j;
+            track.position = cluster.mean;
+            track.color = cluster.color;
+            track.size = float(cluster.count);
+            track.age++;
+            track.missed = 0;
+        }
+        else {
+            ClusterTrack track;
+            track.id = next_id++;
+            track.cluster = j;
+            track.position = cluster.mean;
+            track.velocity = vec3(0, 0, 0);
+            track.color = cluster.color;
+            track.size = float(cluster.count);
+            track.age = 0;
+            track.missed = 0;
+            tracks.push_back(track);
+        }
+    }
+
+    // unmatched tracks wait max_missed frames for their object to come back
+    size_t live = 0;
+    for (size_t t = 0; t < tracks.size(); t++) {
+        if (tracks[t].cluster < 0) {
+            tracks[t].missed++;
+        }
+        if (tracks[t].missed <= params.max_missed) {
+            tracks[live++] = tracks[t];
+        }
+    }
+    tracks.resize(live);
+}
+
+
+/**
+ * @brief Predicted centroid of every cluster for the next frame (position
+ *        plus velocity of its track); clusters without a track are left
+ *        unchanged
+ *
+ * @param centers       In: current centers, out: predicted centers
+ * @param num_clusters  Number of clusters
+ */
+void ClusterTracker::predict(vec3* centers, int num_clusters) const {
+
+    for (size_t t = 0; t < tracks.size(); t++) {
+        const ClusterTrack& track = tracks[t];
+        if (track.cluster >= 0 && track.cluster < num_clusters) {
+            centers[track.cluster] = vec3(track.position.x + track.velocity.x,
+                                          track.position.y + track.velocity.y,
+                                          track.position.z + track.velocity.z);
+        }
+    }
+}
+
+
+/**
+ * @brief Track of a cluster in the last frame (-1: none)
+ */
+int ClusterTracker::track_of_cluster(int cluster) const {
+
+    for (size_t t = 0; t < tracks.size(); t++) {
+        if (tracks[t].cluster == cluster) {
+            return tracks[t].id;
+        }
+    }
+    return -1;
+}
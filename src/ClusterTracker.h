@@ -0,0 +1,125 @@
+//============================================================================
+// Name        : ClusterTracker.h
+// Copyright   : GWU Research
+// Description : Frame to frame tracking of the cluster centroids
+//============================================================================
+
+#pragma once
+
+#include "ClusterStatistics.h"
+#include "vec3.h"
+
+// C/C++
+#include <vector>
+
+
+// One tracked object
+struct ClusterTrack {
+    int     id;             // Stable track id (never reused)
+    int     cluster;        // Cluster of the last frame (-1: not seen in the last frame)
+    vec3    position;       // Last centroid
+    vec3    velocity;       // Smoothed centroid motion per frame
+    vec3    color;          // Last mean color
+    float   size;           // Last number of points
+    int     age;            // Frames since the track started
+    int     missed;         // Consecutive frames without a matching cluster
+};
+
+
+// Association weights of the tracker; the cost of a cluster-track pair is
+// distance / position_scale + color difference / color_scale
+// + |log(size ratio)| * size_weight
+struct TrackerParams {
+    float   position_scale = 0.10f;     // Centroid distance worth one cost unit (meters)
+    float   color_scale = 60.0f;        // Mean color distance worth one cost unit
+    float   size_weight = 0.5f;         // Cost of a factor e size change
+    float   max_cost = 4.0f;            // Pairs above this cost start a new track
+    float   velocity_smoothing = 0.5f;  // Weight of the newest motion in the velocity
+    int     max_missed = 10;            // Frames a lost track is kept for re-association
+};
+
+
+// Associates the clusters of consecutive frames with tracks. The clusters of a
+// frame are matched to the predicted (constant velocity) track positions by an
+// optimal assignment over the cluster x track costs (Hungarian method, the
+// matrices are only k x k), and the predictions seed the next frame.
+class ClusterTracker {
+
+public:
+
+    /**
+     * @brief ClusterTracker constructor
+     *
+     * @param params_  Association weights
+     */
+    ClusterTracker(const TrackerParams& params_ = TrackerParams());
+
+
+    /**
+     * @brief Drops all the tracks
+     */
+    void reset();
+
+
+    /**
+     * @brief Matches the clusters of a frame with the tracks and updates them;
+     *        empty clusters are not matched
+     *
+     * @param stats         Statistics of each cluster
+     * @param num_clusters  Number of clusters
+     */
+    void update(const ClusterStats* stats, int num_clusters);
+
+
+    /**
+     * @brief Predicted centroid of every cluster for the next frame (position
+     *        plus velocity of its track); clusters without a track are left
+     *        unchanged
+     *
+     * @param centers       In: current centers, out: predicted centers
+     * @param num_clusters  Number of clusters
+     */
+    void predict(vec3* centers, int num_clusters) const;
+
+
+    /**
+     * @brief Track of a cluster in the last frame (-1: none)
+     */
+    int track_of_cluster(int cluster) const;
+
+
+    /**
+     * @brief Live tracks (seen in the last max_missed frames)
+     */
+    inline const std::vector<ClusterTrack>& get_tracks() const { return tracks; }
+
+
+    inline void set_params(const TrackerParams& params_) { params = params_; }
+    inline const TrackerParams& get_params() const { return params; }
+
+private:
+
+    /**
+     * @brief Association cost of a cluster with a track
+     */
+    float cost(const ClusterStats& cluster, const ClusterTrack& track) const;
+
+
+    TrackerParams               params;
+    std::vector<ClusterTrack>   tracks;
+    int                         next_id;
+
+    std::vector<double>         costs;          // Square cost matrix of the assignment
+    std::vector<int>            assignment;     // Column assigned to each row
+};
+
+
+/**
+ * @brief Minimum cost assignment of a square matrix (Hungarian method with
+ *        potentials, O(n^3))
+ *
+ * @param costs       n x n costs, row major
+ * @param n           Matrix size
+ * @param assignment  Output column of every row
+ */
+void solve_assignment(const double* costs, int n, int* assignment);
@@ -4,76 +4,85 @@
 #include <fstream>
 #include <sstream>
 #include <limits>
+#include <cfloat>
 #include <string>
+#include <vector>
 #include "vec3.h"
-#include <thread>
-#include <future>
-#include <ppl.h>
+#include "ClusteringKernels.h"
+#include <algorithm>
+#include <cstring>
 #include <omp.h>
-// Windows
-#include <Kinect.h>
-#include <Windows.h>
-#include <Strsafe.h>
-using namespace Concurrency;
+#include <chrono>
 using namespace std;
 
 #define PI 3.141592653589793238462643383279502884197169399375105820974944592307816406286208998
 
+// Points handed to the assignment kernel per task
+static const int kASSIGN_BLOCK = 16384;
 
+// k-means|| seeding: sampling rounds and candidates per round (in k units)
+static const int kPARALLEL_SEEDING_ROUNDS = 5;
+static const float kPARALLEL_SEEDING_OVERSAMPLING = 2.0f;
 
+// Pixel of the first k-means++/k-means|| seed (first valid point at or after it)
+static const int kFIRST_SEED_PIXEL = 959549;
 
-inline float inner(const vec3 &v1, const vec3 &v2) {
-	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
-}
+// Relative safety margin of the bound test, covers the float rounding of the
+// bounds so a skipped point is always strictly closer to its own center
+static const float kBOUND_EPSILON = 1e-4f;
 
 
 
-inline float CalculateDistance_(const vec3 &v1, const vec3 &v2)
-{
-	return (float)sqrt((v1.x - v2.x)*(v1.x - v2.x) + (v1.y - v2.y)*(v1.y - v2.y) + (v1.z - v2.z)*(v1.z - v2.z));
-}
-inline float Clustering::CalculateDistance(const vec3 &v1, const vec3 &v2, const vec3 &c1, const vec3 &c2, const vec3 &n1, const vec3 &n2, bool considerColor, bool considerNormal)
-{
-	float dist = 0.0;
 
-	if (considerColor)
-	{
+typedef std::chrono::steady_clock ClusteringClock;
 
+// Milliseconds elapsed since a time point
+static inline double ElapsedMs(const ClusteringClock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(ClusteringClock::now() - start).count();
+}
 
-		dist = sqrtf(gama*gama*((v1.x - v2.x)*(v1.x - v2.x) + (v1.y - v2.y)*(v1.y - v2.y) + (v1.z - v2.z)*(v1.z - v2.z)) +
-			//alpha*((c1.x - c2.x)*(c1.x - c2.x) + (c1.y - c2.y)*(c1.y - c2.y) + (c1.z - c2.z)*(c1.z - c2.z)));
+float CalculateClusterChange(vec3* center_of_cluster_old, vec3* center_of_cluster, int nNumCluster);
 
-			alpha*alpha*((c1.x - c2.x)*(c1.x - c2.x) + (c1.y - c2.y)*(c1.y - c2.y) + (c1.z - c2.z)*(c1.z - c2.z)));
-	}
-	else
-		dist = sqrtf(gama*(v1.x - v2.x)*(v1.x - v2.x) + (v1.y - v2.y)*(v1.y - v2.y) + (v1.z - v2.z)*(v1.z - v2.z));
-
-	if (considerNormal)
+// Drift of every center between two iterations, plus the largest and second
+// largest drift (the lower bound of a point moves by the largest drift of the
+// centers it is not assigned to)
+static void CalculateCenterDrift(const KernelCenters& from, const KernelCenters& to, const KernelParams& params,
+	float* drift, int& nMaxDriftCenter, float& fMaxDrift, float& fSecondMaxDrift)
+{
+	nMaxDriftCenter = 0;
+	fMaxDrift = fSecondMaxDrift = 0;
+	for (int j = 0; j < to.k; j++)
 	{
-		float fWeight = 0.0001;
-		if (!((n1.x == 0) && (n1.y == 0) && (n1.z == 0)))
-			dist += fWeight * (1 - inner(n1, n2));
+		drift[j] = center_drift(from, to, j, params);
+		if (drift[j] > fMaxDrift)
+		{
+			fSecondMaxDrift = fMaxDrift;
+			fMaxDrift = drift[j];
+			nMaxDriftCenter = j;
+		}
+		else if (drift[j] > fSecondMaxDrift)
+			fSecondMaxDrift = drift[j];
 	}
-
-	return dist;
 }
 
-//assigned Labels 
-void Clustering::assigned_label(int i, int label)
+inline float CalculateDistance_(const vec3 &v1, const vec3 &v2)
 {
-	input[i].Label_c[label] += 1.0;
-	float sum = 0.0;
-	/*for (int j = 0; j < nNumCluster; j++)
-	{
-	if (input[i].Label_c[j] < 0.01) input[i].Label_c[j] = 0.01;
-	sum += (input[i].Label_c[j] );
-	}*/
-
-	//sum = sqrtf(sum);
-#pragma parallel
-
+	return (float)sqrt((v1.x - v2.x)*(v1.x - v2.x) + (v1.y - v2.y)*(v1.y - v2.y) + (v1.z - v2.z)*(v1.z - v2.z));
+}
+//assigned Labels: the label of each listed point gets +1, then all the weights are halved
+void Clustering::assigned_label(const int* index, int count)
+{
+	const int* label = input->label;
 	for (int j = 0; j < nNumCluster; j++)
-		input[i].Label_c[j] /= 2.0;
+	{
+		float* weight = input->membership_plane(j);
+		for (int n = 0; n < count; n++)
+		{
+			const int i = index[n];
+			weight[i] = (weight[i] + (label[i] == j ? 1.0f : 0.0f)) * 0.5f;
+		}
+	}
 }
 
 /********************************************************************
@@ -84,76 +93,29 @@ void Clustering::assigned_label(int i, int label)
 void Clustering::Clustering_KMeans()
 {
 	// Added by Manal: Automatic uniformally seeding for k-means and k-means++ seeding for k-means
-	// g_bAutoSeedingType values: 1: choose smart seeds, 2: choose uniformaly at random
-	float fThreshold = 1.0, fChange, fMinDist, fDistance;
 	// Choose the number of clusters, k.	
 	// 1. Automatically generate k clusters and determine the cluster centers, or directly generate k random points as cluster centers.
-	bool bAutomaticSeed = false;
-	int terminationIteration = 1;
-
-	if (center_of_cluster == NULL)
-	{
-		bAutomaticSeed = true;
-		terminationIteration = 1;
-		center_of_cluster = new vec3[nNumCluster];
-		for (register int i = 0; i < IMAGESIZE; i++)
-		{
-			for (register int j = 0; j < nNumCluster; j++)
-			{
-				input[i].Label_c[j] = 0.0;
+	const ClusteringClock::time_point frameStart = ClusteringClock::now();
 
-			}
-			input[i].Label = 0;
+	// every pass below walks the packed list of valid points
+	const int* valid_index = input->valid_index;
+	const int num_valid = input->num_valid;
+	if (num_valid == 0)
+		return;
 
-		}
-	}
+	// seeds of the first frame, same dispatch as the other modes
+	if (center_of_cluster == NULL)
+		SeedCenters();
+	telemetry.frame++;
+	telemetry.records.clear();
 
 	//to hold the automatic generated seeds
 	vec3* center_of_cluster_ = new vec3[nNumCluster];
 	vec3* normal_center_of_cluster = new vec3[nNumCluster];
 
 	// copy seed to the center of the cluster
-	if (bAutomaticSeed == false)
-		for (register int i = 0; i<nNumCluster; i++)
-			center_of_cluster_[i] = center_of_cluster[i];
-
-	else
-	{
-		// intialize the labels to zero before we start
-
-		// Output: center_of_cluster_, normal_center_of_cluster
-		fThreshold = 0.1;
-		if (AutoSeedingType == 1)
-		{
-			//ChooseSmartCenters(center_of_cluster_, 5);
-
-			ChooseSmartCenters( center_of_cluster_, 5);//changed for parallel processing 
-			//thread_ChooseSmartCenters.join();//changed for parallel processing 
-			
-			char * pFileName = "D:\\SEEDS.TXT";
-			FILE *fc = fopen(pFileName, "w+");
-			for (int l = 0; l < nNumCluster; l++)
-				fprintf(fc, "%f	%f	%f\n", center_of_cluster_[l].x, center_of_cluster_[l].y, center_of_cluster_[l].z);
-			fclose(fc);
-
-		}
-		else if (AutoSeedingType == 2)
-		{
-			ChooseUniformCenters( center_of_cluster_);
-			//thread_ChooseUniformCenters.join();
-
-			//ChooseUniformCenters(center_of_cluster_);
-		}
-
-		else
-		{
-			//printf("no clustering centers are specified!");
-			return;
-		}
-
-		//read from file and put in center_of_cluster_[l].x, center_of_cluster_[l].y, center_of_cluster_[l].z of # of clusters
-
-	}
+	for (register int i = 0; i<nNumCluster; i++)
+		center_of_cluster_[i] = center_of_cluster[i];
 
 	//after each iteration, check the center of the cluster to see if there is changes or not, if not, we got the optimal center
 	vec3* center_of_cluster_old = new vec3[nNumCluster];
@@ -161,153 +123,766 @@ void Clustering::Clustering_KMeans()
 	int* centerIndeces = new int[nNumCluster];
 	int iterationCounter = 0;
 
+	// accelerated mode: centers of the previous iteration and per-center drift
+	KernelCenters previous_centers(nNumCluster);
+	std::vector<float> drift(nNumCluster);
+	// the kernel always stores the distance to the center (inertia), the second closest
+	// distance is only needed by the bounds (the temporal mode needs them as well)
+	float* upper_bound = input->upper_bound;
+	float* lower_bound = (accelerated || temporal) ? input->lower_bound : NULL;
+
 	////////////////////////////////////////
 	// Repeat the two steps
 
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-
+	const int nNumThreads = num_threads > 0 ? num_threads : omp_get_max_threads();
+	const int nNumBlocks = (num_valid + kASSIGN_BLOCK - 1) / kASSIGN_BLOCK;
+	const int nMaxIterations = max(termination.max_iterations, 1);
+	TERMINATION_REASON reason = TERMINATION_MAX_ITERATIONS;
 	do
 	{
+		const ClusteringClock::time_point iterationStart = ClusteringClock::now();
 		iterationCounter++;
-#pragma omp parallel
+#pragma omp parallel for num_threads(nNumThreads)
 		//#pragma loop(hint_parallel(32))
-		for (register int j = 0; j < nNumCluster; j++)
+		for (int j = 0; j < nNumCluster; j++)
 		{
 			//centerIndeces[j] = GetNearestNeighborIndex(center_of_cluster_[j]);
 
 			
 			centerIndeces[j] = GetNearestNeighborIndex(center_of_cluster_[j]);
-			center_of_cluster_[j] = input[centerIndeces[j]].Pos3D;
+			center_of_cluster_[j] = position(centerIndeces[j]);
 			center_of_cluster_old[j] = center_of_cluster_[j];
 		}
 		//for all surface points
 		// 2. Assign each point to the nearest cluster center, where "nearest" is defined with respect to one of the distance measures.
 		// Distance Measure: Distance, Normal, Color
 
-		//#pragma loop(hint_parallel(32))
-#pragma omp parallel num_threads(32)
+		// center attributes are gathered once per iteration
+		KernelCenters centers(nNumCluster);
+		for (register int j = 0; j < nNumCluster; j++)
+		{
+			const int c = centerIndeces[j];
+			centers.px[j] = center_of_cluster_[j].x; centers.py[j] = center_of_cluster_[j].y; centers.pz[j] = center_of_cluster_[j].z;
+			centers.cr[j] = input->r[c]; centers.cg[j] = input->g[c]; centers.cb[j] = input->b[c];
+			centers.nx[j] = input->nx[c]; centers.ny[j] = input->ny[c]; centers.nz[j] = input->nz[c];
+		}
+		KernelParams params;
+		params.position_weight2 = gama * gama;
+		params.color_weight2 = alpha * alpha;
+		params.normal_weight = fWeight;
+
+		// the kernel scores 8 (AVX2) or 4 (SSE4.2) points against all the centers at once,
+		// 3. and the new cluster centers are summed while the block is still in cache.
+		// Each thread (or block, in deterministic mode) owns its partial sums.
+		reduction.reset(deterministic ? nNumBlocks : nNumThreads, nNumCluster);
+
+		// with bounds from the previous iteration, the centers drift is all that is needed
+		// to rule out most of the points: u + drift(a) < l - max drift(j != a)
+		const bool use_bounds = accelerated && iterationCounter > 1;
+		int nMaxDriftCenter = 0;
+		float fMaxDrift = 0, fSecondMaxDrift = 0;
+		if (use_bounds)
 		{
+			CalculateCenterDrift(previous_centers, centers, params, &drift[0], nMaxDriftCenter, fMaxDrift, fSecondMaxDrift);
+			candidate_buffer.resize((size_t)nNumThreads * kASSIGN_BLOCK);
+		}
 
-			for (register int i = 0; i < IMAGESIZE; i++)
+		long long nSkipped = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(nNumThreads) reduction(+:nSkipped)
+		for (int block = 0; block < nNumBlocks; block++)
+		{
+			const int begin = block * kASSIGN_BLOCK;
+			const int count = min(kASSIGN_BLOCK, num_valid - begin);
+			if (use_bounds)
+			{
+				int* candidates = &candidate_buffer[(size_t)omp_get_thread_num() * kASSIGN_BLOCK];
+				int nNumCandidates = 0;
+				for (int n = begin; n < begin + count; n++)
+				{
+					const int i = valid_index[n];
+					const int a = input->label[i];
+					const float u = upper_bound[i] + drift[a];
+					const float l = lower_bound[i] - (a == nMaxDriftCenter ? fSecondMaxDrift : fMaxDrift);
+					upper_bound[i] = u;
+					lower_bound[i] = l;
+					if (u * (1.0f + kBOUND_EPSILON) < l)
+						nSkipped++;
+					else
+						candidates[nNumCandidates++] = i;
+				}
+				assign_kernel(*input, centers, params, candidates, nNumCandidates, input->label, upper_bound, lower_bound);
+			}
+			else
+				assign_kernel(*input, centers, params, valid_index + begin, count, input->label, upper_bound, lower_bound);
+			assigned_label(valid_index + begin, count);
+			// the statistics moments are summed in the same pass, on the block already in cache
+			if (cluster_stats || tracking)
+				reduction.accumulate_moments(deterministic ? block : omp_get_thread_num(), *input, valid_index + begin, count, upper_bound);
+			else
+				reduction.accumulate(deterministic ? block : omp_get_thread_num(), *input, valid_index + begin, count, upper_bound);
+		}
+		// averging
+		reduction.merge(center_of_cluster_, nNumPointInCluster);
+		previous_centers = centers;
+		///////////////////////////////////////
+		// Calculate the termination condition
+		// if the centers of the cluster change less than threshold, the iteration stops. 
+		const float fChange = CalculateClusterChange(center_of_cluster_old, center_of_cluster_, nNumCluster);
 
+		IterationRecord record;
+		record.center_shift = fChange;
+		record.inertia = reduction.inertia();
+		record.time_ms = ElapsedMs(iterationStart);
+		record.skipped_evaluations = nSkipped * nNumCluster;
+		telemetry.records.push_back(record);
 
-			{
+		if (termination.shift_threshold > 0 && fChange < termination.shift_threshold)
+		{
+			reason = TERMINATION_CONVERGED;
+			break;
+		}
+		// stop if one more iteration like the last one would overrun the budget
+		if (termination.time_budget_ms > 0 && iterationCounter < nMaxIterations &&
+			ElapsedMs(frameStart) + record.time_ms > termination.time_budget_ms)
+		{
+			reason = TERMINATION_TIME_BUDGET;
+			break;
+		}
 
-				int new_cluster = 0;
-				if (Mask[i])
-				{
-					fMinDist = 100000;
-					float sum = 0.0;
-#pragma omp parallel
-#pragma loop(no_vector)
-					//#pragma loop(hint_parallel(32))
-					for (int j = 0; j < nNumCluster; j++)
-					{
-						// Distance: ecludian distance
-						fDistance = CalculateDistance(input[i].Pos3D, center_of_cluster_[j], input[i].color/*input[i].color*/, input[centerIndeces[j]].color /*input[centerIndeces[j]].color*/,
-							input[i].normal, input[centerIndeces[j]].normal, true, true);
+	} while (iterationCounter < nMaxIterations);
 
+													  // save the center_of_cluster_ in the same array of the seeds
+	for (int i = 0; i < nNumCluster; i++)
+		center_of_cluster[i] = center_of_cluster_[i];
 
-						if (fDistance < fMinDist)
-						{
-							fMinDist = fDistance;
-							new_cluster = j;
-							input[i].Label = j;
+	// the sums of the last iteration belong to the final labels
+	if (cluster_stats || tracking)
+	{
+		stats.resize(nNumCluster);
+		reduction.merge_moments(&stats[0]);
+		stats_fresh = true;
+	}
 
-						}
-					}
-					assigned_label(i, new_cluster);
+	delete[]center_of_cluster_;
+	delete[]normal_center_of_cluster;
+	delete[]center_of_cluster_old;
+	delete[]nNumPointInCluster;
+	delete[]centerIndeces;
 
+	telemetry.iterations = iterationCounter;
+	telemetry.inertia = telemetry.records.back().inertia;
+	telemetry.reason = reason;
+	telemetry.time_ms = ElapsedMs(frameStart);
+	ReportFrame();
 
+	// the next frames start from the labels, bounds and sums of the last iteration
+	if (temporal)
+	{
+		tracked_centers = previous_centers;
+		tracked_sums.reset(1, nNumCluster);
+		tracked_sums.absorb(reduction);
+		input->save_reference();
+		temporal_ready = true;
+		temporal_frames = 0;
+	}
+}
 
+/********************************************************************
+** Temporal (incremental) k-means: one more k-means iteration on top of
+** the previous frame. Pixels whose position/color moved less than the
+** tolerance and whose bounds still hold keep their label and their
+** reference values in the cluster sums; all the other pixels are
+** re-evaluated and their contribution to the sums is patched.
+********************************************************************/
+void Clustering::Clustering_Incremental()
+{
+	const ClusteringClock::time_point frameStart = ClusteringClock::now();
+	const int nNumThreads = num_threads > 0 ? num_threads : omp_get_max_threads();
+	const int nNumBlocks = (input->size + kASSIGN_BLOCK - 1) / kASSIGN_BLOCK;
+	KernelParams params;
+	params.position_weight2 = gama * gama;
+	params.color_weight2 = alpha * alpha;
+	params.normal_weight = fWeight;
+
+	// averaging: new center positions from the tracked sums, color and normal stay
+	// the ones of the last snapped centers
+	vec3* center_of_cluster_ = new vec3[nNumCluster];
+	int* nNumPointInCluster = new int[nNumCluster];
+	tracked_sums.merge(center_of_cluster_, nNumPointInCluster);
+	KernelCenters centers = tracked_centers;
+	for (int j = 0; j < nNumCluster; j++)
+	{
+		if (nNumPointInCluster[j])
+		{
+			centers.px[j] = center_of_cluster_[j].x; centers.py[j] = center_of_cluster_[j].y; centers.pz[j] = center_of_cluster_[j].z;
+		}
+	}
+
+	std::vector<float> drift(nNumCluster);
+	int nMaxDriftCenter;
+	float fMaxDrift, fSecondMaxDrift;
+	CalculateCenterDrift(tracked_centers, centers, params, &drift[0], nMaxDriftCenter, fMaxDrift, fSecondMaxDrift);
+
+	// all the pixels are visited, the ones that left the mask are removed from the sums
+	const bool* mask = input->mask;
+	bool* ref_mask = input->ref_mask;
+	const int* label = input->label;
+	float* upper_bound = input->upper_bound;
+	float* lower_bound = input->lower_bound;
+	candidate_buffer.resize((size_t)nNumThreads * kASSIGN_BLOCK);
+	reduction.reset(deterministic ? nNumBlocks : nNumThreads, nNumCluster);
+
+	long long nReevaluated = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(nNumThreads) reduction(+:nReevaluated)
+	for (int block = 0; block < nNumBlocks; block++)
+	{
+		const int begin = block * kASSIGN_BLOCK;
+		const int end = min(begin + kASSIGN_BLOCK, input->size);
+		ClusterSum* delta = reduction.slot_sums(deterministic ? block : omp_get_thread_num());
+		int* candidates = &candidate_buffer[(size_t)omp_get_thread_num() * kASSIGN_BLOCK];
+		int nNumCandidates = 0;
+
+		for (int i = begin; i < end; i++)
+		{
+			if (!mask[i] && !ref_mask[i])
+				continue;
+
+			if (ref_mask[i])
+			{
+				const int a = label[i];
+				if (mask[i])
+				{
+					// how far the pixel moved in the clustering metric
+					const float dx = input->x[i] - input->ref_x[i], dy = input->y[i] - input->ref_y[i], dz = input->z[i] - input->ref_z[i];
+					const float dr = input->r[i] - input->ref_r[i], dg = input->g[i] - input->ref_g[i], db = input->b[i] - input->ref_b[i];
+					const float fMove = sqrtf(params.position_weight2 * (dx*dx + dy*dy + dz*dz) + params.color_weight2 * (dr*dr + dg*dg + db*db));
+
+					// the bounds hold for the reference values, the move widens them
+					const float u = upper_bound[i] + drift[a];
+					const float l = lower_bound[i] - (a == nMaxDriftCenter ? fSecondMaxDrift : fMaxDrift);
+					upper_bound[i] = u;
+					lower_bound[i] = l;
+					if (fMove <= temporal_tolerance && (u + fMove) * (1.0f + kBOUND_EPSILON) < l - fMove)
+						continue;
 				}
+
+				// remove the reference contribution
+				delta[a].x -= input->ref_x[i];
+				delta[a].y -= input->ref_y[i];
+				delta[a].z -= input->ref_z[i];
+				delta[a].count--;
+				ref_mask[i] = false;
 			}
+
+			if (mask[i])
+				candidates[nNumCandidates++] = i;
 		}
-		////////////////////////////////////////
-		// 3. Recompute the new cluster centers.
-		// initilaization
-#pragma omp parallel
-		//#pragma loop(hint_parallel(32))
 
-		parallel_for(int(0), nNumCluster, [&](int j)
+		assign_kernel(*input, centers, params, candidates, nNumCandidates, input->label, upper_bound, lower_bound);
+
+		// add the new contribution, the current values become the reference
+		for (int n = 0; n < nNumCandidates; n++)
 		{
-			center_of_cluster_[j] = vec3(0, 0, 0);
-			normal_center_of_cluster[j] = vec3(0, 0, 0);
-			nNumPointInCluster[j] = 0;
-		});
-		// averging
-#pragma omp parallel
+			const int i = candidates[n];
+			ClusterSum& sum = delta[label[i]];
+			sum.x += input->x[i];
+			sum.y += input->y[i];
+			sum.z += input->z[i];
+			sum.count++;
+			input->ref_x[i] = input->x[i]; input->ref_y[i] = input->y[i]; input->ref_z[i] = input->z[i];
+			input->ref_r[i] = input->r[i]; input->ref_g[i] = input->g[i]; input->ref_b[i] = input->b[i];
+			ref_mask[i] = true;
+		}
+		nReevaluated += nNumCandidates;
+	}
+
+	// fuzzy labels of all the valid points
+	const int nNumValidBlocks = (input->num_valid + kASSIGN_BLOCK - 1) / kASSIGN_BLOCK;
+#pragma omp parallel for num_threads(nNumThreads)
+	for (int block = 0; block < nNumValidBlocks; block++)
+	{
+		const int begin = block * kASSIGN_BLOCK;
+		assigned_label(input->valid_index + begin, min(kASSIGN_BLOCK, input->num_valid - begin));
+	}
 
-#pragma loop(no_vector)
-#pragma loop(hint_parallel(32))
-		for (int i = 0; i < IMAGESIZE; i++)
+	tracked_sums.absorb(reduction);
+	tracked_centers = centers;
+	tracked_sums.merge(center_of_cluster, NULL);
+	temporal_frames++;
+
+	IterationRecord record;
+	record.center_shift = CalculateClusterChange(center_of_cluster_, center_of_cluster, nNumCluster);
+	record.inertia = -1;
+	record.time_ms = ElapsedMs(frameStart);
+	record.skipped_evaluations = (input->num_valid - nReevaluated) * nNumCluster;
+	telemetry.frame++;
+	telemetry.records.assign(1, record);
+	telemetry.iterations = 1;
+	telemetry.inertia = -1;
+	telemetry.reason = TERMINATION_MAX_ITERATIONS;
+	telemetry.time_ms = record.time_ms;
+	ReportFrame();
 
+	delete[]center_of_cluster_;
+	delete[]nNumPointInCluster;
+}
+/********************************************************************
+** Mini-batch k-means (Sculley, "Web-scale k-means clustering"): every
+** iteration assigns a random batch of valid points and moves each
+** center towards its points with a per-center learning rate 1/count.
+** The iteration cost only depends on the batch size; one full
+** assignment pass then produces the labels of the frame.
+********************************************************************/
+void Clustering::Clustering_MiniBatch()
+{
+	const int* valid_index = input->valid_index;
+	const int num_valid = input->num_valid;
+	if (num_valid == 0)
+		return;
+	const ClusteringClock::time_point frameStart = ClusteringClock::now();
+	const int nNumThreads = num_threads > 0 ? num_threads : omp_get_max_threads();
+
+	if (center_of_cluster == NULL)
+		SeedCenters();
+
+	KernelParams params;
+	params.position_weight2 = gama * gama;
+	params.color_weight2 = alpha * alpha;
+	params.normal_weight = fWeight;
+
+	// start from the nearest points of the previous centers (color and normal included)
+	KernelCenters centers(nNumCluster);
+#pragma omp parallel for num_threads(nNumThreads)
+	for (int j = 0; j < nNumCluster; j++)
+	{
+		const int c = GetNearestNeighborIndex(center_of_cluster[j]);
+		centers.px[j] = input->x[c]; centers.py[j] = input->y[c]; centers.pz[j] = input->z[c];
+		centers.cr[j] = input->r[c]; centers.cg[j] = input->g[c]; centers.cb[j] = input->b[c];
+		centers.nx[j] = input->nx[c]; centers.ny[j] = input->ny[c]; centers.nz[j] = input->nz[c];
+	}
+
+	// learn the centers from the batches
+	std::vector<int> nNumPointInCluster(nNumCluster, 0);
+	std::uniform_int_distribution<int> pick(0, num_valid - 1);
+	batch.resize(batch_size);
+	for (int iteration = 0; iteration < batch_iterations; iteration++)
+	{
+		for (int n = 0; n < batch_size; n++)
+			batch[n] = valid_index[pick(batch_rng)];
+		assign_kernel(*input, centers, params, &batch[0], batch_size, input->label, NULL, NULL);
+
+		for (int n = 0; n < batch_size; n++)
 		{
+			const int i = batch[n];
+			const int j = input->label[i];
+			const float eta = 1.0f / (float)(++nNumPointInCluster[j]);
+			centers.px[j] += eta * (input->x[i] - centers.px[j]);
+			centers.py[j] += eta * (input->y[i] - centers.py[j]);
+			centers.pz[j] += eta * (input->z[i] - centers.pz[j]);
+			centers.cr[j] += eta * (input->r[i] - centers.cr[j]);
+			centers.cg[j] += eta * (input->g[i] - centers.cg[j]);
+			centers.cb[j] += eta * (input->b[i] - centers.cb[j]);
+			centers.nx[j] += eta * (input->nx[i] - centers.nx[j]);
+			centers.ny[j] += eta * (input->ny[i] - centers.ny[j]);
+			centers.nz[j] += eta * (input->nz[i] - centers.nz[j]);
+		}
+	}
 
-			if (Mask[i])
-			{
-#pragma omp parallel
-				//#pragma loop(hint_parallel(32))
-				for (register int j = 0; j < nNumCluster; j++)
-				{
+	// full resolution assignment, the means of the final labels are the new centers
+	const int nNumBlocks = (num_valid + kASSIGN_BLOCK - 1) / kASSIGN_BLOCK;
+	reduction.reset(deterministic ? nNumBlocks : nNumThreads, nNumCluster);
+#pragma omp parallel for schedule(dynamic) num_threads(nNumThreads)
+	for (int block = 0; block < nNumBlocks; block++)
+	{
+		const int begin = block * kASSIGN_BLOCK;
+		const int count = min(kASSIGN_BLOCK, num_valid - begin);
+		assign_kernel(*input, centers, params, valid_index + begin, count, input->label, input->upper_bound, NULL);
+		assigned_label(valid_index + begin, count);
+		reduction.accumulate(deterministic ? block : omp_get_thread_num(), *input, valid_index + begin, count, input->upper_bound);
+	}
+	vec3* center_of_cluster_old = new vec3[nNumCluster];
+	for (int j = 0; j < nNumCluster; j++)
+		center_of_cluster_old[j] = center_of_cluster[j];
+	reduction.merge(center_of_cluster, NULL);
+
+	// the batches and the full pass count as one iteration
+	IterationRecord record;
+	record.center_shift = CalculateClusterChange(center_of_cluster_old, center_of_cluster, nNumCluster);
+	record.inertia = reduction.inertia();
+	record.time_ms = ElapsedMs(frameStart);
+	record.skipped_evaluations = 0;
+	telemetry.frame++;
+	telemetry.records.assign(1, record);
+	telemetry.iterations = 1;
+	telemetry.inertia = record.inertia;
+	telemetry.reason = TERMINATION_MAX_ITERATIONS;
+	telemetry.time_ms = record.time_ms;
+	ReportFrame();
+	delete[]center_of_cluster_old;
+}
 
-					if ((int)input[i].Label == j)
-					{
-						center_of_cluster_[j].x += input[i].Pos3D.x;
-						center_of_cluster_[j].y += input[i].Pos3D.y;
-						center_of_cluster_[j].z += input[i].Pos3D.z;
+/********************************************************************
+** Weighted (fuzzy) c-means: every point gets the full membership
+** vector u_j = 1 / sum_l (d_j / d_l)^(2/(m-1)) from its distances to
+** all the centers (same metric as k-means), and every center attribute
+** is the u^m weighted mean of the points. The memberships are written
+** to the membership planes, the hard label is the largest membership.
+********************************************************************/
+void Clustering::Clustering_FuzzyCMeans()
+{
+	const int* valid_index = input->valid_index;
+	const int num_valid = input->num_valid;
+	if (num_valid == 0)
+		return;
+	const ClusteringClock::time_point frameStart = ClusteringClock::now();
+	if (center_of_cluster == NULL)
+	{
+		SeedCenters();
+		fuzzy_ready = false;
+	}
+	telemetry.frame++;
+	telemetry.records.clear();
+
+	const int nNumThreads = num_threads > 0 ? num_threads : omp_get_max_threads();
+	const int nNumBlocks = (num_valid + kASSIGN_BLOCK - 1) / kASSIGN_BLOCK;
+	KernelParams params;
+	params.position_weight2 = gama * gama;
+	params.color_weight2 = alpha * alpha;
+	params.normal_weight = fWeight;
+
+	// the weighted centers of the previous frame, or the nearest points of the hard centers
+	if (!fuzzy_ready)
+	{
+		fuzzy_centers = KernelCenters(nNumCluster);
+#pragma omp parallel for num_threads(nNumThreads)
+		for (int j = 0; j < nNumCluster; j++)
+		{
+			const int c = GetNearestNeighborIndex(center_of_cluster[j]);
+			fuzzy_centers.px[j] = input->x[c]; fuzzy_centers.py[j] = input->y[c]; fuzzy_centers.pz[j] = input->z[c];
+			fuzzy_centers.cr[j] = input->r[c]; fuzzy_centers.cg[j] = input->g[c]; fuzzy_centers.cb[j] = input->b[c];
+			fuzzy_centers.nx[j] = input->nx[c]; fuzzy_centers.ny[j] = input->ny[c]; fuzzy_centers.nz[j] = input->nz[c];
+		}
+		fuzzy_ready = true;
+	}
 
-						nNumPointInCluster[j]++;
-					}
-				}
-			}
+	vec3* center_of_cluster_old = new vec3[nNumCluster];
+	const int nMaxIterations = max(termination.max_iterations, 1);
+	TERMINATION_REASON reason = TERMINATION_MAX_ITERATIONS;
+	int iterationCounter = 0;
+	do
+	{
+		const ClusteringClock::time_point iterationStart = ClusteringClock::now();
+		iterationCounter++;
+		for (int j = 0; j < nNumCluster; j++)
+			center_of_cluster_old[j] = vec3(fuzzy_centers.px[j], fuzzy_centers.py[j], fuzzy_centers.pz[j]);
 
+		// memberships (8 or 4 points at once) and weighted sums of the block
+		reduction.reset(deterministic ? nNumBlocks : nNumThreads, nNumCluster);
+#pragma omp parallel for schedule(dynamic) num_threads(nNumThreads)
+		for (int block = 0; block < nNumBlocks; block++)
+		{
+			const int begin = block * kASSIGN_BLOCK;
+			const int count = min(kASSIGN_BLOCK, num_valid - begin);
+			fuzzy_kernel(*input, fuzzy_centers, params, fuzzifier, valid_index + begin, count,
+				input->membership, input->label, input->upper_bound);
+			reduction.accumulate_fuzzy(deterministic ? block : omp_get_thread_num(), *input, valid_index + begin, count,
+				input->membership, fuzzifier, input->upper_bound);
 		}
-#pragma omp parallel
-		//#pragma loop(hint_parallel(32))
+		reduction.merge_fuzzy(fuzzy_centers);
+		for (int j = 0; j < nNumCluster; j++)
+			center_of_cluster[j] = vec3(fuzzy_centers.px[j], fuzzy_centers.py[j], fuzzy_centers.pz[j]);
+
+		const float fChange = CalculateClusterChange(center_of_cluster_old, center_of_cluster, nNumCluster);
+		IterationRecord record;
+		record.center_shift = fChange;
+		record.inertia = reduction.inertia();
+		record.time_ms = ElapsedMs(iterationStart);
+		record.skipped_evaluations = 0;
+		telemetry.records.push_back(record);
+
+		if (termination.shift_threshold > 0 && fChange < termination.shift_threshold)
+		{
+			reason = TERMINATION_CONVERGED;
+			break;
+		}
+		if (termination.time_budget_ms > 0 && iterationCounter < nMaxIterations &&
+			ElapsedMs(frameStart) + record.time_ms > termination.time_budget_ms)
+		{
+			reason = TERMINATION_TIME_BUDGET;
+			break;
+		}
+	} while (iterationCounter < nMaxIterations);
 
-		for (register int j = 0; j < nNumCluster; j++)
+	telemetry.iterations = iterationCounter;
+	telemetry.inertia = telemetry.records.back().inertia;
+	telemetry.reason = reason;
+	telemetry.time_ms = ElapsedMs(frameStart);
+	ReportFrame();
+	delete[]center_of_cluster_old;
+}
+
+/********************************************************************
+** Coarse-to-fine mode: the selected clustering mode runs on every
+** step-th pixel of every step-th row (step = 2^levels), then one pass
+** carries the labels to the other valid pixels. The frame telemetry
+** covers both; its inertia is the one of the coarse pixels.
+********************************************************************/
+void Clustering::Clustering_Pyramid()
+{
+	if (input->num_valid == 0)
+		return;
+	const ClusteringClock::time_point frameStart = ClusteringClock::now();
+	const int step = 1 << pyramid_levels;
+
+	// 1. valid pixels of the coarse grid, in pixel order
+	pyramid_index.clear();
+	for (int y = 0; y < input->height; y += step)
+		for (int x = 0; x < input->width; x += step)
 		{
-			if (nNumPointInCluster[j])
+			const int i = y * input->width + x;
+			if (input->mask[i])
+				pyramid_index.push_back(i);
+		}
+	if (pyramid_index.empty())
+	{
+		RunClusteringMode();
+		return;
+	}
+
+	// 2. the coarse pixels stand in for the valid list (seeding included)
+	int* full_index = input->valid_index;
+	const int full_count = input->num_valid;
+	input->valid_index = &pyramid_index[0];
+	input->num_valid = (int)pyramid_index.size();
+	if (center_of_cluster == NULL)
+		SeedCenters();
+	vector<vec3> start_centers;
+	if (pyramid_report_enabled)
+		start_centers.assign(center_of_cluster, center_of_cluster + nNumCluster);
+
+	// the frame is reported once the labels are propagated; the temporal reference
+	// of the full resolution frame does not match the coarse sums, so every
+	// pyramid frame runs the full mode (and leaves no reference behind)
+	DiagnosticsSink* sink = diagnostics;
+	diagnostics = NULL;
+	temporal_ready = false;
+	RunClusteringMode();
+	temporal_ready = false;
+	input->valid_index = full_index;
+	input->num_valid = full_count;
+
+	// 3. full resolution labels
+	PropagateLabels(step);
+	diagnostics = sink;
+	telemetry.time_ms = ElapsedMs(frameStart);
+	ReportFrame();
+
+	if (pyramid_report_enabled)
+		ComparePyramid(start_centers);
+}
+
+/********************************************************************
+** Gives every valid pixel that is not on the coarse grid the label
+** (and memberships) of one of the 4 coarse pixels around it: the
+** closest one, or in edge-aware mode the most similar one in position
+** and color, so labels do not leak across depth or color edges. Pixels
+** with no valid coarse neighbor are assigned to the nearest center.
+********************************************************************/
+void Clustering::PropagateLabels(int step)
+{
+	const int width = input->width;
+	const int height = input->height;
+	const size_t plane = input->size;
+	const bool edge_aware = (pyramid_upsampling == PYRAMID_EDGE_AWARE);
+	const float fPositionWeight = gama * gama;
+	const float fColorWeight = alpha * alpha;
+	const int nNumThreads = num_threads > 0 ? num_threads : omp_get_max_threads();
+
+	KernelParams params;
+	params.position_weight2 = gama * gama;
+	params.color_weight2 = alpha * alpha;
+	params.normal_weight = fWeight;
+	KernelCenters centers(nNumCluster);
+	if (fuzzy)
+		centers = fuzzy_centers;
+	else
+		for (int j = 0; j < nNumCluster; j++)
+		{
+			const int c = GetNearestNeighborIndex(center_of_cluster[j]);
+			centers.px[j] = input->x[c]; centers.py[j] = input->y[c]; centers.pz[j] = input->z[c];
+			centers.cr[j] = input->r[c]; centers.cg[j] = input->g[c]; centers.cb[j] = input->b[c];
+			centers.nx[j] = input->nx[c]; centers.ny[j] = input->ny[c]; centers.nz[j] = input->nz[c];
+		}
+
+#pragma omp parallel num_threads(nNumThreads)
+	{
+		vector<int> orphans;
+		orphans.reserve(width);
+#pragma omp for schedule(dynamic)
+		for (int y = 0; y < height; y++)
+		{
+			orphans.clear();
+			const int y0 = (y / step) * step;
+			for (int x = 0; x < width; x++)
 			{
-				center_of_cluster_[j].x /= (float)nNumPointInCluster[j];
-				center_of_cluster_[j].y /= (float)nNumPointInCluster[j];
-				center_of_cluster_[j].z /= (float)nNumPointInCluster[j];
+				const int i = y * width + x;
+				if (!input->mask[i] || (y == y0 && x % step == 0))
+					continue;
+
+				const int x0 = (x / step) * step;
+				int best = -1;
+				float fBestCost = FLT_MAX;
+				for (int c = 0; c < 4; c++)
+				{
+					const int sx = x0 + ((c & 1) ? step : 0);
+					const int sy = y0 + ((c & 2) ? step : 0);
+					if (sx >= width || sy >= height)
+						continue;
+					const int s = sy * width + sx;
+					if (!input->mask[s])
+						continue;
+					float fCost;
+					if (edge_aware)
+					{
+						const float dx = input->x[i] - input->x[s], dy = input->y[i] - input->y[s], dz = input->z[i] - input->z[s];
+						const float dr = input->r[i] - input->r[s], dg = input->g[i] - input->g[s], db = input->b[i] - input->b[s];
+						fCost = fPositionWeight * (dx*dx + dy*dy + dz*dz) + fColorWeight * (dr*dr + dg*dg + db*db);
+					}
+					else
+						fCost = (float)((sx - x) * (sx - x) + (sy - y) * (sy - y));
+					if (fCost < fBestCost)
+					{
+						fBestCost = fCost;
+						best = s;
+					}
+				}
+
+				if (best < 0)
+				{
+					orphans.push_back(i);
+					continue;
+				}
+				input->label[i] = input->label[best];
+				if (fuzzy)
+					for (int j = 0; j < nNumCluster; j++)
+						input->membership[j * plane + i] = input->membership[j * plane + best];
 			}
-			else
+
+			if (!orphans.empty())
 			{
-				center_of_cluster_[j] = vec3(0, 0, 0);
+				if (fuzzy)
+					fuzzy_kernel(*input, centers, params, fuzzifier, &orphans[0], (int)orphans.size(), input->membership, input->label, NULL);
+				else
+					assign_kernel(*input, centers, params, &orphans[0], (int)orphans.size(), input->label, NULL, NULL);
 			}
 		}
-		///////////////////////////////////////
-		// Calculate the termination condition
-		// if the centers of the cluster change less than threshold, the iteration stops. 
-		//fChange = CalculateClusterChange(center_of_cluster_old, center_of_cluster_);
+	}
+}
 
-	} while (iterationCounter < terminationIteration);//(fChange != 0);
+/********************************************************************
+** Quality/time report of the pyramid: clusters the frame again at full
+** resolution from the centers the pyramid started from, compares the
+** two, then puts the pyramid result (labels, memberships, centers and
+** telemetry) back.
+********************************************************************/
+void Clustering::ComparePyramid(const vector<vec3>& start_centers)
+{
+	const int* valid_index = input->valid_index;
+	const int num_valid = input->num_valid;
+	const size_t plane = input->size;
+
+	// pyramid result
+	const FrameTelemetry pyramid_telemetry = telemetry;
+	const KernelCenters pyramid_fuzzy_centers = fuzzy_centers;
+	const vector<vec3> pyramid_centers(center_of_cluster, center_of_cluster + nNumCluster);
+	vector<int> pyramid_labels(num_valid);
+	vector<float> pyramid_membership(fuzzy ? (size_t)num_valid * nNumCluster : 0);
+#pragma omp parallel for
+	for (int n = 0; n < num_valid; n++)
+	{
+		const int i = valid_index[n];
+		pyramid_labels[n] = input->label[i];
+		if (fuzzy)
+			for (int j = 0; j < nNumCluster; j++)
+				pyramid_membership[(size_t)j * num_valid + n] = input->membership[j * plane + i];
+	}
 
-													  // save the center_of_cluster_ in the same array of the seeds
-#pragma omp parallel
-													  //#pragma loop(hint_parallel(32))
-	for (int i = 0; i < nNumCluster; i++)
-		center_of_cluster[i] = center_of_cluster_[i];
+	// full resolution run, same mode and starting centers, not reported
+	for (int j = 0; j < nNumCluster; j++)
+		center_of_cluster[j] = start_centers[j];
+	temporal_ready = false;
+	fuzzy_ready = false;
+	DiagnosticsSink* sink = diagnostics;
+	diagnostics = NULL;
+	const ClusteringClock::time_point fullStart = ClusteringClock::now();
+	RunClusteringMode();
+	const double fFullMs = ElapsedMs(fullStart);
+	diagnostics = sink;
+
+	int nAgree = 0;
+#pragma omp parallel for reduction(+:nAgree)
+	for (int n = 0; n < num_valid; n++)
+	{
+		const int i = valid_index[n];
+		if (input->label[i] == pyramid_labels[n])
+			nAgree++;
+		input->label[i] = pyramid_labels[n];
+		if (fuzzy)
+			for (int j = 0; j < nNumCluster; j++)
+				input->membership[j * plane + i] = pyramid_membership[(size_t)j * num_valid + n];
+	}
 
-	delete[]center_of_cluster_;
-	delete[]normal_center_of_cluster;
-	delete[]center_of_cluster_old;
-	delete[]nNumPointInCluster;
+	pyramid_report.coarse_points = (int)pyramid_index.size();
+	pyramid_report.full_points = num_valid;
+	pyramid_report.pyramid_ms = pyramid_telemetry.time_ms;
+	pyramid_report.full_ms = fFullMs;
+	pyramid_report.pyramid_inertia = pyramid_telemetry.inertia / pyramid_report.coarse_points;
+	pyramid_report.full_inertia = telemetry.inertia / num_valid;
+	pyramid_report.label_agreement = (float)nAgree / num_valid;
+
+	// the next frame goes on from the pyramid result
+	for (int j = 0; j < nNumCluster; j++)
+		center_of_cluster[j] = pyramid_centers[j];
+	fuzzy_centers = pyramid_fuzzy_centers;
+	fuzzy_ready = fuzzy;
+	temporal_ready = false;
+	telemetry = pyramid_telemetry;
+}
+
+// Seeds of the first frame (1: k-means++, 2: uniform at random, 3: k-means||)
+void Clustering::SeedCenters()
+{
+	center_of_cluster = new vec3[nNumCluster];
+	memset(input->membership, 0, (size_t)input->size * nNumCluster * sizeof(float));
+	memset(input->label, 0, (size_t)input->size * sizeof(int));
+	if (AutoSeedingType == 2)
+		ChooseUniformCenters(center_of_cluster);
+	else if (AutoSeedingType == 3)
+		ChooseParallelCenters(center_of_cluster, kPARALLEL_SEEDING_ROUNDS, kPARALLEL_SEEDING_OVERSAMPLING);
+	else
+		ChooseSmartCenters(center_of_cluster, 5);
+	if (diagnostics)
+		diagnostics->push_centers(RECORD_SEEDS, telemetry.frame + 1, center_of_cluster, nNumCluster);
+}
 
+// Queues the centers and the telemetry of the frame just clustered
+void Clustering::ReportFrame()
+{
+	if (diagnostics == NULL)
+		return;
+	diagnostics->push_centers(RECORD_CENTERS, telemetry.frame, center_of_cluster, nNumCluster);
+	diagnostics->push_frame_stats(telemetry.frame, telemetry.iterations, telemetry.time_ms, telemetry.inertia,
+		telemetry.reason, input->num_valid);
 }
+
 /********************************************************************
 ** Added by Manal
 ** used in k-means clusterin algorithm to calculate the distortion change.
 *********************************************************************/
-float CalculateClusterChange(vec3* center_of_cluster_old, vec3* center_of_cluster)
+float CalculateClusterChange(vec3* center_of_cluster_old, vec3* center_of_cluster, int nNumCluster)
 {
 	//for termination: all clusteres in account
 	float fChange = 0;
-#pragma omp parallel
 	//#pragma loop(hint_parallel(32))
 	for (int j = 0; j < nNumCluster; j++)
 		fChange += fabs(center_of_cluster_old[j].x - center_of_cluster[j].x)
@@ -320,62 +895,75 @@ float CalculateClusterChange(vec3* center_of_cluster_old, vec3* center_of_cluste
 ** Added by Manal
 ** Chooses random color for each label.
 ********************************************************************/
-bool color_first = false;
-void Clustering::AssignLabelColor()
+void Clustering::BuildLabelColors()
 {
 	//using binary of 3 bits assignment
-	if (clustersColors == NULL)
-	{
-		float r, g, b;
-		clustersColors = new vec3[nNumCluster + 1];
+	float r, g, b;
+	clustersColors = new vec3[nNumCluster + 1];
 
-		if (nNumCluster > 1 && nNumCluster < 8)
-			for (int j = 1; j <= nNumCluster; j++)
-				clustersColors[j - 1] = vec3(r = (j % 2) * 100, g = ((int)(j / 2) % 2) * 100, b = ((int)((int)(j / 2) / 2) % 2) * 100);
+	if (nNumCluster > 1 && nNumCluster < 8)
+		for (int j = 1; j <= nNumCluster; j++)
+			clustersColors[j - 1] = vec3(r = (j % 2) * 100, g = ((int)(j / 2) % 2) * 100, b = ((int)((int)(j / 2) / 2) % 2) * 100);
 
-		else if (nNumCluster > 0)
+	else if (nNumCluster > 0)
+	{
+		// serial: rand() and the colors already picked are shared by the iterations
+		for (int j = 0; j < nNumCluster; j++)
 		{
-#pragma omp parallel
-			//#pragma loop(hint_parallel(32))
-			for (int j = 0; j < nNumCluster; j++)
+			r = rand() % 255; g = rand() % 255; b = rand() % 255;
+			// make sure that this random generated color does not generated before
+			for (register int i = 0; i < j; i++)
 			{
-				r = rand() % 255; g = rand() % 255; b = rand() % 255;
-				// make sure that this random generated color does not generated before
-#pragma omp parallel
-				//#pragma loop(hint_parallel(32))
-				for (register int i = 0; i < j; i++)
+				if ((clustersColors[i].x == r) && (clustersColors[i].y == g) && (clustersColors[i].z == b))
 				{
-					if ((clustersColors[i].x == r) && (clustersColors[i].y == g) && (clustersColors[i].z == b))
-					{
-						r = rand() % 255; g = rand() % 255;
-					}
+					r = rand() % 255; g = rand() % 255;
 				}
-				clustersColors[j] = vec3(r, g, b);
 			}
+			clustersColors[j] = vec3(r, g, b);
 		}
 	}
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-	//for (register int i = 0; i < IMAGESIZE; i++)*/
-	parallel_for(int(0), IMAGESIZE, [&](int i)
+	palette.set(clustersColors, nNumCluster);
+}
+
+// Palette of the fused OUTPUT_CLUSTER pass (built with the label colors)
+const ClusterPalette& Clustering::get_palette()
+{
+	if (clustersColors == NULL)
+		BuildLabelColors();
+	return palette;
+}
+/********************************************************************
+** Blends the label colors into the point colors.
+********************************************************************/
+bool color_first = false;
+void Clustering::AssignLabelColor()
+{
+	if (clustersColors == NULL)
+		BuildLabelColors();
+	const float* membership_s = (S_OBJECT_DETECTING >= 0) ? input->membership_plane(S_OBJECT_DETECTING) : NULL;
+	const float* membership_ml = M_OBJECT_DETECTING ? input->membership_plane(ML_OBJECT_DETECTING) : NULL;
+	const int* valid_index = input->valid_index;
+#pragma omp parallel for
+	for (int n = 0; n < input->num_valid; n++)
 	{
-		if (Mask[i])
+		const int i = valid_index[n];
 		{
 			vec3 Color_2;
 			//	vec3 Color_1 = clustersColors[(int)input[i].Label] ;
-			if (input[i].color_buffer.x == 0 && input[i].color_buffer.y == 0 && input[i].color_buffer.z == 0)
+			const vec3 color_buffer(input->buffer_r[i], input->buffer_g[i], input->buffer_b[i]);
+			if (color_buffer.x == 0 && color_buffer.y == 0 && color_buffer.z == 0)
 			{
 				Color_2.x = 255.0; Color_2.y = 255.0; Color_2.z = 255.0;
 			}
-			else	Color_2 = (input[i].color_buffer);
+			else	Color_2 = color_buffer;
 
 			vec3 AA;
 			//	AA.set(1.0, 1.0, 1.0);
 			if (M_OBJECT_DETECTING)
 			{
-				AA.x += input[i].Label_c[ML_OBJECT_DETECTING] * input[i].color.x;// clustersColors[S_OBJECT_DETECTING].x;
-				AA.y += input[i].Label_c[ML_OBJECT_DETECTING] * input[i].color.y;//clustersColors[S_OBJECT_DETECTING].y;
-				AA.z += input[i].Label_c[ML_OBJECT_DETECTING] * input[i].color.z;//clustersColors[S_OBJECT_DETECTING].z;
+				AA.x += membership_ml[i] * input->r[i];// clustersColors[S_OBJECT_DETECTING].x;
+				AA.y += membership_ml[i] * input->g[i];//clustersColors[S_OBJECT_DETECTING].y;
+				AA.z += membership_ml[i] * input->b[i];//clustersColors[S_OBJECT_DETECTING].z;
 
 			}
 			else
@@ -385,9 +973,9 @@ void Clustering::AssignLabelColor()
 				{
 					for (register int ll = 0; ll < nNumCluster; ll++)
 					{
-						AA.x += input[i].Label_c[ll] * clustersColors[ll].x;
-						AA.y += input[i].Label_c[ll] * clustersColors[ll].y;
-						AA.z += input[i].Label_c[ll] * clustersColors[ll].z;
+						AA.x += input->membership_plane(ll)[i] * clustersColors[ll].x;
+						AA.y += input->membership_plane(ll)[i] * clustersColors[ll].y;
+						AA.z += input->membership_plane(ll)[i] * clustersColors[ll].z;
 
 					}
 				}
@@ -395,19 +983,23 @@ void Clustering::AssignLabelColor()
 				{
 
 
-					AA.x += input[i].Label_c[S_OBJECT_DETECTING] * input[i].color.x;// clustersColors[S_OBJECT_DETECTING].x;
-					AA.y += input[i].Label_c[S_OBJECT_DETECTING] * input[i].color.y;//clustersColors[S_OBJECT_DETECTING].y;
-					AA.z += input[i].Label_c[S_OBJECT_DETECTING] * input[i].color.z;//clustersColors[S_OBJECT_DETECTING].z;
+					AA.x += membership_s[i] * input->r[i];// clustersColors[S_OBJECT_DETECTING].x;
+					AA.y += membership_s[i] * input->g[i];//clustersColors[S_OBJECT_DETECTING].y;
+					AA.z += membership_s[i] * input->b[i];//clustersColors[S_OBJECT_DETECTING].z;
 
 				}
 			}
-			vec3 CC = input[i].color;
-			input[i].color = (AA + input[i].color_buffer) / 2.0;
+			const vec3 blended = (AA + color_buffer) / 2.0;
+			input->r[i] = blended.x;
+			input->g[i] = blended.y;
+			input->b[i] = blended.z;
 
 
 
 
-			input[i].color_buffer = AA;
+			input->buffer_r[i] = AA.x;
+			input->buffer_g[i] = AA.y;
+			input->buffer_b[i] = AA.z;
 
 
 
@@ -417,7 +1009,7 @@ void Clustering::AssignLabelColor()
 			//}
 			//color_first = true;
 		}
-	});
+	}
 }
 /********************************************************************
 ** Added by Manal
@@ -425,41 +1017,8 @@ void Clustering::AssignLabelColor()
 ********************************************************************/
 void Clustering::ChooseUniformCenters(vec3* center_of_cluster)
 {
-	int i;
-
-	std::vector<int> centerIndices;
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-	for (i = 0; i < IMAGESIZE; i++)
-		centerIndices.push_back(i);
-
-	// Choose each center one at a time, keeping the list up to date
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-	for (i = 0; i < nNumCluster; i++)
-	{
-		int index = (int)(/*getRandomScalar*/(double(rand()) / RAND_MAX) * centerIndices.size());
-		center_of_cluster[i] = input[centerIndices[index]].Pos3D;
-		centerIndices[index] = centerIndices[int(centerIndices.size()) - 1];
-		centerIndices.pop_back();
-	}
-}
-/*******************************************************************************************
-Added by Manal
-to generate random index for k-means++ Algorithm
-*********************************************************************************************/
-int getRandomIndex()
-{
-	register int randomIndex = 0;
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-	/*while (randomIndex == 0)
-	{
-	randomIndex = 10;// (int)(double(rand()) / RAND_MAX) * IMAGESIZE;
-	if(!Mask[randomIndex])
-	randomIndex = 0;
-	}*/
-	return 959549;
+	// drawn with the seeding generator, a partial shuffle keeps the picks distinct
+	seeding.uniform(*input, nNumCluster, center_of_cluster);
 }
 /*******************************************************************************************
 Added by Manal
@@ -474,98 +1033,112 @@ k-means++ Algorithm:
 *******************************************************************************************/
 void Clustering::ChooseSmartCenters(vec3* center_of_cluster, int numLocalTries)
 {
-	register int i;
-	double currentPot = 0;
-	std::vector<double> closestDistSq;
-
-	// Choose one random center and set the closestDistSq values
-	int index = getRandomIndex();
-	center_of_cluster[0] = input[index].Pos3D;
-	//	printf("%f, %f, %f\n", center_of_cluster[0].x, center_of_cluster[0].y, center_of_cluster[0].z);
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-	for (i = 0; i < IMAGESIZE; i++)
-	{
-
-		closestDistSq.push_back(CalculateDistance_(input[i].Pos3D, input[index].Pos3D));
-		currentPot += closestDistSq[i];
-	}
-
-	// Choose each center
-#pragma omp parallel
-	//#pragma loop(hint_parallel(32))
-	for (register int centerCount = 1; centerCount < nNumCluster; centerCount++)
-	{
-		// Repeat several trials
-		double bestNewPot = -1;
-		int bestNewIndex;
-#pragma omp parallel
-		//#pragma loop(hint_parallel(32))
-		for (int localTrial = 0; localTrial < numLocalTries; localTrial++)
-		{
-			// Choose our center - have to be slightly careful to return a valid answer even accounting
-			// for possible rounding errors
-			double randVal = /*getRandomScalar*/(double(rand()) / RAND_MAX) * currentPot;
-#pragma omp parallel
-			//#pragma loop(hint_parallel(32))
-			for (index = 0; index < IMAGESIZE - 1; index++)
-			{
-				if (randVal <= closestDistSq[index])
-					break;
-				else
-					randVal -= closestDistSq[index];
-			}
-
-			// Compute the new potential
-			double newPot = 0;
-#pragma omp parallel
-			//#pragma loop(hint_parallel(32))
-			for (i = 0; i < IMAGESIZE; i++)
-				newPot += min((double)CalculateDistance_(input[i].Pos3D, input[index].Pos3D), closestDistSq[i]);
-
-			// Store the best result
-			if (bestNewPot < 0 || newPot < bestNewPot)
-			{
-				bestNewPot = newPot;
-				bestNewIndex = index;
-			}
-		}
-
-		// Add the appropriate center
-		center_of_cluster[centerCount] = input[bestNewIndex].Pos3D;
-		//printf("%f, %f, %f\n", center_of_cluster[centerCount].x, center_of_cluster[centerCount].y, center_of_cluster[centerCount].z);
-
-		currentPot = bestNewPot;
-#pragma parallel
-#pragma omp parallel
-		//#pragma loop(hint_parallel(32))
-		for (i = 0; i < IMAGESIZE; i++)
-			closestDistSq[i] = min((double)CalculateDistance_(input[i].Pos3D, input[bestNewIndex].Pos3D), closestDistSq[i]);
-	}
+	// D^2 sampling runs on a parallel prefix sum (binary search per sample), see CenterSeeding
+	seeding.kmeanspp(*input, GetFirstSeed(), nNumCluster, numLocalTries, center_of_cluster);
+}
+/*******************************************************************************************
+k-means|| Algorithm (Bahmani et al., "Scalable K-Means++"):
+*  - One center is chosen as in k-means++.
+*  - A few rounds pick every point independently with probability proportional to the
+*    distance squared from it to the closest candidate (about oversampling*k per round).
+*  - The candidates, weighted by the number of points they are closest to, are reduced
+*    to numCenters with k-means++.
+*******************************************************************************************/
+void Clustering::ChooseParallelCenters(vec3* center_of_cluster, int numRounds, float fOversampling)
+{
+	seeding.kmeans_parallel(*input, GetFirstSeed(), nNumCluster, numRounds, fOversampling, center_of_cluster);
+}
+// Position in the valid list of the first seed: first valid point at or after the fixed seed pixel
+int Clustering::GetFirstSeed() const
+{
+	const int* valid_index = input->valid_index;
+	const int num_valid = input->num_valid;
+	const int index = int(lower_bound(valid_index, valid_index + num_valid, kFIRST_SEED_PIXEL) - valid_index);
+	return (index == num_valid) ? num_valid - 1 : index;
 }
 int Clustering::GetNearestNeighborIndex(vec3 center_of_cluster)
 {
-	int nnIndex = 0;
-	float minDist = CalculateDistance_(input[0].Pos3D, center_of_cluster);
+	if (spatial_index != NULL && !spatial_index->empty())
+		return spatial_index->nearest(center_of_cluster);
+
+	const int* valid_index = input->valid_index;
+	int nnIndex = valid_index[0];
+	float minDist = CalculateDistance_(position(nnIndex), center_of_cluster);
 	float currentDistance;
-#pragma omp parallel
 	//#pragma loop(hint_parallel(32))
-	for (register int i = 0; i< IMAGESIZE; i++)
+	for (register int n = 1; n < input->num_valid; n++)
 	{
-
-		if (Mask[i])
+		const int i = valid_index[n];
+		currentDistance = CalculateDistance_(position(i), center_of_cluster);
+		if (currentDistance < minDist)
 		{
-			currentDistance = CalculateDistance_(input[i].Pos3D, center_of_cluster);
-			if (currentDistance < minDist)
-			{
-				minDist = currentDistance;
-				nnIndex = i;
-			}
+			minDist = currentDistance;
+			nnIndex = i;
 		}
 	}
 	return nnIndex;
 }
 
+Clustering::Clustering(int num_clusters) :
+	nNumCluster(num_clusters)
+{
+	set_kernel_isa(detect_kernel_isa());
+}
+
+Clustering::~Clustering()
+{
+	delete[] center_of_cluster;
+	delete[] clustersColors;
+}
+
+void Clustering::set_kernel_isa(KERNEL_ISA isa)
+{
+	kernel_isa = isa;
+	assign_kernel = select_assign_kernel(isa, nNumCluster);
+	fuzzy_kernel = select_fuzzy_kernel(isa);
+}
+
+void Clustering::set_num_clusters(int num_clusters)
+{
+	if (num_clusters == nNumCluster)
+		return;
+
+	nNumCluster = num_clusters;
+	assign_kernel = select_assign_kernel(kernel_isa, nNumCluster);
+
+	// seeds and label colors depend on k
+	delete[] center_of_cluster;
+	center_of_cluster = NULL;
+	delete[] clustersColors;
+	clustersColors = NULL;
+	temporal_ready = false;
+	fuzzy_ready = false;
+	tracker.reset();
+}
+
 void Clustering::update() {
-	Clustering_KMeans();
+	stats_fresh = false;
+	if (pyramid_levels > 0)
+		Clustering_Pyramid();
+	else
+		RunClusteringMode();
+
+	// the tracks follow the clusters of this frame and seed the next one
+	if (tracking && stats_fresh && center_of_cluster != NULL)
+	{
+		tracker.update(&stats[0], nNumCluster);
+		tracker.predict(center_of_cluster, nNumCluster);
+	}
+}
+
+// Clustering of the current valid list with the selected mode
+void Clustering::RunClusteringMode() {
+	if (fuzzy)
+		Clustering_FuzzyCMeans();
+	else if (temporal && temporal_ready && center_of_cluster != NULL && temporal_frames < temporal_refresh && input->weight == NULL)
+		Clustering_Incremental();
+	else if (minibatch)
+		Clustering_MiniBatch();
+	else
+		Clustering_KMeans();
 }
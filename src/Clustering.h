@@ -1,21 +1,70 @@
 #pragma once
 
 #include "vec3.h"
+#include "FrameStore.h"
+#include "ClusteringKernels.h"
+#include "ClusterReduction.h"
+#include "CenterSeeding.h"
+#include "SpatialGrid.h"
+#include "DiagnosticsSink.h"
+#include "ClusterColoring.h"
+#include "ClusterTracker.h"
+#include <vector>
+#include <random>
 #define IMAGESIZE 1920*1080//961*412
-#define nNumCluster 4
 
+// Default number of clusters
+static const int kDEFAULT_NUM_CLUSTERS = 4;
 
-typedef struct Image_buffer
-{
-	vec3 Pos3D;
-	vec3 color;
-	vec3 normal;
-	float   Label_c[nNumCluster];
-	int Label;
-	vec3 color_buffer;
-	
 
-} Image_buffer;
+// When Clustering_KMeans stops iterating on a frame; the first condition met wins
+struct TerminationPolicy {
+	float shift_threshold = 0.0f;	// Stop when the centers moved less than this (CalculateClusterChange, 0: off)
+	int max_iterations = 1;			// Iterations per frame
+	double time_budget_ms = 0.0;	// Stop when another iteration would not fit in the budget (0: off)
+};
+
+// Why the last frame stopped iterating
+enum TERMINATION_REASON {
+	TERMINATION_MAX_ITERATIONS,
+	TERMINATION_CONVERGED,
+	TERMINATION_TIME_BUDGET
+};
+
+// One k-means iteration
+struct IterationRecord {
+	float center_shift;				// CalculateClusterChange of the iteration
+	double inertia;					// Sum of squared point-to-center distances (upper bound when points were skipped, -1: not computed)
+	double time_ms;					// Wall-clock time of the iteration
+	long long skipped_evaluations;	// Distance evaluations skipped by the bounds
+};
+
+// How the pyramid mode carries the coarse labels to the full resolution pixels
+enum PYRAMID_UPSAMPLING {
+	PYRAMID_NEAREST,				// Label of the closest valid coarse pixel (image distance)
+	PYRAMID_EDGE_AWARE				// Label of the most similar valid coarse neighbor (position and color)
+};
+
+// Pyramid frame against a full resolution run from the same centers
+struct PyramidReport {
+	int coarse_points = 0;			// Valid pixels clustered by the pyramid
+	int full_points = 0;			// Valid pixels of the frame
+	double pyramid_ms = 0.0;		// Coarse clustering + label propagation
+	double full_ms = 0.0;			// Full resolution clustering
+	double pyramid_inertia = 0.0;	// Inertia per point of the coarse run
+	double full_inertia = 0.0;		// Inertia per point of the full resolution run
+	float label_agreement = 0.0f;	// Fraction of the valid pixels with the same label in both runs
+};
+
+// One clustered frame
+struct FrameTelemetry {
+	long long frame = 0;
+	int iterations = 0;
+	double time_ms = 0.0;			// Wall-clock time of the frame (seeding included)
+	double inertia = 0.0;			// Inertia of the last iteration
+	TERMINATION_REASON reason = TERMINATION_MAX_ITERATIONS;
+	std::vector<IterationRecord> records;
+};
 
 
 
@@ -23,28 +72,180 @@ typedef struct Image_buffer
 class Clustering
 {
 public:
-	inline void set_frame(Image_buffer* frame_points) {
-		input = frame_points;
-	}
-
-	inline void set_mask(bool* valid_frame_points) {
-		Mask = valid_frame_points;
-	}
-
-	void update();
-
-	void assigned_label(int i, int label);
+	Clustering(int num_clusters = kDEFAULT_NUM_CLUSTERS);
+	~Clustering();
+
+	inline void set_frame(FrameStore* frame_points) {
+		if (frame_points != input)
+			temporal_ready = false;
+		input = frame_points;
+		Mask = frame_points->mask;
+		input->set_num_membership(nNumCluster);
+	}
+
+	// Voxel grid of the frame, used to snap the centers to their nearest point (NULL: linear scan)
+	inline void set_spatial_index(const SpatialGrid* grid) { spatial_index = grid; }
+
+	// Changes the number of clusters k, the next frame is seeded again
+	void set_num_clusters(int num_clusters);
+	inline int get_num_clusters() const { return nNumCluster; }
+
+	// Forces the instruction set of the assignment kernel (default: best supported by the CPU)
+	// The kernels skip the square root only when fWeight is 0; the default fWeight keeps the full metric
+	void set_kernel_isa(KERNEL_ISA isa);
+	inline KERNEL_ISA get_kernel_isa() const { return kernel_isa; }
+
+	// Number of worker threads of the k-means passes (0: OpenMP default)
+	inline void set_num_threads(int threads) { num_threads = threads; }
+	inline int get_num_threads() const { return num_threads; }
+
+	// Merges the centroid sums per fixed block instead of per thread, so the
+	// result does not depend on the number of threads
+	inline void set_deterministic(bool enable) { deterministic = enable; }
+	inline bool get_deterministic() const { return deterministic; }
+
+	// Accelerated k-means: per-point distance bounds and center drift skip the
+	// points whose label cannot change (same labels as the plain loop)
+	inline void set_accelerated(bool enable) { accelerated = enable; }
+	inline bool get_accelerated() const { return accelerated; }
+
+	// Temporal mode: the frames after a full k-means only re-evaluate the pixels that
+	// moved more than the tolerance (clustering metric units) or whose bounds fail, and
+	// patch the cluster sums; a full k-means runs again every refresh frames (not on
+	// weighted frames such as voxel clouds, whose points change every frame, nor in
+	// pyramid mode, whose coarse sums do not cover the full resolution pixels)
+	inline void set_temporal(bool enable) { temporal = enable; temporal_ready = false; }
+	inline bool get_temporal() const { return temporal; }
+	inline void set_temporal_tolerance(float tolerance) { temporal_tolerance = tolerance; }
+	inline void set_temporal_refresh(int frames) { temporal_refresh = frames; }
+
+	// Mini-batch mode: the centers are learned from batch_size random valid points per
+	// iteration (per-center learning rate 1/count), then one full assignment pass labels
+	// the frame
+	inline void set_minibatch(bool enable) { minibatch = enable; }
+	inline bool get_minibatch() const { return minibatch; }
+	inline void set_batch_size(int size) { batch_size = size; }
+	inline void set_batch_iterations(int iterations) { batch_iterations = iterations; }
+
+	// Iteration control of Clustering_KMeans
+	inline void set_termination_policy(const TerminationPolicy& policy) { termination = policy; }
+	inline const TerminationPolicy& get_termination_policy() const { return termination; }
+
+	// Record of the last clustered frame
+	inline const FrameTelemetry& get_telemetry() const { return telemetry; }
+
+	// Cluster centers (positions) of the last clustered frame, NULL before the first frame
+	inline const vec3* get_centers() const { return center_of_cluster; }
+
+	// Seeds, centers and frame stats are queued to this sink (NULL: no diagnostics)
+	inline void set_diagnostics(DiagnosticsSink* sink) { diagnostics = sink; }
+
+	// Weighted (fuzzy) c-means mode: full membership vectors and membership weighted
+	// centers; the fuzzifier m > 1 (m = 2 runs vectorized)
+	inline void set_fuzzy(bool enable) { fuzzy = enable; }
+	inline bool get_fuzzy() const { return fuzzy; }
+	inline void set_fuzzifier(float m) { fuzzifier = m; }
+
+	// Pyramid mode: the clustering runs on 1 of every 4^levels pixels (levels 1: 1/4,
+	// 2: 1/16, 0: off) and the labels are propagated to the full resolution. With the
+	// report enabled every frame is clustered a second time at full resolution to fill
+	// the pyramid report (the frame keeps the pyramid result).
+	inline void set_pyramid_levels(int levels) { pyramid_levels = levels; }
+	inline int get_pyramid_levels() const { return pyramid_levels; }
+	inline void set_pyramid_upsampling(PYRAMID_UPSAMPLING upsampling) { pyramid_upsampling = upsampling; }
+	inline void set_pyramid_report(bool enable) { pyramid_report_enabled = enable; }
+	inline const PyramidReport& get_pyramid_report() const { return pyramid_report; }
+
+	// Per-cluster statistics (mean, covariance, PCA oriented box, mean color and normal),
+	// summed by the centroid update of the full k-means pass (the coarse points in pyramid
+	// mode); frames clustered by another mode keep the statistics of the last k-means frame
+	inline void set_cluster_stats(bool enable) { cluster_stats = enable; }
+	inline bool get_cluster_stats_enabled() const { return cluster_stats; }
+	inline const std::vector<ClusterStats>& get_cluster_stats() const { return stats; }
+
+	// Tracking mode: after every k-means frame the clusters are matched to tracks
+	// (centroid distance, color and size, optimal k x k assignment), and the
+	// constant velocity predictions of the tracks seed the next frame; needs the
+	// cluster statistics, which are computed while tracking
+	inline void set_tracking(bool enable) { tracking = enable; if (!enable) tracker.reset(); }
+	inline bool get_tracking() const { return tracking; }
+	inline void set_tracker_params(const TrackerParams& params) { tracker.set_params(params); }
+	inline const ClusterTracker& get_tracker() const { return tracker; }
+
+	// Seeding of the first frame: 1: k-means++, 2: uniform at random, 3: k-means||
+	inline void set_seeding_type(int type) { AutoSeedingType = type; }
+	inline int get_seeding_type() const { return AutoSeedingType; }
+
+	void update();
+
+	void assigned_label(const int* index, int count);
 	void	AssignLabelColor();
+	const ClusterPalette& get_palette();
 	void	Clustering_KMeans();
+	void	Clustering_Incremental();
+	void	Clustering_MiniBatch();
+	void	Clustering_FuzzyCMeans();
+	void	Clustering_Pyramid();
 	void ChooseUniformCenters(vec3* center_of_cluster);
 	void ChooseSmartCenters(vec3* center_of_cluster, int numLocalTries);
+	void ChooseParallelCenters(vec3* center_of_cluster, int numRounds, float fOversampling);
+	int GetFirstSeed() const;
+	void ReportFrame();
+	void SeedCenters();
+	void BuildLabelColors();
+	void RunClusteringMode();
+	void PropagateLabels(int step);
+	void ComparePyramid(const std::vector<vec3>& start_centers);
 	int GetNearestNeighborIndex(vec3 center_of_cluster);
-	inline float CalculateDistance(const vec3 &v1, const vec3 &v2, const vec3 &c1, const vec3 &c2, const vec3 &n1, const vec3 &n2, bool considerColor, bool considerNormal);
+	inline vec3 position(int i) const { return vec3(input->x[i], input->y[i], input->z[i]); }
+	inline vec3 color(int i) const { return vec3(input->r[i], input->g[i], input->b[i]); }
+	inline vec3 normal(int i) const { return vec3(input->nx[i], input->ny[i], input->nz[i]); }
 private:
 	bool *Mask;
-	Image_buffer *input;
+	FrameStore *input = NULL;
+	const SpatialGrid* spatial_index = NULL;
+	int nNumCluster;
 	float alpha = 0.00332931578291761926961249526;
 	float gama = 1.0 - alpha;
+	float fWeight = 0.0001;
+	KERNEL_ISA kernel_isa;
+	AssignKernel assign_kernel;
+	FuzzyKernel fuzzy_kernel;
+	ClusterReduction reduction;
+	int num_threads = 0;
+	bool deterministic = false;
+	bool accelerated = false;
+	TerminationPolicy termination;
+	FrameTelemetry telemetry;
+	DiagnosticsSink* diagnostics = NULL;
+	bool fuzzy = false;
+	bool fuzzy_ready = false;
+	float fuzzifier = 2.0f;
+	KernelCenters fuzzy_centers = KernelCenters(kDEFAULT_NUM_CLUSTERS);
+	std::vector<int> candidate_buffer;
+	bool temporal = false;
+	bool temporal_ready = false;
+	float temporal_tolerance = 0.01f;
+	int temporal_refresh = 30;
+	int temporal_frames = 0;
+	KernelCenters tracked_centers = KernelCenters(kDEFAULT_NUM_CLUSTERS);
+	ClusterReduction tracked_sums;
+	bool minibatch = false;
+	int batch_size = 4096;
+	int batch_iterations = 50;
+	std::vector<int> batch;
+	std::mt19937 batch_rng;
+	CenterSeeding seeding;
+	int pyramid_levels = 0;
+	PYRAMID_UPSAMPLING pyramid_upsampling = PYRAMID_EDGE_AWARE;
+	bool pyramid_report_enabled = false;
+	PyramidReport pyramid_report;
+	std::vector<int> pyramid_index;
+	bool cluster_stats = false;
+	std::vector<ClusterStats> stats;
+	bool stats_fresh = false;
+	bool tracking = false;
+	ClusterTracker tracker;
 
 
 	int S_OBJECT_DETECTING = -1;
@@ -53,6 +254,7 @@ private:
 	int ML_OBJECT_DETECTING;
 	vec3* center_of_cluster = NULL;
 	vec3* clustersColors = NULL;
+	ClusterPalette palette;
 	int AutoSeedingType = 1;
 
 };
\ No newline at end of file
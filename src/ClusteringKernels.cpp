@@ -0,0 +1,637 @@
+//============================================================================
+// Name        : ClusteringKernels.cpp
+// Copyright   : GWU Research
+// Description : Vectorized point-to-center assignment kernels
+//============================================================================
+
+#include "ClusteringKernels.h"
+
+// C/C++
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+
+// Initial best distance, same as the original scalar loop
+static const float kMAX_DISTANCE = 100000.0f;
+
+// Smallest squared distance of the fuzzy kernels, a point sitting on a center
+// gets (almost) all of its membership
+static const float kMIN_FUZZY_DISTANCE2 = 1e-12f;
+
+
+/**
+ * Every kernel is a template over the number of clusters K. The specialized
+ * instances (K = kMIN_SPECIALIZED_K..kMAX_SPECIALIZED_K) have a compile-time
+ * center loop that the compiler fully unrolls, keeping the per-lane best
+ * distance/label in registers; K = 0 is the generic instance for any k.
+ */
+
+
+/**
+ * @brief Scalar fallback. Squared distances are compared when the normal term
+ *        is disabled, otherwise the full metric is used.
+ */
+template <int K>
+static void assign_scalar(const FrameStore& points, const KernelCenters& centers,
+                          const KernelParams& params, const int* index, int count,
+                          int* label, float* min_dist, float* second_dist) {
+
+    const int k = (K > 0) ? K : centers.k;
+    const bool use_normal = (params.normal_weight != 0.0f);
+
+    for (int n = 0; n < count; n++) {
+
+        const int i = index[n];
+        int best_label = 0;
+        float best = use_normal ? kMAX_DISTANCE : kMAX_DISTANCE * kMAX_DISTANCE;
+        float second = best;
+        for (int j = 0; j < k; j++) {
+
+            float dist;
+            if (use_normal) {
+                dist = point_center_distance(points, i, centers, j, params);
+            }
+            else {
+                const float dx = points.x[i] - centers.px[j];
+                const float dy = points.y[i] - centers.py[j];
+                const float dz = points.z[i] - centers.pz[j];
+                const float dr = points.r[i] - centers.cr[j];
+                const float dg = points.g[i] - centers.cg[j];
+                const float db = points.b[i] - centers.cb[j];
+                dist = params.position_weight2 * (dx*dx + dy*dy + dz*dz) +
+                       params.color_weight2 * (dr*dr + dg*dg + db*db);
+            }
+
+            if (dist < best) {
+                second = best;
+                best = dist;
+                best_label = j;
+            }
+            else if (dist < second) {
+                second = dist;
+            }
+        }
+
+        label[i] = best_label;
+        if (min_dist) {
+            min_dist[i] = use_normal ? best : sqrtf(best);
+        }
+        if (second_dist) {
+            second_dist[i] = use_normal ? second : sqrtf(second);
+        }
+    }
+}
+
+
+/**
+ * @brief SSE4.2 kernel, scores 4 points against all the centers at once
+ */
+template <int K>
+KERNEL_TARGET_SSE42 static void assign_sse42(const FrameStore& points, const KernelCenters& centers,
+                         const KernelParams& params, const int* index, int count,
+                         int* label, float* min_dist, float* second_dist) {
+
+    const int k = (K > 0) ? K : centers.k;
+    const bool use_normal = (params.normal_weight != 0.0f);
+    const __m128 w_pos = _mm_set1_ps(params.position_weight2);
+    const __m128 w_col = _mm_set1_ps(params.color_weight2);
+    const __m128 w_nor = _mm_set1_ps(params.normal_weight);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 init = _mm_set1_ps(use_normal ? kMAX_DISTANCE : kMAX_DISTANCE * kMAX_DISTANCE);
+
+    int n = 0;
+    for (; n + 4 <= count; n += 4) {
+
+        // no gather on SSE, lanes are loaded one by one
+        const int i0 = index[n], i1 = index[n + 1], i2 = index[n + 2], i3 = index[n + 3];
+        const __m128 x = _mm_setr_ps(points.x[i0], points.x[i1], points.x[i2], points.x[i3]);
+        const __m128 y = _mm_setr_ps(points.y[i0], points.y[i1], points.y[i2], points.y[i3]);
+        const __m128 z = _mm_setr_ps(points.z[i0], points.z[i1], points.z[i2], points.z[i3]);
+        const __m128 r = _mm_setr_ps(points.r[i0], points.r[i1], points.r[i2], points.r[i3]);
+        const __m128 g = _mm_setr_ps(points.g[i0], points.g[i1], points.g[i2], points.g[i3]);
+        const __m128 b = _mm_setr_ps(points.b[i0], points.b[i1], points.b[i2], points.b[i3]);
+        const __m128 nx = _mm_setr_ps(points.nx[i0], points.nx[i1], points.nx[i2], points.nx[i3]);
+        const __m128 ny = _mm_setr_ps(points.ny[i0], points.ny[i1], points.ny[i2], points.ny[i3]);
+        const __m128 nz = _mm_setr_ps(points.nz[i0], points.nz[i1], points.nz[i2], points.nz[i3]);
+        // points without a normal skip the normal term
+        const __m128 has_normal = _mm_or_ps(_mm_or_ps(_mm_cmpneq_ps(nx, zero), _mm_cmpneq_ps(ny, zero)),
+                                            _mm_cmpneq_ps(nz, zero));
+
+        __m128 best = init;
+        __m128 second = init;
+        __m128i best_label = _mm_setzero_si128();
+        for (int j = 0; j < k; j++) {
+
+            __m128 d, t;
+            d = _mm_sub_ps(x, _mm_set1_ps(centers.px[j]));  __m128 dp = _mm_mul_ps(d, d);
+            d = _mm_sub_ps(y, _mm_set1_ps(centers.py[j]));  dp = _mm_add_ps(dp, _mm_mul_ps(d, d));
+            d = _mm_sub_ps(z, _mm_set1_ps(centers.pz[j]));  dp = _mm_add_ps(dp, _mm_mul_ps(d, d));
+            d = _mm_sub_ps(r, _mm_set1_ps(centers.cr[j]));  __m128 dc = _mm_mul_ps(d, d);
+            d = _mm_sub_ps(g, _mm_set1_ps(centers.cg[j]));  dc = _mm_add_ps(dc, _mm_mul_ps(d, d));
+            d = _mm_sub_ps(b, _mm_set1_ps(centers.cb[j]));  dc = _mm_add_ps(dc, _mm_mul_ps(d, d));
+            __m128 dist = _mm_add_ps(_mm_mul_ps(w_pos, dp), _mm_mul_ps(w_col, dc));
+
+            if (use_normal) {
+                t = _mm_mul_ps(nx, _mm_set1_ps(centers.nx[j]));
+                t = _mm_add_ps(t, _mm_mul_ps(ny, _mm_set1_ps(centers.ny[j])));
+                t = _mm_add_ps(t, _mm_mul_ps(nz, _mm_set1_ps(centers.nz[j])));
+                t = _mm_and_ps(_mm_mul_ps(w_nor, _mm_sub_ps(one, t)), has_normal);
+                dist = _mm_add_ps(_mm_sqrt_ps(dist), t);
+            }
+
+            const __m128 closer = _mm_cmplt_ps(dist, best);
+            if (second_dist) {
+                second = _mm_min_ps(second, _mm_max_ps(best, dist));
+            }
+            best = _mm_blendv_ps(best, dist, closer);
+            best_label = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(best_label),
+                                                        _mm_castsi128_ps(_mm_set1_epi32(j)), closer));
+        }
+        if (!use_normal) {
+            best = _mm_sqrt_ps(best);
+            second = _mm_sqrt_ps(second);
+        }
+
+        // scatter
+        alignas(16) int lane_label[4];
+        alignas(16) float lane_dist[4];
+        alignas(16) float lane_second[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lane_label), best_label);
+        _mm_store_ps(lane_dist, best);
+        _mm_store_ps(lane_second, second);
+        for (int lane = 0; lane < 4; lane++) {
+            label[index[n + lane]] = lane_label[lane];
+            if (min_dist) {
+                min_dist[index[n + lane]] = lane_dist[lane];
+            }
+            if (second_dist) {
+                second_dist[index[n + lane]] = lane_second[lane];
+            }
+        }
+    }
+
+    // tail
+    assign_scalar<K>(points, centers, params, index + n, count - n, label, min_dist, second_dist);
+}
+
+
+/**
+ * @brief AVX2 kernel, scores 8 points against all the centers at once
+ */
+template <int K>
+KERNEL_TARGET_AVX2 static void assign_avx2(const FrameStore& points, const KernelCenters& centers,
+                        const KernelParams& params, const int* index, int count,
+                        int* label, float* min_dist, float* second_dist) {
+
+    const int k = (K > 0) ? K : centers.k;
+    const bool use_normal = (params.normal_weight != 0.0f);
+    const __m256 w_pos = _mm256_set1_ps(params.position_weight2);
+    const __m256 w_col = _mm256_set1_ps(params.color_weight2);
+    const __m256 w_nor = _mm256_set1_ps(params.normal_weight);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 init = _mm256_set1_ps(use_normal ? kMAX_DISTANCE : kMAX_DISTANCE * kMAX_DISTANCE);
+
+    int n = 0;
+    for (; n + 8 <= count; n += 8) {
+
+        const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + n));
+        const __m256 x = _mm256_i32gather_ps(points.x, idx, 4);
+        const __m256 y = _mm256_i32gather_ps(points.y, idx, 4);
+        const __m256 z = _mm256_i32gather_ps(points.z, idx, 4);
+        const __m256 r = _mm256_i32gather_ps(points.r, idx, 4);
+        const __m256 g = _mm256_i32gather_ps(points.g, idx, 4);
+        const __m256 b = _mm256_i32gather_ps(points.b, idx, 4);
+        const __m256 nx = _mm256_i32gather_ps(points.nx, idx, 4);
+        const __m256 ny = _mm256_i32gather_ps(points.ny, idx, 4);
+        const __m256 nz = _mm256_i32gather_ps(points.nz, idx, 4);
+        // points without a normal skip the normal term
+        const __m256 has_normal = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(nx, zero, _CMP_NEQ_UQ),
+                                                            _mm256_cmp_ps(ny, zero, _CMP_NEQ_UQ)),
+                                               _mm256_cmp_ps(nz, zero, _CMP_NEQ_UQ));
+
+        __m256 best = init;
+        __m256 second = init;
+        __m256i best_label = _mm256_setzero_si256();
+        for (int j = 0; j < k; j++) {
+
+            __m256 d, t;
+            d = _mm256_sub_ps(x, _mm256_set1_ps(centers.px[j]));  __m256 dp = _mm256_mul_ps(d, d);
+            d = _mm256_sub_ps(y, _mm256_set1_ps(centers.py[j]));  dp = _mm256_add_ps(dp, _mm256_mul_ps(d, d));
+            d = _mm256_sub_ps(z, _mm256_set1_ps(centers.pz[j]));  dp = _mm256_add_ps(dp, _mm256_mul_ps(d, d));
+            d = _mm256_sub_ps(r, _mm256_set1_ps(centers.cr[j]));  __m256 dc = _mm256_mul_ps(d, d);
+            d = _mm256_sub_ps(g, _mm256_set1_ps(centers.cg[j]));  dc = _mm256_add_ps(dc, _mm256_mul_ps(d, d));
+            d = _mm256_sub_ps(b, _mm256_set1_ps(centers.cb[j]));  dc = _mm256_add_ps(dc, _mm256_mul_ps(d, d));
+            __m256 dist = _mm256_add_ps(_mm256_mul_ps(w_pos, dp), _mm256_mul_ps(w_col, dc));
+
+            if (use_normal) {
+                t = _mm256_mul_ps(nx, _mm256_set1_ps(centers.nx[j]));
+                t = _mm256_add_ps(t, _mm256_mul_ps(ny, _mm256_set1_ps(centers.ny[j])));
+                t = _mm256_add_ps(t, _mm256_mul_ps(nz, _mm256_set1_ps(centers.nz[j])));
+                t = _mm256_and_ps(_mm256_mul_ps(w_nor, _mm256_sub_ps(one, t)), has_normal);
+                dist = _mm256_add_ps(_mm256_sqrt_ps(dist), t);
+            }
+
+            const __m256 closer = _mm256_cmp_ps(dist, best, _CMP_LT_OQ);
+            if (second_dist) {
+                second = _mm256_min_ps(second, _mm256_max_ps(best, dist));
+            }
+            best = _mm256_blendv_ps(best, dist, closer);
+            best_label = _mm256_blendv_epi8(best_label, _mm256_set1_epi32(j), _mm256_castps_si256(closer));
+        }
+        if (!use_normal) {
+            best = _mm256_sqrt_ps(best);
+            second = _mm256_sqrt_ps(second);
+        }
+
+        // no scatter on AVX2
+        alignas(32) int lane_label[8];
+        alignas(32) float lane_dist[8];
+        alignas(32) float lane_second[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lane_label), best_label);
+        _mm256_store_ps(lane_dist, best);
+        _mm256_store_ps(lane_second, second);
+        for (int lane = 0; lane < 8; lane++) {
+            label[index[n + lane]] = lane_label[lane];
+            if (min_dist) {
+                min_dist[index[n + lane]] = lane_dist[lane];
+            }
+            if (second_dist) {
+                second_dist[index[n + lane]] = lane_second[lane];
+            }
+        }
+    }
+
+    // tail
+    assign_scalar<K>(points, centers, params, index + n, count - n, label, min_dist, second_dist);
+}
+
+
+/**
+ * @brief Scalar fuzzy c-means memberships, any fuzzifier
+ */
+static void fuzzy_scalar(const FrameStore& points, const KernelCenters& centers,
+                         const KernelParams& params, float fuzzifier, const int* index, int count,
+                         float* membership, int* label, float* objective) {
+
+    const int k = centers.k;
+    const size_t plane = points.size;
+    const float exponent = 1.0f / (fuzzifier - 1.0f);
+    std::vector<float> weight(k);
+
+    for (int n = 0; n < count; n++) {
+
+        // w_j = (d_j^2)^(-1/(m-1)), u_j = w_j / sum(w)
+        const int i = index[n];
+        float total = 0.0f;
+        float best = -1.0f;
+        int best_label = 0;
+        for (int j = 0; j < k; j++) {
+            const float dist = point_center_distance(points, i, centers, j, params);
+            const float dist2 = std::max(dist * dist, kMIN_FUZZY_DISTANCE2);
+            weight[j] = (fuzzifier == 2.0f) ? 1.0f / dist2 : powf(dist2, -exponent);
+            total += weight[j];
+            if (weight[j] > best) {
+                best = weight[j];
+                best_label = j;
+            }
+        }
+
+        for (int j = 0; j < k; j++) {
+            membership[j * plane + i] = weight[j] / total;
+        }
+        label[i] = best_label;
+        if (objective) {
+            // sum_j u_j^m d_j^2 = sum(w)^(1-m)
+            objective[i] = sqrtf(powf(total, 1.0f - fuzzifier));
+        }
+    }
+}
+
+
+/**
+ * @brief SSE4.2 fuzzy c-means memberships (m = 2), 4 points at once
+ */
+KERNEL_TARGET_SSE42 static void fuzzy_sse42(const FrameStore& points, const KernelCenters& centers,
+                        const KernelParams& params, float fuzzifier, const int* index, int count,
+                        float* membership, int* label, float* objective) {
+
+    if (fuzzifier != 2.0f) {
+        fuzzy_scalar(points, centers, params, fuzzifier, index, count, membership, label, objective);
+        return;
+    }
+
+    const int k = centers.k;
+    const size_t plane = points.size;
+    const bool use_normal = (params.normal_weight != 0.0f);
+    const __m128 w_pos = _mm_set1_ps(params.position_weight2);
+    const __m128 w_col = _mm_set1_ps(params.color_weight2);
+    const __m128 w_nor = _mm_set1_ps(params.normal_weight);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 min_dist2 = _mm_set1_ps(kMIN_FUZZY_DISTANCE2);
+    std::vector<float> weight(k * 4);
+
+    int n = 0;
+    for (; n + 4 <= count; n += 4) {
+
+        const int i0 = index[n], i1 = index[n + 1], i2 = index[n + 2], i3 = index[n + 3];
+        const __m128 x = _mm_setr_ps(points.x[i0], points.x[i1], points.x[i2], points.x[i3]);
+        const __m128 y = _mm_setr_ps(points.y[i0], points.y[i1], points.y[i2], points.y[i3]);
+        const __m128 z = _mm_setr_ps(points.z[i0], points.z[i1], points.z[i2], points.z[i3]);
+        const __m128 r = _mm_setr_ps(points.r[i0], points.r[i1], points.r[i2], points.r[i3]);
+        const __m128 g = _mm_setr_ps(points.g[i0], points.g[i1], points.g[i2], points.g[i3]);
+        const __m128 b = _mm_setr_ps(points.b[i0], points.b[i1], points.b[i2], points.b[i3]);
+        const __m128 nx = _mm_setr_ps(points.nx[i0], points.nx[i1], points.nx[i2], points.nx[i3]);
+        const __m128 ny = _mm_setr_ps(points.ny[i0], points.ny[i1], points.ny[i2], points.ny[i3]);
+        const __m128 nz = _mm_setr_ps(points.nz[i0], points.nz[i1], points.nz[i2], points.nz[i3]);
+        const __m128 has_normal = _mm_or_ps(_mm_or_ps(_mm_cmpneq_ps(nx, zero), _mm_cmpneq_ps(ny, zero)),
+                                            _mm_cmpneq_ps(nz, zero));
+
+        __m128 total = zero;
+        __m128 best = _mm_set1_ps(-1.0f);
+        __m128i best_label = _mm_setzero_si128();
+        for (int j = 0; j < k; j++) {
+
+            __m128 d, t;
+            d = _mm_sub_ps(x, _mm_set1_ps(centers.px[j]));  __m128 dp = _mm_mul_ps(d, d);
+            d = _mm_sub_ps(y, _mm_set1_ps(centers.py[j]));  dp = _mm_add_ps(dp, _mm_mul_ps(d, d));
+            d = _mm_sub_ps(z, _mm_set1_ps(centers.pz[j]));  dp = _mm_add_ps(dp, _mm_mul_ps(d, d));
+            d = _mm_sub_ps(r, _mm_set1_ps(centers.cr[j]));  __m128 dc = _mm_mul_ps(d, d);
+            d = _mm_sub_ps(g, _mm_set1_ps(centers.cg[j]));  dc = _mm_add_ps(dc, _mm_mul_ps(d, d));
+            d = _mm_sub_ps(b, _mm_set1_ps(centers.cb[j]));  dc = _mm_add_ps(dc, _mm_mul_ps(d, d));
+            __m128 dist2 = _mm_add_ps(_mm_mul_ps(w_pos, dp), _mm_mul_ps(w_col, dc));
+
+            if (use_normal) {
+                t = _mm_mul_ps(nx, _mm_set1_ps(centers.nx[j]));
+                t = _mm_add_ps(t, _mm_mul_ps(ny, _mm_set1_ps(centers.ny[j])));
+                t = _mm_add_ps(t, _mm_mul_ps(nz, _mm_set1_ps(centers.nz[j])));
+                t = _mm_and_ps(_mm_mul_ps(w_nor, _mm_sub_ps(one, t)), has_normal);
+                const __m128 dist = _mm_add_ps(_mm_sqrt_ps(dist2), t);
+                dist2 = _mm_mul_ps(dist, dist);
+            }
+
+            const __m128 w = _mm_div_ps(one, _mm_max_ps(dist2, min_dist2));
+            _mm_storeu_ps(&weight[j * 4], w);
+            total = _mm_add_ps(total, w);
+
+            const __m128 larger = _mm_cmpgt_ps(w, best);
+            best = _mm_blendv_ps(best, w, larger);
+            best_label = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(best_label),
+                                                        _mm_castsi128_ps(_mm_set1_epi32(j)), larger));
+        }
+
+        // normalize and scatter the memberships plane by plane
+        const __m128 inv_total = _mm_div_ps(one, total);
+        alignas(16) float lane_value[4];
+        for (int j = 0; j < k; j++) {
+            _mm_store_ps(lane_value, _mm_mul_ps(_mm_loadu_ps(&weight[j * 4]), inv_total));
+            float* membership_j = membership + j * plane;
+            for (int lane = 0; lane < 4; lane++) {
+                membership_j[index[n + lane]] = lane_value[lane];
+            }
+        }
+
+        alignas(16) int lane_label[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lane_label), best_label);
+        _mm_store_ps(lane_value, _mm_sqrt_ps(inv_total));
+        for (int lane = 0; lane < 4; lane++) {
+            label[index[n + lane]] = lane_label[lane];
+            if (objective) {
+                objective[index[n + lane]] = lane_value[lane];
+            }
+        }
+    }
+
+    // tail
+    fuzzy_scalar(points, centers, params, fuzzifier, index + n, count - n, membership, label, objective);
+}
+
+
+/**
+ * @brief AVX2 fuzzy c-means memberships (m = 2), 8 points at once
+ */
+KERNEL_TARGET_AVX2 static void fuzzy_avx2(const FrameStore& points, const KernelCenters& centers,
+                       const KernelParams& params, float fuzzifier, const int* index, int count,
+                       float* membership, int* label, float* objective) {
+
+    if (fuzzifier != 2.0f) {
+        fuzzy_scalar(points, centers, params, fuzzifier, index, count, membership, label, objective);
+        return;
+    }
+
+    const int k = centers.k;
+    const size_t plane = points.size;
+    const bool use_normal = (params.normal_weight != 0.0f);
+    const __m256 w_pos = _mm256_set1_ps(params.position_weight2);
+    const __m256 w_col = _mm256_set1_ps(params.color_weight2);
+    const __m256 w_nor = _mm256_set1_ps(params.normal_weight);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 min_dist2 = _mm256_set1_ps(kMIN_FUZZY_DISTANCE2);
+    std::vector<float> weight(k * 8);
+
+    int n = 0;
+    for (; n + 8 <= count; n += 8) {
+
+        const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + n));
+        const __m256 x = _mm256_i32gather_ps(points.x, idx, 4);
+        const __m256 y = _mm256_i32gather_ps(points.y, idx, 4);
+        const __m256 z = _mm256_i32gather_ps(points.z, idx, 4);
+        const __m256 r = _mm256_i32gather_ps(points.r, idx, 4);
+        const __m256 g = _mm256_i32gather_ps(points.g, idx, 4);
+        const __m256 b = _mm256_i32gather_ps(points.b, idx, 4);
+        const __m256 nx = _mm256_i32gather_ps(points.nx, idx, 4);
+        const __m256 ny = _mm256_i32gather_ps(points.ny, idx, 4);
+        const __m256 nz = _mm256_i32gather_ps(points.nz, idx, 4);
+        const __m256 has_normal = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(nx, zero, _CMP_NEQ_UQ),
+                                                            _mm256_cmp_ps(ny, zero, _CMP_NEQ_UQ)),
+                                               _mm256_cmp_ps(nz, zero, _CMP_NEQ_UQ));
+
+        __m256 total = zero;
+        __m256 best = _mm256_set1_ps(-1.0f);
+        __m256i best_label = _mm256_setzero_si256();
+        for (int j = 0; j < k; j++) {
+
+            __m256 d, t;
+            d = _mm256_sub_ps(x, _mm256_set1_ps(centers.px[j]));  __m256 dp = _mm256_mul_ps(d, d);
+            d = _mm256_sub_ps(y, _mm256_set1_ps(centers.py[j]));  dp = _mm256_add_ps(dp, _mm256_mul_ps(d, d));
+            d = _mm256_sub_ps(z, _mm256_set1_ps(centers.pz[j]));  dp = _mm256_add_ps(dp, _mm256_mul_ps(d, d));
+            d = _mm256_sub_ps(r, _mm256_set1_ps(centers.cr[j]));  __m256 dc = _mm256_mul_ps(d, d);
+            d = _mm256_sub_ps(g, _mm256_set1_ps(centers.cg[j]));  dc = _mm256_add_ps(dc, _mm256_mul_ps(d, d));
+            d = _mm256_sub_ps(b, _mm256_set1_ps(centers.cb[j]));  dc = _mm256_add_ps(dc, _mm256_mul_ps(d, d));
+            __m256 dist2 = _mm256_add_ps(_mm256_mul_ps(w_pos, dp), _mm256_mul_ps(w_col, dc));
+
+            if (use_normal) {
+                t = _mm256_mul_ps(nx, _mm256_set1_ps(centers.nx[j]));
+                t = _mm256_add_ps(t, _mm256_mul_ps(ny, _mm256_set1_ps(centers.ny[j])));
+                t = _mm256_add_ps(t, _mm256_mul_ps(nz, _mm256_set1_ps(centers.nz[j])));
+                t = _mm256_and_ps(_mm256_mul_ps(w_nor, _mm256_sub_ps(one, t)), has_normal);
+                const __m256 dist = _mm256_add_ps(_mm256_sqrt_ps(dist2), t);
+                dist2 = _mm256_mul_ps(dist, dist);
+            }
+
+            const __m256 w = _mm256_div_ps(one, _mm256_max_ps(dist2, min_dist2));
+            _mm256_storeu_ps(&weight[j * 8], w);
+            total = _mm256_add_ps(total, w);
+
+            const __m256 larger = _mm256_cmp_ps(w, best, _CMP_GT_OQ);
+            best = _mm256_blendv_ps(best, w, larger);
+            best_label = _mm256_blendv_epi8(best_label, _mm256_set1_epi32(j), _mm256_castps_si256(larger));
+        }
+
+        // normalize and scatter the memberships plane by plane
+        const __m256 inv_total = _mm256_div_ps(one, total);
+        alignas(32) float lane_value[8];
+        for (int j = 0; j < k; j++) {
+            _mm256_store_ps(lane_value, _mm256_mul_ps(_mm256_loadu_ps(&weight[j * 8]), inv_total));
+            float* membership_j = membership + j * plane;
+            for (int lane = 0; lane < 8; lane++) {
+                membership_j[index[n + lane]] = lane_value[lane];
+            }
+        }
+
+        alignas(32) int lane_label[8];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lane_label), best_label);
+        _mm256_store_ps(lane_value, _mm256_sqrt_ps(inv_total));
+        for (int lane = 0; lane < 8; lane++) {
+            label[index[n + lane]] = lane_label[lane];
+            if (objective) {
+                objective[index[n + lane]] = lane_value[lane];
+            }
+        }
+    }
+
+    // tail
+    fuzzy_scalar(points, centers, params, fuzzifier, index + n, count - n, membership, label, objective);
+}
+
+
+/**
+ * @brief CPUID leaf and subleaf (MSVC intrinsic or the GCC/Clang header)
+ */
+static inline void cpuid(int info[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subleaf);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+    info[0] = (int)a;
+    info[1] = (int)b;
+    info[2] = (int)c;
+    info[3] = (int)d;
+#endif
+}
+
+
+/**
+ * @brief OS enabled register state (XCR0), only valid when OSXSAVE is set
+ */
+static inline unsigned long long xcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+
+/**
+ * @brief Detects the best instruction set supported by the running CPU
+ */
+KERNEL_ISA detect_kernel_isa() {
+
+    int info[4];
+    cpuid(info, 0, 0);
+    const int max_leaf = info[0];
+
+    cpuid(info, 1, 0);
+    const bool sse42 = (info[2] & (1 << 20)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+
+    // AVX state must be enabled by the OS (XCR0 bits 1 and 2)
+    bool avx2 = false;
+    if (avx && osxsave && ((xcr0() & 0x6) == 0x6) && max_leaf >= 7) {
+        cpuid(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2) {
+        return KERNEL_AVX2;
+    }
+    if (sse42) {
+        return KERNEL_SSE42;
+    }
+    return KERNEL_SCALAR;
+}
+
+
+/**
+ * @brief Kernel instance for a given K and instruction set
+ */
+template <int K>
+static AssignKernel select_instance(KERNEL_ISA isa) {
+
+    switch (isa) {
+    case KERNEL_AVX2:
+        return assign_avx2<K>;
+    case KERNEL_SSE42:
+        return assign_sse42<K>;
+    default:
+        return assign_scalar<K>;
+    }
+}
+
+
+// Walks K = kMAX_SPECIALIZED_K..kMIN_SPECIALIZED_K at compile time, falls back
+// to the generic kernel when k is not specialized
+template <int K>
+struct KernelTable {
+    static AssignKernel get(KERNEL_ISA isa, int k) {
+        return (k == K) ? select_instance<K>(isa) : KernelTable<K - 1>::get(isa, k);
+    }
+};
+
+template <>
+struct KernelTable<kMIN_SPECIALIZED_K - 1> {
+    static AssignKernel get(KERNEL_ISA isa, int /*k*/) {
+        return select_instance<0>(isa);
+    }
+};
+
+
+/**
+ * @brief Returns the assignment kernel for the given instruction set and
+ *        number of clusters
+ */
+AssignKernel select_assign_kernel(KERNEL_ISA isa, int k) {
+
+    return KernelTable<kMAX_SPECIALIZED_K>::get(isa, k);
+}
+
+
+
+/**
+ * @brief Returns the fuzzy membership kernel for the given instruction set
+ */
+FuzzyKernel select_fuzzy_kernel(KERNEL_ISA isa) {
+
+    switch (isa) {
+    case KERNEL_AVX2:
+        return fuzzy_avx2;
+    case KERNEL_SSE42:
+        return fuzzy_sse42;
+    default:
+        return fuzzy_scalar;
+    }
+}
@@ -0,0 +1,166 @@
+//============================================================================
+// Name        : ClusteringKernels.h
+// Copyright   : GWU Research
+// Description : Vectorized point-to-center assignment kernels
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+
+// C/C++
+#include <cmath>
+#include <vector>
+
+
+// Range of k with a compile-time specialized kernel, other k use the generic one
+static const int kMIN_SPECIALIZED_K = 2;
+static const int kMAX_SPECIALIZED_K = 16;
+
+
+// Instruction sets the kernels are built for
+enum KERNEL_ISA {
+    KERNEL_SCALAR,
+    KERNEL_SSE42,
+    KERNEL_AVX2
+};
+
+
+// Instruction set of the SIMD kernel functions. MSVC emits any intrinsic in
+// any function; GCC and Clang need the target on the function itself, so the
+// rest of the binary stays baseline x86-64 and detect_kernel_isa() picks the
+// kernel at run time.
+#ifdef _MSC_VER
+#define KERNEL_TARGET_SSE42
+#define KERNEL_TARGET_AVX2
+#else
+#define KERNEL_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define KERNEL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+
+// Distance weights: d = sqrt(gama^2*|dp|^2 + alpha^2*|dc|^2) + fWeight*(1 - n.nc)
+// With fWeight == 0 the assignment kernels compare the squared distances and
+// take the square root of the winner only; any other weight (the default
+// 0.0001 included) evaluates the full metric for every center.
+struct KernelParams {
+    float position_weight2;     // gama^2
+    float color_weight2;        // alpha^2
+    float normal_weight;        // fWeight (0 disables the normal term)
+};
+
+
+// Center attributes of the current iteration, one array per attribute so the
+// kernels can broadcast them
+struct KernelCenters {
+
+    explicit KernelCenters(int k_) :
+    k(k_), px(k_), py(k_), pz(k_), cr(k_), cg(k_), cb(k_), nx(k_), ny(k_), nz(k_) {}
+
+    int k;
+    std::vector<float> px, py, pz;  // Center position
+    std::vector<float> cr, cg, cb;  // Center color
+    std::vector<float> nx, ny, nz;  // Center normal
+};
+
+
+/**
+ * @brief Assigns each listed point to its nearest center
+ *
+ * @param points       Registered frame
+ * @param centers      Centers of the current iteration
+ * @param params       Distance weights
+ * @param index        Point indices (valid points)
+ * @param count        Number of indices
+ * @param label        Output labels, indexed by point
+ * @param min_dist     Output distance to the chosen center, indexed by point (may be NULL)
+ * @param second_dist  Output distance to the second closest center, indexed by point (may be NULL)
+ */
+typedef void (*AssignKernel)(const FrameStore& points, const KernelCenters& centers,
+                             const KernelParams& params, const int* index, int count,
+                             int* label, float* min_dist, float* second_dist);
+
+
+/**
+ * @brief Computes the fuzzy c-means memberships of each listed point,
+ *        u_j = 1 / sum_l (d_j / d_l)^(2 / (m - 1))
+ *
+ * @param points      Registered frame
+ * @param centers     Centers of the current iteration
+ * @param params      Distance weights
+ * @param fuzzifier   Fuzzifier m (> 1, 2 is the vectorized case)
+ * @param index       Point indices (valid points)
+ * @param count       Number of indices
+ * @param membership  Output memberships, one plane of points.size entries per center
+ * @param label       Output labels (largest membership), indexed by point
+ * @param objective   Output sqrt of the point objective sum_j u_j^m d_j^2, indexed by point (may be NULL)
+ */
+typedef void (*FuzzyKernel)(const FrameStore& points, const KernelCenters& centers,
+                            const KernelParams& params, float fuzzifier, const int* index, int count,
+                            float* membership, int* label, float* objective);
+
+
+/**
+ * @brief Detects the best instruction set supported by the running CPU
+ */
+KERNEL_ISA detect_kernel_isa();
+
+
+/**
+ * @brief Returns the assignment kernel for the given instruction set and
+ *        number of clusters
+ */
+AssignKernel select_assign_kernel(KERNEL_ISA isa, int k);
+
+
+/**
+ * @brief Returns the fuzzy membership kernel for the given instruction set
+ */
+FuzzyKernel select_fuzzy_kernel(KERNEL_ISA isa);
+
+
+/**
+ * @brief Reference point-to-center distance, used by the scalar kernel
+ */
+inline float point_center_distance(const FrameStore& points, int i,
+                                   const KernelCenters& centers, int j,
+                                   const KernelParams& params) {
+
+    const float dx = points.x[i] - centers.px[j];
+    const float dy = points.y[i] - centers.py[j];
+    const float dz = points.z[i] - centers.pz[j];
+    const float dr = points.r[i] - centers.cr[j];
+    const float dg = points.g[i] - centers.cg[j];
+    const float db = points.b[i] - centers.cb[j];
+    float dist = sqrtf(params.position_weight2 * (dx*dx + dy*dy + dz*dz) +
+                       params.color_weight2 * (dr*dr + dg*dg + db*db));
+
+    const float n1x = points.nx[i], n1y = points.ny[i], n1z = points.nz[i];
+    if (!((n1x == 0) && (n1y == 0) && (n1z == 0))) {
+        dist += params.normal_weight * (1 - (n1x*centers.nx[j] + n1y*centers.ny[j] + n1z*centers.nz[j]));
+    }
+    return dist;
+}
+
+
+/**
+ * @brief Upper bound of how much the distance of any point to center j can
+ *        change when the center moves from "from" to "to" (normals are unit
+ *        length or zero, so the normal term changes by at most fWeight*|dn|)
+ */
+inline float center_drift(const KernelCenters& from, const KernelCenters& to, int j,
+                          const KernelParams& params) {
+
+    const float dx = to.px[j] - from.px[j];
+    const float dy = to.py[j] - from.py[j];
+    const float dz = to.pz[j] - from.pz[j];
+    const float dr = to.cr[j] - from.cr[j];
+    const float dg = to.cg[j] - from.cg[j];
+    const float db = to.cb[j] - from.cb[j];
+    const float dnx = to.nx[j] - from.nx[j];
+    const float dny = to.ny[j] - from.ny[j];
+    const float dnz = to.nz[j] - from.nz[j];
+    return sqrtf(params.position_weight2 * (dx*dx + dy*dy + dz*dz) +
+                 params.color_weight2 * (dr*dr + dg*dg + db*db)) +
+           params.normal_weight * sqrtf(dnx*dnx + dny*dny + dnz*dnz);
+}
@@ -50,9 +50,17 @@ int APIENTRY wWinMain(
 	_In_ int nShowCmd) {
 
 	UNREFERENCED_PARAMETER(hPrevInstance);
-	UNREFERENCED_PARAMETER(lpCmdLine);
 
-    DatasetCollector application(true);
+    // Optional command line argument: number of clusters k
+    int num_clusters = kDEFAULT_NUM_CLUSTERS;
+    if (lpCmdLine && *lpCmdLine) {
+        int k = _wtoi(lpCmdLine);
+        if (k > 0) {
+            num_clusters = k;
+        }
+    }
+
+    DatasetCollector application(true, num_clusters);
 	application.Run(hInstance, nShowCmd);
 }
 
@@ -60,7 +68,7 @@ int APIENTRY wWinMain(
 /**
  * @brief Class constructor
  */
-DatasetCollector::DatasetCollector(bool viewer_enable_) :
+DatasetCollector::DatasetCollector(bool viewer_enable_, int num_clusters_) :
 m_hWnd(NULL),
 m_nNextStatusTime(0LL),
 m_pD2DFactory(NULL),
@@ -70,6 +78,7 @@ m_pDrawDepth(NULL),
 m_pDrawResult(NULL) {
 
     viewer_enable = viewer_enable_;
+    num_clusters = num_clusters_;
 }
 
 
@@ -116,6 +125,7 @@ int DatasetCollector::Run(HINSTANCE hInstance, int nCmdShow) {
 
     // Create kinect grabber
     kinect_grabber = new Grabber();
+    kinect_grabber->set_num_clusters(num_clusters);
     kinect_grabber->init();
 
 	// Dialog custom window class
@@ -31,8 +31,11 @@ public:
 
     /**
      * @brief Class constructor
+     *
+     * @param viewer_enable_  Enables the result viewer
+     * @param num_clusters_   Number of clusters k
      */
-    DatasetCollector(bool viewer_enable_);
+    DatasetCollector(bool viewer_enable_, int num_clusters_ = kDEFAULT_NUM_CLUSTERS);
 
 
     /**
@@ -60,6 +63,7 @@ private:
     // Viewer
 	HWND            m_hWnd;
     bool            viewer_enable;
+    int             num_clusters;
     int             posX, posY;
 
     // Direct2D
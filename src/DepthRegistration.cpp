@@ -0,0 +1,249 @@
+//============================================================================
+// Name        : DepthRegistration.cpp
+// Copyright   : GWU Research
+// Description : Portable depth to color registration (forward projection)
+//============================================================================
+
+#include "DepthRegistration.h"
+
+// C/C++
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+
+// Color rows per z-buffer band (one thread splats a band)
+static const int kBAND_ROWS = 32;
+
+// Depth pixels per task of the projection and binning passes
+static const int kSPLAT_BLOCK = 16384;
+
+// Footprint margin (color pixels) so that neighbor footprints always overlap
+static const float kSPLAT_MARGIN = 0.25f;
+
+
+/**
+ * @brief Identity transform
+ */
+RigidTransform RigidTransform::identity() {
+
+    RigidTransform transform;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            transform.rotation[r][c] = (r == c) ? 1.0f : 0.0f;
+        }
+        transform.translation[r] = 0.0f;
+    }
+    return transform;
+}
+
+
+/**
+ * @brief Reads the transform from a calibration file: one "name value"
+ *        pair per line (r00 .. r22 row major, tx ty tz in meters), '#'
+ *        starts a comment; missing entries keep the identity
+ *
+ * @param path       Calibration file
+ * @param transform  Output transform (unchanged on failure)
+ *
+ * @returns True when the file could be read
+ */
+bool RigidTransform::load(const std::string& path, RigidTransform& transform) {
+
+    RigidTransform loaded = identity();
+    const char* const names[] = { "r00", "r01", "r02", "r10", "r11", "r12", "r20", "r21", "r22", "tx", "ty", "tz" };
+    float* const fields[] = { &loaded.rotation[0][0], &loaded.rotation[0][1], &loaded.rotation[0][2],
+                              &loaded.rotation[1][0], &loaded.rotation[1][1], &loaded.rotation[1][2],
+                              &loaded.rotation[2][0], &loaded.rotation[2][1], &loaded.rotation[2][2],
+                              &loaded.translation[0], &loaded.translation[1], &loaded.translation[2] };
+    unsigned found = 0;
+    if (!read_calibration_file(path, names, fields, sizeof(fields) / sizeof(fields[0]), found)) {
+        return false;
+    }
+    transform = loaded;
+    return true;
+}
+
+
+/**
+ * @brief DepthRegistration constructor
+ *
+ * @param depth_intrinsics_  Depth camera (distortion of the depth image)
+ * @param color_rays_        Color camera rays (size of the registered frame),
+ *                           must outlive the registration
+ * @param depth_to_color_    Depth to color camera transform
+ */
+DepthRegistration::DepthRegistration(const PinholeIntrinsics& depth_intrinsics_,
+                                     const RayTable& color_rays_,
+                                     const RigidTransform& depth_to_color_) :
+color_rays(color_rays_),
+depth_to_color(depth_to_color_),
+min_depth(0.5f),
+max_depth(2.69f) {
+
+    depth_rays.update(depth_intrinsics_);
+
+    const size_t depth_size = (size_t)depth_intrinsics_.width * depth_intrinsics_.height;
+    splat_z.resize(depth_size);
+    splat_c0.resize(depth_size);
+    splat_c1.resize(depth_size);
+    splat_r0.resize(depth_size);
+    splat_r1.resize(depth_size);
+    bins.resize(2 * depth_size);
+}
+
+
+/**
+ * @brief Registers a depth frame into the color frame: position, color
+ *        and mask of every color pixel (valid_index is not built)
+ *
+ * @param depth_mm    Depth image (millimeters, 0: no depth)
+ * @param color_bgrx  Color image, 4 bytes per pixel (blue, green, red, unused)
+ * @param points      Output frame (color resolution)
+ */
+void DepthRegistration::register_frame(const unsigned short* depth_mm, const unsigned char* color_bgrx,
+                                       FrameStore& points) {
+
+    const PinholeIntrinsics& depth = depth_rays.get_intrinsics();
+    const PinholeIntrinsics& color = color_rays.get_intrinsics();
+    const int depth_width = depth.width;
+    const int depth_size = depth.width * depth.height;
+    const int width = color.width;
+    const int height = color.height;
+    const int num_bands = (height + kBAND_ROWS - 1) / kBAND_ROWS;
+    const int num_blocks = (depth_size + kSPLAT_BLOCK - 1) / kSPLAT_BLOCK;
+    const float (&R)[3][3] = depth_to_color.rotation;
+    const float (&T)[3] = depth_to_color.translation;
+
+    // a depth pixel spans about fx_color / fx_depth color pixels (at equal depth)
+    const float footprint_x = 0.5f * color.fx / depth.fx;
+    const float footprint_y = 0.5f * color.fy / depth.fy;
+
+    // 1. footprint of every depth pixel in the color image, and the number of
+    //    footprints of each block in each band
+    band_count.assign((size_t)num_blocks * num_bands, 0);
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kSPLAT_BLOCK;
+        const int end = std::min(begin + kSPLAT_BLOCK, depth_size);
+        int* counts = &band_count[(size_t)block * num_bands];
+        for (int i = begin; i < end; i++) {
+            splat_c0[i] = 1;
+            splat_c1[i] = 0;
+            const float zd = depth_mm[i] * 0.001f;
+            if (zd <= 0) {
+                continue;
+            }
+            // depth camera point, then color camera point
+            float xd, yd;
+            depth_rays.back_project(i % depth_width, i / depth_width, zd, xd, yd);
+            const float xc = R[0][0] * xd + R[0][1] * yd + R[0][2] * zd + T[0];
+            const float yc = R[1][0] * xd + R[1][1] * yd + R[1][2] * zd + T[1];
+            const float zc = R[2][0] * xd + R[2][1] * yd + R[2][2] * zd + T[2];
+            if (!(zc >= min_depth && zc < max_depth)) {
+                continue;
+            }
+            float u, v;
+            color.project(xc / zc, yc / zc, u, v);
+
+            // color pixels (integer centers) inside the footprint
+            const float scale = zd / zc;
+            const float half_x = footprint_x * scale + kSPLAT_MARGIN;
+            const float half_y = footprint_y * scale + kSPLAT_MARGIN;
+            const int c0 = std::max((int)ceilf(u - half_x), 0);
+            const int c1 = std::min((int)floorf(u + half_x), width - 1);
+            const int r0 = std::max((int)ceilf(v - half_y), 0);
+            const int r1 = std::min((int)floorf(v + half_y), height - 1);
+            if (c0 > c1 || r0 > r1) {
+                continue;
+            }
+            splat_z[i] = zc;
+            splat_c0[i] = (short)c0;
+            splat_c1[i] = (short)c1;
+            splat_r0[i] = (short)r0;
+            splat_r1[i] = (short)r1;
+            for (int band = r0 / kBAND_ROWS; band <= r1 / kBAND_ROWS; band++) {
+                counts[band]++;
+            }
+        }
+    }
+
+    // 2. bins in (band, block) order, so every band lists its footprints in
+    //    depth pixel order
+    band_start.resize(num_bands + 1);
+    int total = 0;
+    for (int band = 0; band < num_bands; band++) {
+        band_start[band] = total;
+        for (int block = 0; block < num_blocks; block++) {
+            int& count = band_count[(size_t)block * num_bands + band];
+            const int first = total;
+            total += count;
+            count = first;
+        }
+    }
+    band_start[num_bands] = total;
+    if ((int)bins.size() < total) {
+        bins.resize(total);
+    }
+
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kSPLAT_BLOCK;
+        const int end = std::min(begin + kSPLAT_BLOCK, depth_size);
+        int* cursor = &band_count[(size_t)block * num_bands];
+        for (int i = begin; i < end; i++) {
+            if (splat_c0[i] > splat_c1[i]) {
+                continue;
+            }
+            for (int band = splat_r0[i] / kBAND_ROWS; band <= splat_r1[i] / kBAND_ROWS; band++) {
+                bins[cursor[band]++] = i;
+            }
+        }
+    }
+
+    // 3. per band: z-buffer splat into the z plane (nearest wins), then the
+    //    pixels that were hit become points
+    const float* slope_x = color_rays.get_slope_x();
+    const float* slope_y = color_rays.get_slope_y();
+    const float* map_x = color_rays.get_map_x();
+    const float* map_y = color_rays.get_map_y();
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int band = 0; band < num_bands; band++) {
+        const int row_begin = band * kBAND_ROWS;
+        const int row_end = std::min(row_begin + kBAND_ROWS, height);
+        float* zbuffer = points.z + (size_t)row_begin * width;
+        std::fill(zbuffer, zbuffer + (size_t)(row_end - row_begin) * width, FLT_MAX);
+
+        for (int e = band_start[band]; e < band_start[band + 1]; e++) {
+            const int i = bins[e];
+            const float z = splat_z[i];
+            const int r0 = std::max((int)splat_r0[i], row_begin);
+            const int r1 = std::min((int)splat_r1[i], row_end - 1);
+            for (int r = r0; r <= r1; r++) {
+                float* row = points.z + (size_t)r * width;
+                for (int c = splat_c0[i]; c <= splat_c1[i]; c++) {
+                    row[c] = std::min(row[c], z);
+                }
+            }
+        }
+
+        for (int r = row_begin; r < row_end; r++) {
+            for (int c = 0; c < width; c++) {
+                const int index = r * width + c;
+                const float z = points.z[index];
+                if (z == FLT_MAX) {
+                    points.mask[index] = false;
+                    continue;
+                }
+                points.x[index] = z * (map_x ? map_x[index] : slope_x[c]);
+                points.y[index] = z * (map_y ? map_y[index] : slope_y[r]);
+                const unsigned char* pixel = color_bgrx + (size_t)index * 4;
+                points.r[index] = pixel[2];
+                points.g[index] = pixel[1];
+                points.b[index] = pixel[0];
+                points.mask[index] = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,107 @@
+//============================================================================
+// Name        : DepthRegistration.h
+// Copyright   : GWU Research
+// Description : Portable depth to color registration (forward projection)
+//============================================================================
+
+#pragma once
+
+#include "CameraModel.h"
+#include "FrameStore.h"
+
+// C/C++
+#include <string>
+#include <vector>
+
+
+// Rigid transform from the depth camera to the color camera (meters)
+struct RigidTransform {
+    float   rotation[3][3];
+    float   translation[3];
+
+    /**
+     * @brief Identity transform
+     */
+    static RigidTransform identity();
+
+    /**
+     * @brief Reads the transform from a calibration file: one "name value"
+     *        pair per line (r00 .. r22 row major, tx ty tz in meters), '#'
+     *        starts a comment; missing entries keep the identity
+     *
+     * @param path       Calibration file
+     * @param transform  Output transform (unchanged on failure)
+     *
+     * @returns True when the file could be read
+     */
+    static bool load(const std::string& path, RigidTransform& transform);
+};
+
+
+// Registration of a depth frame into the color image without the Kinect SDK.
+// Every depth pixel is back-projected with the depth camera rays, moved into
+// the color camera and projected (with the color distortion) to a footprint
+// of color pixels. The footprints are binned into bands of color rows and
+// every band is splatted by one thread into a z-buffer (the z plane of the
+// frame itself), so the nearest surface wins without atomics. The color
+// pixels that were hit get the color ray position at their depth and their
+// color, the others are invalid. The color rays are shared with the owner of
+// the color calibration, so a new color calibration applies right away.
+class DepthRegistration {
+
+public:
+
+    /**
+     * @brief DepthRegistration constructor
+     *
+     * @param depth_intrinsics_  Depth camera (distortion of the depth image)
+     * @param color_rays_        Color camera rays (size of the registered frame),
+     *                           must outlive the registration
+     * @param depth_to_color_    Depth to color camera transform
+     */
+    DepthRegistration(const PinholeIntrinsics& depth_intrinsics_,
+                      const RayTable& color_rays_,
+                      const RigidTransform& depth_to_color_);
+
+
+    /**
+     * @brief Registers a depth frame into the color frame: position, color
+     *        and mask of every color pixel (valid_index is not built)
+     *
+     * @param depth_mm    Depth image (millimeters, 0: no depth)
+     * @param color_bgrx  Color image, 4 bytes per pixel (blue, green, red, unused)
+     * @param points      Output frame (color resolution)
+     */
+    void register_frame(const unsigned short* depth_mm, const unsigned char* color_bgrx, FrameStore& points);
+
+
+    /**
+     * @brief Valid depth range (color camera z, meters)
+     */
+    inline void set_depth_range(float min_depth_, float max_depth_) {
+        min_depth = min_depth_;
+        max_depth = max_depth_;
+    }
+
+
+    inline const PinholeIntrinsics& get_depth_intrinsics() const { return depth_rays.get_intrinsics(); }
+    inline const PinholeIntrinsics& get_color_intrinsics() const { return color_rays.get_intrinsics(); }
+
+private:
+    RayTable        depth_rays;         // Back-projection of the depth pixels
+    const RayTable& color_rays;         // Back-projection of the color pixels (shared)
+    RigidTransform  depth_to_color;
+    float           min_depth;
+    float           max_depth;
+
+    // Footprint of every depth pixel in the color image (empty: c0 > c1)
+    std::vector<float>  splat_z;
+    std::vector<short>  splat_c0, splat_c1, splat_r0, splat_r1;
+
+    std::vector<int>    band_count;     // Per (block, band) footprints, then their first bin entry
+    std::vector<int>    band_start;     // First bin entry of each band (+ end)
+    std::vector<int>    bins;           // Depth pixels grouped by band, in pixel order
+
+    DepthRegistration(const DepthRegistration&);
+    DepthRegistration& operator=(const DepthRegistration&);
+};
@@ -0,0 +1,160 @@
+//============================================================================
+// Name        : DiagnosticsSink.cpp
+// Copyright   : GWU Research
+// Description : Non-blocking diagnostics output (seeds, centers, frame stats)
+//============================================================================
+
+#include "DiagnosticsSink.h"
+
+// C/C++
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+
+// Sleep of the writer thread when the queue is empty
+static const int kWRITER_IDLE_MS = 10;
+
+static const char* kRECORD_NAMES[] = { "seeds", "centers", "frame" };
+
+
+/**
+ * @brief Starts the writer thread (the file is opened by the writer)
+ *
+ * @param path_    Output file
+ * @param format_  Output format
+ */
+DiagnosticsSink::DiagnosticsSink(const std::string& path_, DIAGNOSTICS_FORMAT format_) :
+path(path_),
+format(format_),
+head(0),
+tail(0),
+running(true),
+dropped(0) {
+
+    writer = std::thread(&DiagnosticsSink::run, this);
+}
+
+
+/**
+ * @brief Drains the queue, stops the writer thread and closes the file
+ */
+DiagnosticsSink::~DiagnosticsSink() {
+
+    running.store(false, std::memory_order_release);
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+
+/**
+ * @brief Queues a set of cluster positions (seeds or centers)
+ *
+ * @param type     RECORD_SEEDS or RECORD_CENTERS
+ * @param frame    Frame number
+ * @param centers  Cluster positions
+ * @param k        Number of clusters
+ */
+void DiagnosticsSink::push_centers(DIAGNOSTICS_RECORD type, long long frame, const vec3* centers, int k) {
+
+    const int per_record = kRECORD_VALUES / 3;
+    for (int first = 0; first < k; first += per_record) {
+        DiagnosticsRecord record;
+        record.type = type;
+        record.first = first;
+        record.frame = frame;
+        record.count = 0;
+        for (int j = first; j < k && j < first + per_record; j++) {
+            record.values[record.count++] = centers[j].x;
+            record.values[record.count++] = centers[j].y;
+            record.values[record.count++] = centers[j].z;
+        }
+        push(record);
+    }
+}
+
+
+/**
+ * @brief Queues the statistics of a clustered frame
+ */
+void DiagnosticsSink::push_frame_stats(long long frame, int iterations, double time_ms, double inertia,
+                                       int reason, int num_valid) {
+
+    DiagnosticsRecord record;
+    record.type = RECORD_FRAME_STATS;
+    record.first = 0;
+    record.frame = frame;
+    record.count = 5;
+    record.values[0] = (float)iterations;
+    record.values[1] = (float)time_ms;
+    record.values[2] = (float)inertia;
+    record.values[3] = (float)reason;
+    record.values[4] = (float)num_valid;
+    push(record);
+}
+
+
+/**
+ * @brief Queues a record, drops it when the ring is full (producer side)
+ */
+void DiagnosticsSink::push(const DiagnosticsRecord& record) {
+
+    const unsigned slot = tail.load(std::memory_order_relaxed);
+    if (slot - head.load(std::memory_order_acquire) >= (unsigned)kQUEUE_SIZE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    queue[slot & (kQUEUE_SIZE - 1)] = record;
+    tail.store(slot + 1, std::memory_order_release);
+}
+
+
+/**
+ * @brief Writer thread: drains the ring until stopped
+ */
+void DiagnosticsSink::run() {
+
+    FILE* file = fopen(path.c_str(), (format == DIAGNOSTICS_BINARY) ? "wb" : "w");
+    if (file == NULL) {
+        std::cerr << "[Error][DiagnosticsSink] Unable to open " << path << std::endl;
+    }
+
+    for (;;) {
+        // read the flag first, so the records pushed before the stop are drained
+        const bool stop = !running.load(std::memory_order_acquire);
+        unsigned slot = head.load(std::memory_order_relaxed);
+        const unsigned end = tail.load(std::memory_order_acquire);
+        const bool wrote = (slot != end);
+
+        for (; slot != end; slot++) {
+            const DiagnosticsRecord& record = queue[slot & (kQUEUE_SIZE - 1)];
+            if (file == NULL) {
+                continue;
+            }
+            if (format == DIAGNOSTICS_BINARY) {
+                fwrite(&record, sizeof(record), 1, file);
+            }
+            else {
+                fprintf(file, "%lld\t%s\t%d", record.frame, kRECORD_NAMES[record.type], record.first);
+                for (int v = 0; v < record.count; v++) {
+                    fprintf(file, "\t%f", record.values[v]);
+                }
+                fprintf(file, "\n");
+            }
+        }
+        head.store(slot, std::memory_order_release);
+
+        if (stop) {
+            break;
+        }
+        if (file && wrote) {
+            fflush(file);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kWRITER_IDLE_MS));
+    }
+
+    if (file) {
+        fclose(file);
+    }
+}
@@ -0,0 +1,121 @@
+//============================================================================
+// Name        : DiagnosticsSink.h
+// Copyright   : GWU Research
+// Description : Non-blocking diagnostics output (seeds, centers, frame stats)
+//============================================================================
+
+#pragma once
+
+#include "vec3.h"
+
+// C/C++
+#include <atomic>
+#include <string>
+#include <thread>
+
+
+// Output formats
+enum DIAGNOSTICS_FORMAT {
+    DIAGNOSTICS_TEXT,       // One tab separated line per record
+    DIAGNOSTICS_BINARY      // Raw DiagnosticsRecord structs
+};
+
+
+// Record types
+enum DIAGNOSTICS_RECORD {
+    RECORD_SEEDS,           // Seeds of the first frame (x y z per cluster)
+    RECORD_CENTERS,         // Centers at the end of a frame (x y z per cluster)
+    RECORD_FRAME_STATS      // iterations, time (ms), inertia, termination reason, valid points
+};
+
+
+// Values per record, larger center sets are split over several records
+static const int kRECORD_VALUES = 48;
+
+
+// Fixed size record, so the queue never allocates
+struct DiagnosticsRecord {
+    int         type;                   // DIAGNOSTICS_RECORD
+    int         first;                  // First cluster of the record (centers)
+    int         count;                  // Number of values used
+    long long   frame;                  // Frame number
+    float       values[kRECORD_VALUES];
+};
+
+
+// Diagnostics sink. The clustering thread pushes records into a single
+// producer / single consumer lock-free ring; a background thread drains it to
+// the output file. A push never waits: when the ring is full the record is
+// dropped and counted.
+class DiagnosticsSink {
+
+public:
+
+    /**
+     * @brief Starts the writer thread (the file is opened by the writer)
+     *
+     * @param path_    Output file
+     * @param format_  Output format
+     */
+    DiagnosticsSink(const std::string& path_, DIAGNOSTICS_FORMAT format_ = DIAGNOSTICS_TEXT);
+
+
+    /**
+     * @brief Drains the queue, stops the writer thread and closes the file
+     */
+    ~DiagnosticsSink();
+
+
+    /**
+     * @brief Queues a set of cluster positions (seeds or centers)
+     *
+     * @param type     RECORD_SEEDS or RECORD_CENTERS
+     * @param frame    Frame number
+     * @param centers  Cluster positions
+     * @param k        Number of clusters
+     */
+    void push_centers(DIAGNOSTICS_RECORD type, long long frame, const vec3* centers, int k);
+
+
+    /**
+     * @brief Queues the statistics of a clustered frame
+     */
+    void push_frame_stats(long long frame, int iterations, double time_ms, double inertia,
+                          int reason, int num_valid);
+
+
+    /**
+     * @brief Number of records dropped because the queue was full
+     */
+    inline long long get_dropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    /**
+     * @brief Queues a record, drops it when the ring is full (producer side)
+     */
+    void push(const DiagnosticsRecord& record);
+
+
+    /**
+     * @brief Writer thread: drains the ring until stopped
+     */
+    void run();
+
+
+    static const int kQUEUE_SIZE = 1024;    // Ring slots (power of two)
+
+    std::string             path;
+    DIAGNOSTICS_FORMAT      format;
+    DiagnosticsRecord       queue[kQUEUE_SIZE];
+    std::atomic<unsigned>   head;           // Next slot to read (writer thread)
+    std::atomic<unsigned>   tail;           // Next slot to write (producer)
+    std::atomic<bool>       running;
+    std::atomic<long long>  dropped;
+    std::thread             writer;
+
+    DiagnosticsSink(const DiagnosticsSink&);
+    DiagnosticsSink& operator=(const DiagnosticsSink&);
+};
@@ -0,0 +1,224 @@
+//============================================================================
+// Name        : FrameStore.cpp
+// Copyright   : GWU Research
+// Description : Structure-of-arrays storage for the registered frame points
+//============================================================================
+
+#include "FrameStore.h"
+
+// C/C++
+#include <cstdlib>
+#include <cstring>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+
+// Planes are aligned for 256-bit loads/stores
+static const size_t kPLANE_ALIGNMENT = 32;
+
+// Mask entries handled per task when packing the valid indices
+static const int kINDEX_BLOCK = 8192;
+
+// the frame store is also used by the portable registration, outside MSVC
+// the planes come from posix_memalign
+template <typename T>
+static T* allocate_plane(size_t count) {
+#ifdef _MSC_VER
+    T* plane = static_cast<T*>(_aligned_malloc(count * sizeof(T), kPLANE_ALIGNMENT));
+#else
+    void* memory = NULL;
+    if (posix_memalign(&memory, kPLANE_ALIGNMENT, count * sizeof(T)) != 0) {
+        memory = NULL;
+    }
+    T* plane = static_cast<T*>(memory);
+#endif
+    memset(plane, 0, count * sizeof(T));
+    return plane;
+}
+
+template <typename T>
+static void release_plane(T*& plane) {
+    if (plane) {
+#ifdef _MSC_VER
+        _aligned_free(plane);
+#else
+        free(plane);
+#endif
+        plane = NULL;
+    }
+}
+
+
+/**
+ * @brief Allocates all the planes for a width x height frame
+ *
+ * @param width_          Frame width (pixels)
+ * @param height_         Frame height (pixels)
+ * @param num_membership  Number of membership planes (clusters)
+ */
+FrameStore::FrameStore(int width_, int height_, int num_membership_) :
+width(width_),
+height(height_),
+size(width_ * height_),
+num_membership(num_membership_) {
+
+    x = allocate_plane<float>(size);
+    y = allocate_plane<float>(size);
+    z = allocate_plane<float>(size);
+    r = allocate_plane<float>(size);
+    g = allocate_plane<float>(size);
+    b = allocate_plane<float>(size);
+    nx = allocate_plane<float>(size);
+    ny = allocate_plane<float>(size);
+    nz = allocate_plane<float>(size);
+    label = allocate_plane<int>(size);
+    mask = allocate_plane<bool>(size);
+    valid_index = allocate_plane<int>(size);
+    num_valid = 0;
+    upper_bound = allocate_plane<float>(size);
+    lower_bound = allocate_plane<float>(size);
+
+    num_blocks = (size + kINDEX_BLOCK - 1) / kINDEX_BLOCK;
+    block_offset = allocate_plane<int>(num_blocks + 1);
+
+    membership = allocate_plane<float>((size_t)size * num_membership);
+    buffer_r = allocate_plane<float>(size);
+    buffer_g = allocate_plane<float>(size);
+    buffer_b = allocate_plane<float>(size);
+    weight = NULL;
+
+    ref_x = ref_y = ref_z = NULL;
+    ref_r = ref_g = ref_b = NULL;
+    ref_mask = NULL;
+}
+
+
+/**
+ * @brief Releases all the planes
+ */
+FrameStore::~FrameStore() {
+
+    release_plane(x);
+    release_plane(y);
+    release_plane(z);
+    release_plane(r);
+    release_plane(g);
+    release_plane(b);
+    release_plane(nx);
+    release_plane(ny);
+    release_plane(nz);
+    release_plane(label);
+    release_plane(mask);
+    release_plane(valid_index);
+    release_plane(upper_bound);
+    release_plane(lower_bound);
+    release_plane(block_offset);
+
+    release_plane(membership);
+    release_plane(buffer_r);
+    release_plane(buffer_g);
+    release_plane(buffer_b);
+    release_plane(weight);
+
+    release_plane(ref_x);
+    release_plane(ref_y);
+    release_plane(ref_z);
+    release_plane(ref_r);
+    release_plane(ref_g);
+    release_plane(ref_b);
+    release_plane(ref_mask);
+}
+
+
+/**
+ * @brief Re-allocates the membership planes for a new number of clusters
+ *
+ * @param num_membership_  Number of membership planes (clusters)
+ */
+void FrameStore::set_num_membership(int num_membership_) {
+
+    if (num_membership_ == num_membership) {
+        return;
+    }
+    release_plane(membership);
+    num_membership = num_membership_;
+    membership = allocate_plane<float>((size_t)size * num_membership);
+}
+
+
+/**
+ * @brief Allocates the point weight plane (all zero) on first use
+ */
+void FrameStore::enable_weight() {
+
+    if (weight == NULL) {
+        weight = allocate_plane<float>(size);
+    }
+}
+
+
+/**
+ * @brief Packs the indices of the valid points (mask) into valid_index,
+ *        using a parallel prefix sum over blocks of the mask
+ */
+void FrameStore::build_valid_index() {
+
+    // 1. count the valid points of each block
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kINDEX_BLOCK;
+        const int end = (begin + kINDEX_BLOCK < size) ? begin + kINDEX_BLOCK : size;
+        int count = 0;
+        for (int i = begin; i < end; i++) {
+            count += mask[i];
+        }
+        block_offset[block + 1] = count;
+    }
+
+    // 2. exclusive scan of the block counts (few hundred blocks)
+    block_offset[0] = 0;
+    for (int block = 0; block < num_blocks; block++) {
+        block_offset[block + 1] += block_offset[block];
+    }
+    num_valid = block_offset[num_blocks];
+
+    // 3. each block writes its indices at its offset
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kINDEX_BLOCK;
+        const int end = (begin + kINDEX_BLOCK < size) ? begin + kINDEX_BLOCK : size;
+        int* out = valid_index + block_offset[block];
+        for (int i = begin; i < end; i++) {
+            if (mask[i]) {
+                *out++ = i;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Copies the current positions, colors and mask into the reference
+ *        planes (allocated on first use)
+ */
+void FrameStore::save_reference() {
+
+    if (ref_mask == NULL) {
+        ref_x = allocate_plane<float>(size);
+        ref_y = allocate_plane<float>(size);
+        ref_z = allocate_plane<float>(size);
+        ref_r = allocate_plane<float>(size);
+        ref_g = allocate_plane<float>(size);
+        ref_b = allocate_plane<float>(size);
+        ref_mask = allocate_plane<bool>(size);
+    }
+
+    float* const src[] = { x, y, z, r, g, b };
+    float* const dst[] = { ref_x, ref_y, ref_z, ref_r, ref_g, ref_b };
+    #pragma omp parallel for
+    for (int plane = 0; plane < 6; plane++) {
+        memcpy(dst[plane], src[plane], size * sizeof(float));
+    }
+    memcpy(ref_mask, mask, size * sizeof(bool));
+}
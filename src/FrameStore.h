@@ -0,0 +1,111 @@
+//============================================================================
+// Name        : FrameStore.h
+// Copyright   : GWU Research
+// Description : Structure-of-arrays storage for the registered frame points
+//============================================================================
+
+#pragma once
+
+// C/C++
+#include <cstddef>
+
+
+// Registered frame points, one plane per attribute.
+// Every plane holds width*height entries and is 32 byte aligned, so the
+// clustering loops only stream the attributes they actually read.
+struct FrameStore {
+
+    /**
+     * @brief Allocates all the planes for a width x height frame
+     *
+     * @param width_          Frame width (pixels)
+     * @param height_         Frame height (pixels)
+     * @param num_membership  Number of membership planes (clusters)
+     */
+    FrameStore(int width_, int height_, int num_membership);
+
+
+    /**
+     * @brief Releases all the planes
+     */
+    ~FrameStore();
+
+
+    /**
+     * @brief Re-allocates the membership planes for a new number of clusters
+     *
+     * @param num_membership_  Number of membership planes (clusters)
+     */
+    void set_num_membership(int num_membership_);
+
+
+    /**
+     * @brief Packs the indices of the valid points (mask) into valid_index,
+     *        using a parallel prefix sum over blocks of the mask
+     */
+    void build_valid_index();
+
+
+    /**
+     * @brief Copies the current positions, colors and mask into the reference
+     *        planes (allocated on first use)
+     */
+    void save_reference();
+
+
+    /**
+     * @brief Allocates the point weight plane (all zero) on first use
+     */
+    void enable_weight();
+
+
+    /**
+     * @brief Pointer to the membership plane of cluster j
+     */
+    inline float* membership_plane(int j) {
+        return membership + (size_t)j * size;
+    }
+
+
+    int     width;          // Frame width
+    int     height;         // Frame height
+    int     size;           // Number of points (width*height)
+
+    float*  x;              // Point 3D world position
+    float*  y;
+    float*  z;
+    float*  r;              // Point color
+    float*  g;
+    float*  b;
+    float*  nx;             // Point normal (orientation)
+    float*  ny;
+    float*  nz;
+    int*    label;          // Point hard label
+    bool*   mask;           // Valid points of the frame
+    int*    valid_index;    // Densely packed indices of the valid points
+    int     num_valid;      // Number of valid points
+    float*  upper_bound;    // Upper bound of the distance to the assigned center
+    float*  lower_bound;    // Lower bound of the distance to any other center
+
+    int     num_membership; // Number of membership planes
+    float*  membership;     // Point fuzzy labels, one plane per cluster
+    float*  buffer_r;       // Point color buffer (label color blending)
+    float*  buffer_g;
+    float*  buffer_b;
+    float*  weight;         // Point weight, e.g. points per voxel (NULL: every point counts once)
+
+    float*  ref_x;          // Reference values of the incremental clustering,
+    float*  ref_y;          // i.e. the point values the cluster sums hold
+    float*  ref_z;          // (NULL until save_reference is called)
+    float*  ref_r;
+    float*  ref_g;
+    float*  ref_b;
+    bool*   ref_mask;
+
+private:
+    int*    block_offset;   // Per-block prefix sum used by build_valid_index
+    int     num_blocks;
+
+    FrameStore(const FrameStore&);
+    FrameStore& operator=(const FrameStore&);
+};
@@ -23,7 +23,7 @@
 #include <sstream>
 #include <limits>
 #include <string>
-#include<ppl.h>
+#include <chrono>
 
 // Windows
 #include <Kinect.h>
@@ -50,6 +50,15 @@ inline vec3 cross(vec3 v1, vec3 v2) {
 }
 
 
+typedef std::chrono::steady_clock GrabberClock;
+
+// Milliseconds elapsed since start
+static inline double ElapsedMs(const GrabberClock::time_point& start) {
+
+    return std::chrono::duration<double, std::milli>(GrabberClock::now() - start).count();
+}
+
+
 /**
  * @brief Grabber constructor
  */
@@ -60,6 +69,7 @@ m_pKinectMapper(NULL),
 raw_color_RGBX(NULL),
 raw_infrared_u16(NULL),
 raw_depth_u16(NULL),
+depth_XYZ(NULL),
 m_pDrawColor(NULL),
 m_pDrawInfrared(NULL),
 m_pDrawDepth(NULL),
@@ -67,7 +77,23 @@ m_pDrawResult(NULL),
 m_hWnd(NULL),
 screenshot_color(false),
 screenshot_depth(false),
-screenshot_infrared(false) {
+screenshot_infrared(false),
+cluster(NULL),
+num_clusters(kDEFAULT_NUM_CLUSTERS),
+diagnostics(NULL),
+depth_native(false),
+depth_store(NULL),
+depth_grid(NULL),
+depth_color_UV(NULL),
+color_depth_UV(NULL),
+color_lookup_ready(false),
+voxelizer(NULL),
+extractor(NULL),
+register_kernel(select_registration_kernel(detect_kernel_isa())),
+normal_radius(4),
+registration(NULL),
+registration_report_enabled(false),
+registration_reference(NULL) {
 
 	// create heap storage for color pixel data in RGBX format
     aux_color_RGBX = new RGBQUAD[cColorWidth * cColorHeight];
@@ -75,11 +101,17 @@ screenshot_infrared(false) {
     infrared_RGBX = new RGBQUAD[cInfraredWidth * cInfraredHeight];
     aux_infrared_u16 = new UINT16[cInfraredWidth * cInfraredHeight];
 
-    depth_XYZ = new CameraSpacePoint[cColorWidth * cColorHeight];
     depth_RGBX = new RGBQUAD[cDepthWidth * cDepthHeight];
     aux_depth_u16 = new UINT16[cDepthWidth * cDepthHeight];
     
     result_RGBX = new RGBQUAD[cColorWidth * cColorHeight];
+
+    frame_store = new FrameStore(cColorWidth, cColorHeight, kDEFAULT_NUM_CLUSTERS);
+    spatial_grid = new SpatialGrid(cColorWidth * cColorHeight);
+
+    // color camera: 70 x 60 degrees field of view, centered
+    color_intrinsics = PinholeIntrinsics::from_fov(cColorWidth, cColorHeight,
+                                                   (float)(70.0 * PI / 180.0), (float)(60.0 * PI / 180.0));
 }
 
 
@@ -120,6 +152,51 @@ Grabber::~Grabber() {
     if (result_RGBX) {
         delete[] result_RGBX;
         result_RGBX = NULL;
+    }
+    // Registered frame
+    if (frame_store) {
+        delete frame_store;
+        frame_store = NULL;
+    }
+    if (spatial_grid) {
+        delete spatial_grid;
+        spatial_grid = NULL;
+    }
+    // Depth-native frame
+    if (depth_store) {
+        delete depth_store;
+        depth_store = NULL;
+    }
+    if (depth_grid) {
+        delete depth_grid;
+        depth_grid = NULL;
+    }
+    if (depth_color_UV) {
+        delete[] depth_color_UV;
+        depth_color_UV = NULL;
+    }
+    if (color_depth_UV) {
+        delete[] color_depth_UV;
+        color_depth_UV = NULL;
+    }
+    // Voxel stage
+    if (voxelizer) {
+        delete voxelizer;
+        voxelizer = NULL;
+    }
+    // Object extraction
+    if (extractor) {
+        delete extractor;
+        extractor = NULL;
+    }
+    // Portable registration
+    if (registration) {
+        delete registration;
+        registration = NULL;
+    }
+    if (registration_reference) {
+        delete registration_reference;
+        registration_reference = NULL;
     }
 	// close the Kinect Sensor
 	if (m_pKinectSensor) {
@@ -133,6 +210,11 @@ Grabber::~Grabber() {
 		delete cluster;
 		cluster = NULL;
 	}
+    // Diagnostics (drains the pending records)
+    if (diagnostics) {
+        delete diagnostics;
+        diagnostics = NULL;
+    }
 }
 
 
@@ -181,7 +263,8 @@ HRESULT Grabber::init() {
         }
     }
 	// Create cluster 
-	cluster = new Clustering();
+	cluster = new Clustering(num_clusters);
+	cluster->set_diagnostics(diagnostics);
 
     return hr;
 } /* Grabber::init() */
@@ -660,23 +743,54 @@ void Grabber::ProcessInfrared(const UINT16* pBuffer, int nWidth, int nHeight) {
 
 
 /**
- * @brief Projects a point from image plane to the 3D world space
+ * @brief Registers the color frame through the SDK mapping of every color
+ *        pixel to camera space (position, color and mask of every pixel)
+ *
+ * @param points  Output frame (color resolution)
  *
- * @param (xp,yp)     Point in 2D fimage plane coordinates
- * @param zp          Depth of the 2D point
- * @param (xw,yw,zw)  Point in 3D world coordinates
+ * @returns S_OK on success, otherwise failure code.
  */
-void Grabber::ConvertProjectiveToRealWorld(float xp, float yp, float zp,
-                                           float &xw, float &yw, float &zw) {
+HRESULT Grabber::RegisterWithMapper(FrameStore& points) {
 
-    static const float fovWidth = (70.0 * PI / 180.0);// 1.0144686707507438;
-    static const float fovHeight = (60.0 * PI / 180.0); // 0.78980943449644714;
-    static const float fScaleX = tanf(fovWidth * 0.5f) * 2.0;
-    static const float fScaleY = tanf(fovHeight * 0.5f) * 2.0;
-    
-    xw = (float)zp * ((float)xp / 1920.0f - 0.5f) * fScaleX;
-    yw = (float)zp * ((float)yp / 1080.0f - 0.5f) * fScaleY;
-    zw = (float)zp;
+    if (!depth_XYZ) {
+        depth_XYZ = new CameraSpacePoint[cColorWidth * cColorHeight];
+    }
+    HRESULT hr = m_pKinectMapper->MapColorFrameToCameraSpace(cDepthWidth * cDepthHeight,
+                                                             (UINT16*)raw_depth_u16,
+                                                             cColorWidth * cColorHeight,
+                                                             depth_XYZ);
+    if (SUCCEEDED(hr)) {
+
+        // loop over output pixels, the rays of the camera model replace the
+        // per-pixel projection math (rebuilt only when the intrinsics change)
+        color_rays.update(color_intrinsics, ray_cache_path);
+        const float* slope_x = color_rays.get_slope_x();
+        const float* slope_y = color_rays.get_slope_y();
+        const float* map_x = color_rays.get_map_x();
+        const float* map_y = color_rays.get_map_y();
+        const float min_depth = kMIN_DEPTH;
+        const float max_depth = kMAX_DEPTH;
+
+        // one fused pass per row: range check, back-projection, color and
+        // mask (CameraSpacePoint is 3 floats, RGBQUAD is packed BGRX)
+        const float* camera_xyz = reinterpret_cast<const float*>(depth_XYZ);
+        const unsigned int* color_bgrx = reinterpret_cast<const unsigned int*>(raw_color_RGBX);
+        const RegistrationKernel kernel = register_kernel;
+
+        #pragma omp parallel for
+        for (int row = 0; row < cColorHeight; ++row) {
+
+            // distorted cameras take the ray of the pixel, the others the
+            // slopes of its column and row
+            const float* ray_x = map_x ? map_x + row * cColorWidth : slope_x;
+            const float* ray_y = map_y ? map_y + row * cColorWidth : NULL;
+            const float row_slope = map_y ? 0.0f : slope_y[row];
+            kernel(camera_xyz, color_bgrx, ray_x, ray_y, row_slope, min_depth, max_depth,
+                   row * cColorWidth, cColorWidth, points);
+        }
+    }
+
+    return hr;
 }
 
 
@@ -695,61 +809,106 @@ HRESULT Grabber::registerFrame() {
         return E_FAIL;
     }
 
-    // maps depth to higher resolution RGB image
-    if (!m_pKinectMapper) {
-        std::cerr << "[Error][Grabber::registerFrame] Empty depth mapper."
-            << std::endl;
-        return E_FAIL;
+    color_lookup_ready = false;
+    if (registration == NULL || depth_native) {
+        // maps depth to higher resolution RGB image
+        if (!m_pKinectMapper) {
+            std::cerr << "[Error][Grabber::registerFrame] Empty depth mapper."
+                << std::endl;
+            return E_FAIL;
+        }
+        if (depth_native) {
+            return RegisterDepthNative();
+        }
     }
-    HRESULT hr = m_pKinectMapper->MapColorFrameToCameraSpace(cDepthWidth * cDepthHeight,
-                                                             (UINT16*)raw_depth_u16,
-                                                             cColorWidth * cColorHeight,
-                                                             depth_XYZ);
+
+    FrameStore& points = *frame_store;
+    HRESULT hr = S_OK;
+    if (registration) {
+        // own forward projection, no SDK mapping and no camera space buffer
+        const GrabberClock::time_point start = GrabberClock::now();
+        registration->register_frame(raw_depth_u16, reinterpret_cast<const unsigned char*>(raw_color_RGBX), points);
+        if (registration_report_enabled) {
+            CompareRegistration(ElapsedMs(start));
+        }
+    }
+    else {
+        hr = RegisterWithMapper(points);
+    }
+    if (SUCCEEDED(hr)) {
+
+        // Pack the valid points once, every clustering pass walks this list
+        points.build_valid_index();
+        spatial_grid->build(points);
+
+        // Calculate number of faces
+        hr = CalculateSurfaceNormal(points, normal_radius);
+        if (FAILED(hr)) {
+            std::cerr << "[Error][Grabber::registerFrame] Unable to compute the surface normals."
+                      << std::endl;
+        }
+    }
+
+    return hr;
+}
+
+
+/**
+ * @brief Registers color into the native depth grid: every valid depth
+ *        pixel becomes a point, colored by its pixel in the color frame
+ *
+ * @returns S_OK on success, otherwise failure code.
+ */
+HRESULT Grabber::RegisterDepthNative() {
+
+    color_rays.update(color_intrinsics, ray_cache_path);
+    HRESULT hr = m_pKinectMapper->MapDepthFrameToColorSpace(cDepthWidth * cDepthHeight,
+                                                            (UINT16*)raw_depth_u16,
+                                                            cDepthWidth * cDepthHeight,
+                                                            depth_color_UV);
     if (SUCCEEDED(hr)) {
 
-        // loop over output pixels
-        float x, y, z;
+        FrameStore& points = *depth_store;
 
         #pragma omp parallel for num_threads(4)
-        for (size_t color_index = 0; color_index < kFRAME_SIZE; ++color_index) {
-
-            // default setting source to copy from the background pixel
-            CameraSpacePoint p = depth_XYZ[color_index];
-            if (p.Z != std::numeric_limits<float>::infinity() &&
-                p.Z != -std::numeric_limits<float>::infinity() &&
-                static_cast<float>(p.Z) >= kMIN_DEPTH && static_cast<float>(p.Z) < kMAX_DEPTH) {
-
-                float xp = color_index % cColorWidth;
-                float yp = color_index / cColorWidth;
-                float zp = static_cast<float>(p.Z);
-                //float depthX = static_cast<float>(p.X);//changed by kamran 2015-1-7
-                //float depthY = static_cast<float>(p.Y);//changed by kamran 2015-1-7
-                //float depthZ = static_cast<float>(p.Z);//changed by kamran 2015-1-7
-
-                // position
-                ConvertProjectiveToRealWorld(xp, yp, zp, x, y, z);
-                frame_points[color_index].position.x = x;
-                frame_points[color_index].position.y = y;
-                frame_points[color_index].position.z = z;
-                // color (check the alignment)
-                const RGBQUAD* pSrc = raw_color_RGBX + color_index;
-                frame_points[color_index].color.x = pSrc->rgbRed;
-                frame_points[color_index].color.y = pSrc->rgbGreen;
-                frame_points[color_index].color.z = pSrc->rgbBlue;
+        for (int depth_index = 0; depth_index < cDepthWidth * cDepthHeight; ++depth_index) {
+
+            // depth in meters, same z as the camera space of the color registration
+            const float zp = raw_depth_u16[depth_index] * 0.001f;
+            const ColorSpacePoint uv = depth_color_UV[depth_index];
+            const float xp = floorf(uv.X + 0.5f);
+            const float yp = floorf(uv.Y + 0.5f);
+            if (zp >= kMIN_DEPTH && zp < kMAX_DEPTH &&
+                xp >= 0 && xp < cColorWidth && yp >= 0 && yp < cColorHeight) {
+
+                // position, with the color camera rays of the 1080p mode
+                float x, y;
+                color_rays.back_project((int)xp, (int)yp, zp, x, y);
+                points.x[depth_index] = x;
+                points.y[depth_index] = y;
+                points.z[depth_index] = zp;
+                // color
+                const RGBQUAD* pSrc = raw_color_RGBX + (int)yp * cColorWidth + (int)xp;
+                points.r[depth_index] = pSrc->rgbRed;
+                points.g[depth_index] = pSrc->rgbGreen;
+                points.b[depth_index] = pSrc->rgbBlue;
 
                 // new valid point
-                valid_frame_points[color_index] = true;
+                points.mask[depth_index] = true;
             }
             else {
-                // invalid point
-                valid_frame_points[color_index] = false;
+                // no depth, or outside the color frame
+                points.mask[depth_index] = false;
             }
         }
-        
-        // Calculate number of faces
-        hr = CalculateSurfaceNormal();
+
+        points.build_valid_index();
+        depth_grid->build(points);
+
+        // one depth pixel is about 4 color pixels (the estimator keeps at least 1)
+        hr = CalculateSurfaceNormal(points, normal_radius / 4);
         if (FAILED(hr)) {
-            std::cerr << "[Error][Grabber::registerFrame] Unable to compute the surface normals."
+            std::cerr << "[Error][Grabber::RegisterDepthNative] Unable to compute the surface normals."
                       << std::endl;
         }
     }
@@ -759,46 +918,294 @@ HRESULT Grabber::registerFrame() {
 
 
 /**
-* @brief Computes the surface normal for each valid point
-*
-* @returns S_OK on success, otherwise failure code.
-*/
-HRESULT Grabber::CalculateSurfaceNormal() {
+ * @brief Fills the color resolution frame from the depth-native frame:
+ *        each color pixel takes the attributes of the depth pixel it maps
+ *        to (mask always, then only what the output needs)
+ *
+ * @param output_type  The type of information that will be drawn
+ *
+ * @returns S_OK on success, otherwise failure code.
+ */
+HRESULT Grabber::ProjectToColor(OUTPUT_TYPE output_type) {
 
-    // Locals
-    vec3 v1, v2, v3;
-    const int nSamplingRate = 2;
-    const int nOffset = cColorWidth*nSamplingRate;
-    // Calculate face normal
-   // #pragma omp parallel for num_threads(8)
+    if (!depth_native || !raw_depth_u16 || !m_pKinectMapper) {
+        return E_FAIL;
+    }
 
-	concurrency::parallel_for(int (0),  kFRAME_SIZE - (nOffset + nSamplingRate),[&]( int i)
-	{
+    // color to depth lookup, once per frame
+    if (!color_lookup_ready) {
+        if (!color_depth_UV) {
+            color_depth_UV = new DepthSpacePoint[kFRAME_SIZE];
+        }
+        HRESULT hr = m_pKinectMapper->MapColorFrameToDepthSpace(cDepthWidth * cDepthHeight,
+                                                                (UINT16*)raw_depth_u16,
+                                                                kFRAME_SIZE,
+                                                                color_depth_UV);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        color_lookup_ready = true;
+    }
+
+    const FrameStore& source = *depth_store;
+    FrameStore& points = *frame_store;
+    const bool copy_membership = (output_type == OUTPUT_CLUSTER) && cluster && cluster->get_fuzzy();
+    if (copy_membership) {
+        points.set_num_membership(source.num_membership);
+    }
+    const size_t source_plane = source.size;
+    const size_t plane = points.size;
+
+    #pragma omp parallel for num_threads(8)
+    for (int i = 0; i < kFRAME_SIZE; i++) {
+
+        const DepthSpacePoint uv = color_depth_UV[i];
+        const float dx = floorf(uv.X + 0.5f);
+        const float dy = floorf(uv.Y + 0.5f);
+        const int d = (int)dy * cDepthWidth + (int)dx;
+        if (!(dx >= 0 && dx < cDepthWidth && dy >= 0 && dy < cDepthHeight) || !source.mask[d]) {
+            points.mask[i] = false;
+            continue;
+        }
+        points.mask[i] = true;
+
+        switch (output_type) {
+        case OUTPUT_COLOR:
+            points.r[i] = source.r[d];
+            points.g[i] = source.g[d];
+            points.b[i] = source.b[d];
+            break;
+        case OUTPUT_DEPTH:
+            points.x[i] = source.x[d];
+            points.y[i] = source.y[d];
+            points.z[i] = source.z[d];
+            break;
+        case OUTPUT_NORMAL:
+            points.nx[i] = source.nx[d];
+            points.ny[i] = source.ny[d];
+            points.nz[i] = source.nz[d];
+            break;
+        case OUTPUT_CLUSTER:
+            points.label[i] = source.label[d];
+            if (copy_membership) {
+                for (int j = 0; j < source.num_membership; j++) {
+                    points.membership[j * plane + i] = source.membership[j * source_plane + d];
+                }
+            }
+            break;
+        }
+    }
 
-        frame_points[i].normal.set(0, 0, 0);
-        int index_v1 = i;
-        int index_v2 = i + nOffset;
-        int index_v3 = i + nSamplingRate;
+    return S_OK;
+}
 
-        // is nIndex i ? no, id sampling rate is different
-        
-        // offsetted points are valid
-        if (valid_frame_points[index_v1] &&
-            valid_frame_points[index_v2] &&
-            valid_frame_points[index_v3]) {
-
-            // compute surface normal
-            v1 = frame_points[index_v1].position;
-            v2 = frame_points[index_v2].position;
-            v3 = frame_points[index_v3].position;
-            frame_points[index_v1].normal = normalize(cross(v2 - v1, v3 - v1));
-            if (frame_points[index_v1].normal.x > 1 ||
-                frame_points[index_v1].normal.y > 1 ||
-                frame_points[index_v1].normal.z > 1) {
-                printf("\n\n %f %f %f", frame_points[index_v1].normal.x, frame_points[index_v1].normal.y, frame_points[index_v1].normal.z);
+
+/**
+ * @brief  Loads the color camera calibration (intrinsics and distortion) and
+ *         builds its rays right away; the distorted ray maps are cached next
+ *         to the calibration file (<path>.raycache) for the next start
+ *
+ * @param path  Calibration file (see PinholeIntrinsics::load)
+ *
+ * @returns S_OK on success, otherwise failure code.
+ */
+HRESULT Grabber::load_color_calibration(const std::string& path) {
+
+    PinholeIntrinsics intrinsics;
+    if (!PinholeIntrinsics::load(path, intrinsics)) {
+        return E_FAIL;
+    }
+    if (intrinsics.width != cColorWidth || intrinsics.height != cColorHeight) {
+        std::cerr << "[Error][Grabber::load_color_calibration] The calibration is not "
+                  << cColorWidth << "x" << cColorHeight << "." << std::endl;
+        return E_FAIL;
+    }
+    color_intrinsics = intrinsics;
+    ray_cache_path = path + ".raycache";
+    color_rays.update(color_intrinsics, ray_cache_path);
+    return S_OK;
+}
+
+
+/**
+ * @brief  Switches the 1080p registration to the portable forward projection
+ *         of the depth pixels (DepthRegistration) instead of the SDK mapping
+ *         of every color pixel; it projects with the color rays of the
+ *         grabber, so the color calibration may be loaded before or after
+ *
+ * @param depth_calibration      Depth camera intrinsics file (see PinholeIntrinsics::load)
+ * @param extrinsics_calibration Depth to color transform file (see RigidTransform::load)
+ *
+ * @returns S_OK on success, otherwise failure code.
+ */
+HRESULT Grabber::load_depth_calibration(const std::string& depth_calibration,
+                                        const std::string& extrinsics_calibration) {
+
+    PinholeIntrinsics depth_intrinsics;
+    RigidTransform depth_to_color;
+    if (!PinholeIntrinsics::load(depth_calibration, depth_intrinsics) ||
+        !RigidTransform::load(extrinsics_calibration, depth_to_color)) {
+        return E_FAIL;
+    }
+    if (depth_intrinsics.width != cDepthWidth || depth_intrinsics.height != cDepthHeight) {
+        std::cerr << "[Error][Grabber::load_depth_calibration] The depth calibration is not "
+                  << cDepthWidth << "x" << cDepthHeight << "." << std::endl;
+        return E_FAIL;
+    }
+
+    // the registration projects with color_rays, so a later load_color_calibration
+    // applies to it as well (and the distorted maps come from the ray cache)
+    color_rays.update(color_intrinsics, ray_cache_path);
+    delete registration;
+    registration = new DepthRegistration(depth_intrinsics, color_rays, depth_to_color);
+    registration->set_depth_range(kMIN_DEPTH, kMAX_DEPTH);
+    return S_OK;
+}
+
+
+/**
+ * @brief  Back to the SDK registration
+ */
+void Grabber::disable_portable_registration() {
+
+    delete registration;
+    registration = NULL;
+}
+
+
+/**
+ * @brief  Runs the SDK registration on the same frame as the portable one
+ *         and compares them (depth of the pixels valid in both, coverage)
+ *
+ * @param engine_ms  Time of the portable registration
+ */
+void Grabber::CompareRegistration(double engine_ms) {
+
+    if (!m_pKinectMapper) {
+        return;
+    }
+    if (!registration_reference) {
+        registration_reference = new FrameStore(cColorWidth, cColorHeight, 0);
+    }
+    const GrabberClock::time_point start = GrabberClock::now();
+    if (FAILED(RegisterWithMapper(*registration_reference))) {
+        return;
+    }
+    const double sdk_ms = ElapsedMs(start);
+
+    const FrameStore& engine = *frame_store;
+    const FrameStore& sdk = *registration_reference;
+    long long engine_points = 0, sdk_points = 0, common_points = 0;
+    double sum_dz = 0, max_dz = 0;
+    #pragma omp parallel
+    {
+        long long local_engine = 0, local_sdk = 0, local_common = 0;
+        double local_sum = 0, local_max = 0;
+        #pragma omp for
+        for (int i = 0; i < kFRAME_SIZE; i++) {
+            local_engine += engine.mask[i];
+            local_sdk += sdk.mask[i];
+            if (engine.mask[i] && sdk.mask[i]) {
+                const double dz = fabs((double)engine.z[i] - sdk.z[i]);
+                local_common++;
+                local_sum += dz;
+                local_max = (dz > local_max) ? dz : local_max;
             }
         }
-});
+        #pragma omp critical
+        {
+            engine_points += local_engine;
+            sdk_points += local_sdk;
+            common_points += local_common;
+            sum_dz += local_sum;
+            max_dz = (local_max > max_dz) ? local_max : max_dz;
+        }
+    }
+
+    registration_report.engine_points = (int)engine_points;
+    registration_report.sdk_points = (int)sdk_points;
+    registration_report.common_points = (int)common_points;
+    registration_report.mean_abs_dz = common_points ? float(sum_dz / common_points) : 0.0f;
+    registration_report.max_abs_dz = float(max_dz);
+    registration_report.engine_ms = engine_ms;
+    registration_report.sdk_ms = sdk_ms;
+}
+
+
+/**
+ * @brief  Voxel downsampling stage: the clustering runs on the mean points
+ *         of a voxel grid (weighted by their pixel count), then the labels
+ *         are scattered back to the pixels
+ *
+ * @param voxel_size  Voxel edge in meters (0: off)
+ */
+void Grabber::set_voxel_size(float voxel_size) {
+
+    if (voxel_size <= 0) {
+        delete voxelizer;
+        voxelizer = NULL;
+    }
+    else if (voxelizer) {
+        voxelizer->set_voxel_size(voxel_size);
+    }
+    else {
+        voxelizer = new VoxelDownsampler(voxel_size);
+    }
+}
+
+
+/**
+ * @brief  Object extraction stage: after clustering, every label is split
+ *         into spatially connected objects
+ *
+ * @param enable   Object extraction flag
+ * @param max_gap  Largest 3D distance between connected neighbors (meters)
+ */
+void Grabber::set_object_extraction(bool enable, float max_gap) {
+
+    if (!enable) {
+        delete extractor;
+        extractor = NULL;
+    }
+    else if (extractor) {
+        extractor->set_max_gap(max_gap);
+    }
+    else {
+        // sized for the color grid, the depth grid fits as well
+        extractor = new ObjectExtractor(cColorWidth * cColorHeight, max_gap);
+    }
+}
+
+
+/**
+ * @brief  Switches between the color resolution pipeline (1920x1080) and
+ *         the depth-native one (512x424)
+ *
+ * @param enable  Depth-native flag
+ */
+void Grabber::set_depth_native(bool enable) {
+
+    depth_native = enable;
+    if (depth_native && !depth_store) {
+        depth_store = new FrameStore(cDepthWidth, cDepthHeight, num_clusters);
+        depth_grid = new SpatialGrid(cDepthWidth * cDepthHeight);
+        depth_color_UV = new ColorSpacePoint[cDepthWidth * cDepthHeight];
+    }
+}
+
+
+/**
+* @brief Computes the surface normal for each valid point
+*
+* @param points         Registered frame
+* @param window_radius  Half size of the normal window (pixels of the frame)
+*
+* @returns S_OK on success, otherwise failure code.
+*/
+HRESULT Grabber::CalculateSurfaceNormal(FrameStore& points, int window_radius) {
+
+    // covariance of the window points, same cost for every window size
+    normals.compute(points, window_radius);
 
     return S_OK;
 }
@@ -820,58 +1227,70 @@ HRESULT Grabber::drawResults(OUTPUT_TYPE output_type) {
         return E_FAIL;
     }
 
+    // Depth-native frames are projected into the color frame on demand
+    if (depth_native) {
+        HRESULT hr = ProjectToColor(output_type);
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+
     // Populate result buffer
     RGBQUAD* result_buff = result_RGBX;
-    FrameDescriptor* frame_buff = frame_points;
+    const FrameStore& points = *frame_store;
     if (output_type == OUTPUT_COLOR) {
         #pragma omp parallel for num_threads(8)
         for (int i = 0; i < kFRAME_SIZE; i++) {
-            if (valid_frame_points[i]) {
-                result_buff->rgbRed = frame_buff->color.x;
-                result_buff->rgbGreen = frame_buff->color.y;
-                result_buff->rgbBlue = frame_buff->color.z;
+            if (points.mask[i]) {
+                result_buff[i].rgbRed = points.r[i];
+                result_buff[i].rgbGreen = points.g[i];
+                result_buff[i].rgbBlue = points.b[i];
             }
             else {
-                result_buff->rgbRed = 0;
-                result_buff->rgbGreen = 0;
-                result_buff->rgbBlue = 0;
+                result_buff[i].rgbRed = 0;
+                result_buff[i].rgbGreen = 0;
+                result_buff[i].rgbBlue = 0;
             }
-            result_buff++;
-            frame_buff++;
         }
     }
     else if (output_type == OUTPUT_DEPTH) {
         #pragma omp parallel for num_threads(8)
         for (int i = 0; i < kFRAME_SIZE; i++) {
-            if (valid_frame_points[i]) {
-                result_buff->rgbRed = fabsf(frame_buff->position.x * 130);
-                result_buff->rgbGreen = fabsf(frame_buff->position.y * 130);
-                result_buff->rgbBlue = fabsf(frame_buff->position.z * 130);
+            if (points.mask[i]) {
+                result_buff[i].rgbRed = fabsf(points.x[i] * 130);
+                result_buff[i].rgbGreen = fabsf(points.y[i] * 130);
+                result_buff[i].rgbBlue = fabsf(points.z[i] * 130);
             }
             else {
-                result_buff->rgbRed = 0;
-                result_buff->rgbGreen = 0;
-                result_buff->rgbBlue = 0;
+                result_buff[i].rgbRed = 0;
+                result_buff[i].rgbGreen = 0;
+                result_buff[i].rgbBlue = 0;
             }
-            result_buff++;
-            frame_buff++;
         }
     }
     else if (output_type == OUTPUT_NORMAL) {
         #pragma omp parallel for num_threads(8)
         for (int i = 0; i < kFRAME_SIZE; i++) {
-            if (valid_frame_points[i]) {
-                result_buff->rgbRed = fabsf(frame_buff->normal.x*255.0);
-                result_buff->rgbGreen = fabsf(frame_buff->normal.y*255.0);
-                result_buff->rgbBlue = fabsf(frame_buff->normal.z*255.0);
+            if (points.mask[i]) {
+                result_buff[i].rgbRed = fabsf(points.nx[i]*255.0);
+                result_buff[i].rgbGreen = fabsf(points.ny[i]*255.0);
+                result_buff[i].rgbBlue = fabsf(points.nz[i]*255.0);
             }
             else {
-                result_buff->rgbRed = 0;
-                result_buff->rgbGreen = 0;
-                result_buff->rgbBlue = 0;
+                result_buff[i].rgbRed = 0;
+                result_buff[i].rgbGreen = 0;
+                result_buff[i].rgbBlue = 0;
             }
-            result_buff++;
-            frame_buff++;
+        }
+    }
+    else if (output_type == OUTPUT_CLUSTER) {
+        // Labels (or memberships) straight to packed BGRX, one row per task
+        const ClusterPalette& palette = cluster->get_palette();
+        const ColoringKernel kernel = select_coloring_kernel(cluster->get_kernel_isa(), cluster->get_fuzzy());
+        unsigned int* result_bgrx = reinterpret_cast<unsigned int*>(result_buff);
+        #pragma omp parallel for num_threads(8)
+        for (int row = 0; row < cColorHeight; row++) {
+            kernel(points, palette, row * cColorWidth, cColorWidth, result_bgrx);
         }
     }
     m_pDrawResult->Draw(reinterpret_cast<BYTE*>(result_RGBX), cColorWidth * cColorHeight * sizeof(RGBQUAD));
@@ -1015,10 +1434,45 @@ bool Grabber::SetStatusMessage(_In_z_ WCHAR* szMessage,
     return false;
 }
 
+/**
+ * @brief  Sends the clustering diagnostics (seeds, centers, frame stats) to a file
+ *
+ * @param path    Output file
+ * @param format  Text or binary records
+ */
+void Grabber::set_diagnostics_output(const std::string& path, DIAGNOSTICS_FORMAT format) {
+
+    DiagnosticsSink* previous = diagnostics;
+    diagnostics = new DiagnosticsSink(path, format);
+    if (cluster) {
+        cluster->set_diagnostics(diagnostics);
+    }
+    delete previous;
+}
+
+
 HRESULT Grabber::clustering() {
 
-	cluster->set_frame(reinterpret_cast<Image_buffer*>(&frame_points[0]));
-	cluster->set_mask(valid_frame_points);
-	cluster->update();
+	FrameStore* points = depth_native ? depth_store : frame_store;
+	if (voxelizer) {
+		// cluster the voxel cloud, then label the pixels through the pixel-to-voxel map
+		voxelizer->build(*points, num_clusters);
+		if (voxelizer->get_num_voxels() > 0) {
+			cluster->set_frame(voxelizer->get_voxels());
+			cluster->set_spatial_index(NULL);
+			cluster->update();
+			voxelizer->scatter_labels(*points, cluster->get_fuzzy());
+		}
+	}
+	else {
+		cluster->set_frame(points);
+		cluster->set_spatial_index(get_spatial_grid());
+		cluster->update();
+	}
+
+	// split the labels into connected objects
+	if (extractor) {
+		extractor->extract(*points);
+	}
 	return NULL;
 }
\ No newline at end of file
@@ -11,6 +11,15 @@
 #include "ImageRenderer.h"
 #include "vec3.h"
 #include "Clustering.h"
+#include "FrameStore.h"
+#include "SpatialGrid.h"
+#include "DiagnosticsSink.h"
+#include "VoxelDownsampler.h"
+#include "ObjectExtractor.h"
+#include "CameraModel.h"
+#include "DepthRegistration.h"
+#include "RegistrationKernels.h"
+#include "NormalEstimator.h"
 
 // Windows
 #include <Kinect.h>
@@ -21,16 +30,15 @@
 
 
 
-// Frame descriptor
-struct FrameDescriptor {
-    vec3 position;                      // Point 3D world position
-    vec3 color;                         // Point color
-    vec3 normal;                        // Point normal (orientation)
-    //std::vector<float> fuzzy_labels;    // Point fuzzy labels
-	float fuzzy_labels[4];    // Point fuzzy labels
-    /// ????
-    int label;
-    vec3 color_buffer;
+// Portable registration compared with the SDK mapping on the same frame
+struct RegistrationReport {
+    int     engine_points = 0;      // Valid color pixels of the portable registration
+    int     sdk_points = 0;         // Valid color pixels of the SDK mapping
+    int     common_points = 0;      // Valid in both
+    float   mean_abs_dz = 0;        // Mean |z difference| over the common pixels (meters)
+    float   max_abs_dz = 0;         // Largest |z difference| over the common pixels (meters)
+    double  engine_ms = 0;          // Time of the portable registration
+    double  sdk_ms = 0;             // Time of the SDK mapping and its conversion loop
 };
 
 
@@ -127,6 +135,159 @@ public:
     }
 
 
+    /**
+     * @brief  Sets the number of clusters k used by the clustering stage
+     *
+     * @param num_clusters_  Number of clusters
+     */
+    inline void set_num_clusters(int num_clusters_) {
+        num_clusters = num_clusters_;
+        if (cluster) {
+            cluster->set_num_clusters(num_clusters);
+        }
+    }
+
+
+    /**
+     * @brief  Sends the clustering diagnostics (seeds, centers, frame stats) to a file
+     *
+     * @param path    Output file
+     * @param format  Text or binary records
+     */
+    void set_diagnostics_output(const std::string& path, DIAGNOSTICS_FORMAT format = DIAGNOSTICS_TEXT);
+
+
+    /**
+     * @brief  Voxel grid over the valid 3D points of the last registered frame
+     */
+    inline const SpatialGrid* get_spatial_grid() const {
+        return depth_native ? depth_grid : spatial_grid;
+    }
+
+
+    /**
+     * @brief  Switches between the color resolution pipeline (1920x1080) and
+     *         the depth-native one (512x424): registration, normals and
+     *         clustering run on the depth grid, the color resolution images
+     *         are only produced by projection when drawn
+     *
+     * @param enable  Depth-native flag
+     */
+    void set_depth_native(bool enable);
+    inline bool get_depth_native() const {
+        return depth_native;
+    }
+
+
+    /**
+     * @brief  Intrinsics used to back-project the color pixels (the ray table
+     *         is rebuilt on the next frame when they change)
+     *
+     * @param intrinsics  Color camera intrinsics (cColorWidth x cColorHeight)
+     */
+    inline void set_color_intrinsics(const PinholeIntrinsics& intrinsics) {
+        color_intrinsics = intrinsics;
+    }
+    inline const PinholeIntrinsics& get_color_intrinsics() const {
+        return color_intrinsics;
+    }
+
+
+    /**
+     * @brief  Loads the color camera calibration (intrinsics and distortion) and
+     *         builds its rays right away; the distorted ray maps are cached next
+     *         to the calibration file (<path>.raycache) for the next start
+     *
+     * @param path  Calibration file (see PinholeIntrinsics::load)
+     *
+     * @returns S_OK on success, otherwise failure code.
+     */
+    HRESULT load_color_calibration(const std::string& path);
+
+
+    /**
+     * @brief  Switches the 1080p registration to the portable forward projection
+     *         of the depth pixels (DepthRegistration) instead of the SDK mapping
+     *         of every color pixel; it projects with the color rays of the
+     *         grabber, so the color calibration may be loaded before or after
+     *
+     * @param depth_calibration      Depth camera intrinsics file (see PinholeIntrinsics::load)
+     * @param extrinsics_calibration Depth to color transform file (see RigidTransform::load)
+     *
+     * @returns S_OK on success, otherwise failure code.
+     */
+    HRESULT load_depth_calibration(const std::string& depth_calibration,
+                                   const std::string& extrinsics_calibration);
+    void disable_portable_registration();
+
+
+    /**
+     * @brief  With the portable registration, also runs the SDK mapping on
+     *         every frame and compares both (accuracy check, slow)
+     */
+    inline void set_registration_report(bool enable) {
+        registration_report_enabled = enable;
+    }
+    inline const RegistrationReport& get_registration_report() const {
+        return registration_report;
+    }
+
+
+    /**
+     * @brief  Voxel downsampling stage: the clustering runs on the mean points
+     *         of a voxel grid (weighted by their pixel count), then the labels
+     *         are scattered back to the pixels
+     *
+     * @param voxel_size  Voxel edge in meters (0: off)
+     */
+    void set_voxel_size(float voxel_size);
+
+
+    /**
+     * @brief  Object extraction stage: after clustering, every label is split
+     *         into spatially connected objects (pixel count, 2D box, 3D
+     *         centroid and 3D box of each)
+     *
+     * @param enable   Object extraction flag
+     * @param max_gap  Largest 3D distance between connected neighbors (meters)
+     */
+    void set_object_extraction(bool enable, float max_gap = 0.02f);
+
+
+    /**
+     * @brief  Objects of the last clustered frame (empty when extraction is off)
+     */
+    inline const std::vector<SceneObject>& get_objects() const {
+        static const std::vector<SceneObject> none;
+        return extractor ? extractor->get_objects() : none;
+    }
+
+
+    /**
+     * @brief  Surface normal window: every normal comes from the covariance
+     *         of the points in a (2r + 1) x (2r + 1) pixel window, windows
+     *         across a depth edge get no normal
+     *
+     * @param window_radius     Half size of the window (color pixels)
+     * @param max_depth_change  Largest depth step between neighbors, relative to their depth
+     */
+    inline void set_normal_window(int window_radius, float max_depth_change = 0.02f) {
+        normal_radius = window_radius;
+        normals.set_max_depth_change(max_depth_change);
+    }
+
+
+    /**
+     * @brief  Produces the 1080p label image (labels and mask of the color
+     *         resolution frame) from the depth-native labels
+     *
+     * @returns S_OK on success, otherwise failure code.
+     */
+    inline HRESULT project_labels() {
+        return ProjectToColor(OUTPUT_CLUSTER);
+    }
+
+
     /**
      * @brief  Sets the image render for the color image
      *
@@ -194,8 +355,8 @@ private:
 	IKinectSensor*           m_pKinectSensor;   // Sensor driver
     IMultiSourceFrameReader* m_pKinectReader;   // Kinect frame grabber
     ICoordinateMapper*       m_pKinectMapper;   // Converts between depth, color, and 3d coordinates
-    FrameDescriptor          frame_points[kFRAME_SIZE]; // Registered image planes of the current frame
-    bool                     valid_frame_points[kFRAME_SIZE]; // Mask for valid points of the frame
+    FrameStore*              frame_store;     // Registered image planes of the current frame (+ valid mask)
+    SpatialGrid*             spatial_grid;    // Voxel grid over the valid points of the current frame
 
 	// Color buffers
     RGBQUAD*        aux_color_RGBX;     // Pre-allocated RGBX frame 
@@ -212,7 +373,7 @@ private:
     RGBQUAD*          depth_RGBX;         // Post-processed(normalized) z-buffer
     UINT16*           aux_depth_u16;      // Pre-allocated UINT16 frame 
     UINT16*           raw_depth_u16;      // Raw depth(z) data buffer
-    CameraSpacePoint* depth_XYZ;          // Depth frame projected into XYZ space (camera space)
+    CameraSpacePoint* depth_XYZ;          // Color frame in camera space (SDK registration, allocated on first use)
     bool              screenshot_depth;   // Trigger for depth image save
 
     // Results buffers
@@ -227,6 +388,36 @@ private:
 
 	// Clustering
 	Clustering* cluster;
+    int         num_clusters;       // Number of clusters k
+    DiagnosticsSink* diagnostics;   // Background writer of the clustering diagnostics (NULL: off)
+
+    // Depth-native pipeline (allocated on first use)
+    bool             depth_native;      // Register and cluster at depth resolution
+    FrameStore*      depth_store;       // Registered depth grid (512x424)
+    SpatialGrid*     depth_grid;        // Voxel grid over the valid depth points
+    ColorSpacePoint* depth_color_UV;    // Color pixel of each depth pixel
+    DepthSpacePoint* color_depth_UV;    // Depth pixel of each color pixel (projection)
+    bool             color_lookup_ready;// color_depth_UV holds the current frame
+
+    VoxelDownsampler* voxelizer;        // Voxel downsampling stage (NULL: off)
+    ObjectExtractor*  extractor;        // Connected objects stage (NULL: off)
+
+    // Back-projection of the color pixels
+    PinholeIntrinsics color_intrinsics; // Color camera model
+    RayTable          color_rays;       // Rays of color_intrinsics
+    std::string       ray_cache_path;   // Cache of the distorted rays (empty: none)
+    RegistrationKernel register_kernel; // Fused mapper output to frame points kernel
+
+    // Surface normals
+    NormalEstimator   normals;          // Windowed covariance normals
+    int               normal_radius;    // Window half size (color pixels)
+
+    // Portable registration (NULL: SDK mapping)
+    DepthRegistration* registration;
+    bool               registration_report_enabled;
+    RegistrationReport registration_report;
+    FrameStore*        registration_reference;  // SDK registration of the compared frame
+
     /**
      * @brief  Grabs and stores the depth frame
      *
@@ -294,22 +485,55 @@ private:
 
 
     /**
-     * @brief Projects a point from image plane to the 3D world space
+     * @brief Registers color into the native depth grid: every valid depth
+     *        pixel becomes a point, colored by its pixel in the color frame
      *
-     * @param (xp,yp)     Point in 2D fimage plane coordinates
-     * @param zp          Depth of the 2D point
-     * @param (xw,yw,zw)  Point in 3D world coordinates
+     * @returns S_OK on success, otherwise failure code.
      */
-    void ConvertProjectiveToRealWorld(float xp, float yp, float zp,
-                                      float &xw, float &yw, float &zw);
-    
-    
+    HRESULT RegisterDepthNative();
+
+
+    /**
+     * @brief Registers the color frame through the SDK mapping of every color
+     *        pixel to camera space (position, color and mask of every pixel)
+     *
+     * @param points  Output frame (color resolution)
+     *
+     * @returns S_OK on success, otherwise failure code.
+     */
+    HRESULT RegisterWithMapper(FrameStore& points);
+
+
+    /**
+     * @brief Runs the SDK registration on the same frame as the portable one
+     *        and compares them (depth of the pixels valid in both, coverage)
+     *
+     * @param engine_ms  Time of the portable registration
+     */
+    void CompareRegistration(double engine_ms);
+
+
+    /**
+     * @brief Fills the color resolution frame from the depth-native frame:
+     *        each color pixel takes the attributes of the depth pixel it maps
+     *        to (mask always, then only what the output needs)
+     *
+     * @param output_type  The type of information that will be drawn
+     *
+     * @returns S_OK on success, otherwise failure code.
+     */
+    HRESULT ProjectToColor(OUTPUT_TYPE output_type);
+
+
     /**
      * @brief Computes the surface normal for each valid point
      *
+     * @param points         Registered frame
+     * @param window_radius  Half size of the normal window (pixels of the frame)
+     *
      * @returns S_OK on success, otherwise failure code.
      */
-    HRESULT CalculateSurfaceNormal();
+    HRESULT CalculateSurfaceNormal(FrameStore& points, int window_radius);
 
     /**
      * @brief Get the name of the file where screenshot will be stored.
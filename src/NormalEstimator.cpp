@@ -0,0 +1,253 @@
+//============================================================================
+// Name        : NormalEstimator.cpp
+// Copyright   : GWU Research
+// Description : Windowed covariance surface normals of the registered frame
+//============================================================================
+
+#include "NormalEstimator.h"
+
+// C/C++
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+
+// Moments summed per pixel: count, depth edges, x, y, z, xx, xy, xz, yy, yz, zz
+enum { kCOUNT, kEDGES, kX, kY, kZ, kXX, kXY, kXZ, kYY, kYZ, kZZ, kMOMENTS };
+
+// Rows per band task
+static const int kNORMAL_BAND = 32;
+
+
+/**
+ * @brief Adds (sign 1) or removes (sign -1) the moments of one row to the
+ *        column sums
+ */
+static void add_row(const FrameStore& points, const unsigned char* depth_edge,
+                    int row, double sign, double* column) {
+
+    const int width = points.width;
+    const int first = row * width;
+    for (int u = 0; u < width; u++) {
+        const int i = first + u;
+        if (!points.mask[i]) {
+            continue;
+        }
+        const double x = points.x[i], y = points.y[i], z = points.z[i];
+        double* sums = column + u * kMOMENTS;
+        sums[kCOUNT] += sign;
+        sums[kEDGES] += sign * depth_edge[i];
+        sums[kX] += sign * x;
+        sums[kY] += sign * y;
+        sums[kZ] += sign * z;
+        sums[kXX] += sign * x * x;
+        sums[kXY] += sign * x * y;
+        sums[kXZ] += sign * x * z;
+        sums[kYY] += sign * y * y;
+        sums[kYZ] += sign * y * z;
+        sums[kZZ] += sign * z * z;
+    }
+}
+
+
+/**
+ * @brief Unit eigenvector of the smallest eigenvalue of a symmetric 3x3
+ *        matrix. The adjugate has the same eigenvectors with eigenvalues
+ *        l2 l3, l1 l3 and l1 l2, so its largest column followed by two power
+ *        steps converges by l3 / l2 per step: exact for a plane (l3 = 0) and
+ *        without any trigonometry.
+ *
+ * @returns false when the matrix has no single smallest direction
+ */
+static bool smallest_eigenvector(double a00, double a01, double a02, double a11, double a12, double a22,
+                                 float& nx, float& ny, float& nz) {
+
+    const double m00 = a11*a22 - a12*a12;
+    const double m01 = a02*a12 - a01*a22;
+    const double m02 = a01*a12 - a02*a11;
+    const double m11 = a00*a22 - a02*a02;
+    const double m12 = a01*a02 - a00*a12;
+    const double m22 = a00*a11 - a01*a01;
+
+    // largest diagonal, its column is the longest one (points on a line or
+    // a single point leave the adjugate zero)
+    double v0 = m00, v1 = m01, v2 = m02;
+    double largest = m00;
+    if (m11 > largest) {
+        v0 = m01; v1 = m11; v2 = m12;
+        largest = m11;
+    }
+    if (m22 > largest) {
+        v0 = m02; v1 = m12; v2 = m22;
+        largest = m22;
+    }
+    if (!(largest > 0)) {
+        return false;
+    }
+    for (int step = 0; step < 2; step++) {
+        const double w0 = m00*v0 + m01*v1 + m02*v2;
+        const double w1 = m01*v0 + m11*v1 + m12*v2;
+        const double w2 = m02*v0 + m12*v1 + m22*v2;
+        // rescale so the powers do not underflow
+        const double inv_scale = 1 / largest;
+        v0 = w0 * inv_scale;
+        v1 = w1 * inv_scale;
+        v2 = w2 * inv_scale;
+    }
+    const double length2 = v0*v0 + v1*v1 + v2*v2;
+    if (!(length2 > 0)) {
+        return false;
+    }
+    const double inv_length = 1 / sqrt(length2);
+    nx = (float)(v0 * inv_length);
+    ny = (float)(v1 * inv_length);
+    nz = (float)(v2 * inv_length);
+    return true;
+}
+
+
+/**
+ * @brief NormalEstimator constructor
+ *
+ * @param max_depth_change_  Largest depth step between neighbor pixels,
+ *                           relative to their depth (meters per meter)
+ * @param min_neighbors_     Fewest valid points of a window with a normal
+ */
+NormalEstimator::NormalEstimator(float max_depth_change_, int min_neighbors_) :
+max_depth_change(max_depth_change_),
+min_neighbors(min_neighbors_) {
+}
+
+
+/**
+ * @brief Computes the normal of every pixel of the frame
+ *
+ * @param points         Registered frame (position and mask)
+ * @param window_radius  Half size of the window (pixels, window is 2r + 1 wide)
+ */
+void NormalEstimator::compute(FrameStore& points, int window_radius) {
+
+    const int width = points.width;
+    const int height = points.height;
+    const int size = width * height;
+    window_radius = std::max(window_radius, 1);
+
+    // 1. depth edges: a valid neighbor further away in depth than allowed
+    depth_edge.resize(size);
+    #pragma omp parallel for
+    for (int v = 0; v < height; v++) {
+        for (int u = 0; u < width; u++) {
+            const int i = v * width + u;
+            bool edge = false;
+            if (points.mask[i]) {
+                const float limit = max_depth_change * points.z[i];
+                const int right = i + 1;
+                const int down = i + width;
+                edge = (u + 1 < width && points.mask[right] && fabsf(points.z[right] - points.z[i]) > limit) ||
+                       (v + 1 < height && points.mask[down] && fabsf(points.z[down] - points.z[i]) > limit);
+            }
+            depth_edge[i] = edge;
+        }
+    }
+
+    // 2. bands of rows, each thread slides its column sums down its bands
+    const int num_threads = omp_get_max_threads();
+    const size_t per_thread = (size_t)(2 * width + 1) * kMOMENTS;
+    scratch.resize(num_threads * per_thread);
+    const int num_bands = (height + kNORMAL_BAND - 1) / kNORMAL_BAND;
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        double* column = &scratch[omp_get_thread_num() * per_thread];
+        double* prefix = column + width * kMOMENTS;
+        #pragma omp for schedule(dynamic, 1)
+        for (int band = 0; band < num_bands; band++) {
+            const int begin = band * kNORMAL_BAND;
+            compute_band(points, window_radius, begin, std::min(begin + kNORMAL_BAND, height), column, prefix);
+        }
+    }
+}
+
+
+/**
+ * @brief Normals of the rows [begin, end) of a band
+ */
+void NormalEstimator::compute_band(FrameStore& points, int window_radius, int begin, int end,
+                                   double* column, double* prefix) {
+
+    const int width = points.width;
+    const int height = points.height;
+    const double min_count = std::max(min_neighbors, 3) - 0.5;
+
+    // column sums of the window rows of the first row
+    std::fill(column, column + width * kMOMENTS, 0.0);
+    for (int row = std::max(begin - window_radius, 0); row <= std::min(begin + window_radius, height - 1); row++) {
+        add_row(points, &depth_edge[0], row, 1, column);
+    }
+
+    for (int v = begin; v < end; v++) {
+
+        // prefix sums along the row, prefix[u] holds the columns before u
+        std::fill(prefix, prefix + kMOMENTS, 0.0);
+        for (int u = 0; u < width; u++) {
+            const double* col = column + u * kMOMENTS;
+            const double* before = prefix + u * kMOMENTS;
+            double* after = prefix + (u + 1) * kMOMENTS;
+            for (int m = 0; m < kMOMENTS; m++) {
+                after[m] = before[m] + col[m];
+            }
+        }
+
+        for (int u = 0; u < width; u++) {
+            const int i = v * width + u;
+            points.nx[i] = 0;
+            points.ny[i] = 0;
+            points.nz[i] = 0;
+            if (!points.mask[i]) {
+                continue;
+            }
+
+            // window sums, no normal across a depth edge or from too few points
+            const double* hi = prefix + (std::min(u + window_radius, width - 1) + 1) * kMOMENTS;
+            const double* lo = prefix + std::max(u - window_radius, 0) * kMOMENTS;
+            const double n = hi[kCOUNT] - lo[kCOUNT];
+            if (hi[kEDGES] - lo[kEDGES] > 0.5 || n < min_count) {
+                continue;
+            }
+            const double inv_n = 1 / n;
+            const double mx = (hi[kX] - lo[kX]) * inv_n;
+            const double my = (hi[kY] - lo[kY]) * inv_n;
+            const double mz = (hi[kZ] - lo[kZ]) * inv_n;
+            const double cxx = (hi[kXX] - lo[kXX]) * inv_n - mx * mx;
+            const double cxy = (hi[kXY] - lo[kXY]) * inv_n - mx * my;
+            const double cxz = (hi[kXZ] - lo[kXZ]) * inv_n - mx * mz;
+            const double cyy = (hi[kYY] - lo[kYY]) * inv_n - my * my;
+            const double cyz = (hi[kYZ] - lo[kYZ]) * inv_n - my * mz;
+            const double czz = (hi[kZZ] - lo[kZZ]) * inv_n - mz * mz;
+
+            float nx, ny, nz;
+            if (!smallest_eigenvector(cxx, cxy, cxz, cyy, cyz, czz, nx, ny, nz)) {
+                continue;
+            }
+            // towards the camera (at the origin)
+            if (nx * points.x[i] + ny * points.y[i] + nz * points.z[i] > 0) {
+                nx = -nx;
+                ny = -ny;
+                nz = -nz;
+            }
+            points.nx[i] = nx;
+            points.ny[i] = ny;
+            points.nz[i] = nz;
+        }
+
+        // slide the window one row down
+        if (v + 1 < end) {
+            if (v + 1 + window_radius < height) {
+                add_row(points, &depth_edge[0], v + 1 + window_radius, 1, column);
+            }
+            if (v - window_radius >= 0) {
+                add_row(points, &depth_edge[0], v - window_radius, -1, column);
+            }
+        }
+    }
+}
@@ -0,0 +1,66 @@
+//============================================================================
+// Name        : NormalEstimator.h
+// Copyright   : GWU Research
+// Description : Windowed covariance surface normals of the registered frame
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+
+// C/C++
+#include <vector>
+
+
+// Surface normals from the covariance of the points in a square pixel window.
+// Rows are split into bands; a band keeps running column sums of the point
+// moments (count, x, y, z and their products) over the window rows and takes
+// a prefix sum along each row, so every window sum costs the same whatever
+// the window size. The normal is the eigenvector of the smallest eigenvalue
+// of the window covariance, turned towards the camera. Windows that cross a
+// depth edge or hold too few points get no normal (zero).
+class NormalEstimator {
+
+public:
+
+    /**
+     * @brief NormalEstimator constructor
+     *
+     * @param max_depth_change_  Largest depth step between neighbor pixels,
+     *                           relative to their depth (meters per meter)
+     * @param min_neighbors_     Fewest valid points of a window with a normal
+     */
+    NormalEstimator(float max_depth_change_ = 0.02f, int min_neighbors_ = 6);
+
+
+    /**
+     * @brief Computes the normal of every pixel of the frame
+     *
+     * @param points         Registered frame (position and mask)
+     * @param window_radius  Half size of the window (pixels, window is 2r + 1 wide)
+     */
+    void compute(FrameStore& points, int window_radius);
+
+
+    inline void  set_max_depth_change(float max_depth_change_) { max_depth_change = max_depth_change_; }
+    inline float get_max_depth_change() const { return max_depth_change; }
+    inline void  set_min_neighbors(int min_neighbors_) { min_neighbors = min_neighbors_; }
+    inline int   get_min_neighbors() const { return min_neighbors; }
+
+private:
+
+    /**
+     * @brief Normals of the rows [begin, end) of a band
+     */
+    void compute_band(FrameStore& points, int window_radius, int begin, int end, double* column, double* prefix);
+
+
+    float   max_depth_change;
+    int     min_neighbors;
+
+    std::vector<unsigned char>  depth_edge;     // Pixel with a depth step to its right or lower neighbor
+    std::vector<double>         scratch;        // Per-thread column and prefix sums
+
+    NormalEstimator(const NormalEstimator&);
+    NormalEstimator& operator=(const NormalEstimator&);
+};
@@ -0,0 +1,270 @@
+//============================================================================
+// Name        : ObjectExtractor.cpp
+// Copyright   : GWU Research
+// Description : Connected-component objects of the clustered frame
+//============================================================================
+
+#include "ObjectExtractor.h"
+
+// C/C++
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <omp.h>
+
+
+// Valid points per task of the root scan
+static const int kOBJECT_BLOCK = 16384;
+
+
+/**
+ * @brief Same label and closer than the gap in 3D
+ */
+static inline bool connected(const FrameStore& points, int i, int j, float max_gap2) {
+
+    if (points.label[i] != points.label[j]) {
+        return false;
+    }
+    const float dx = points.x[j] - points.x[i];
+    const float dy = points.y[j] - points.y[i];
+    const float dz = points.z[j] - points.z[i];
+    return dx*dx + dy*dy + dz*dz <= max_gap2;
+}
+
+
+/**
+ * @brief ObjectExtractor constructor
+ *
+ * @param max_points   Maximum number of points (frame size)
+ * @param max_gap_     Largest 3D distance between connected neighbors (meters)
+ * @param min_pixels_  Smallest component reported as an object
+ */
+ObjectExtractor::ObjectExtractor(int max_points, float max_gap_, int min_pixels_) :
+max_gap(max_gap_),
+min_pixels(min_pixels_),
+parent(new std::atomic<int>[max_points]),
+root_size(new std::atomic<int>[max_points]),
+object_map(max_points, -1),
+joined_left(max_points, 0) {
+}
+
+
+/**
+ * @brief Root of a pixel, halving the path on the way (lock-free)
+ */
+int ObjectExtractor::find(int i) {
+
+    for (;;) {
+        const int p = parent[i].load(std::memory_order_relaxed);
+        if (p == i) {
+            return i;
+        }
+        // point to the grandparent, a failed CAS only means someone else did it
+        const int gp = parent[p].load(std::memory_order_relaxed);
+        if (p != gp) {
+            int expected = p;
+            parent[i].compare_exchange_weak(expected, gp, std::memory_order_relaxed);
+        }
+        i = gp;
+    }
+}
+
+
+/**
+ * @brief Links the components of two pixels, the larger root goes under
+ *        the smaller one (lock-free)
+ */
+void ObjectExtractor::unite(int a, int b) {
+
+    for (;;) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return;
+        }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        // a is still a root only if nobody linked it meanwhile
+        int expected = a;
+        if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+
+/**
+ * @brief Finds the objects of a clustered frame
+ *
+ * @param points  Registered frame with labels
+ */
+void ObjectExtractor::extract(const FrameStore& points) {
+
+    const int width = points.width;
+    const int height = points.height;
+    const int num_valid = points.num_valid;
+    const int* valid_index = points.valid_index;
+    const float max_gap2 = max_gap * max_gap;
+    objects.clear();
+    if (num_valid == 0) {
+        return;
+    }
+
+    // 1. row runs: a pixel joined to its left neighbor points to the start
+    //    of its run, so every later find is one or two hops
+    #pragma omp parallel for
+    for (int v = 0; v < height; v++) {
+        int run_start = -1;
+        for (int u = 0; u < width; u++) {
+            const int i = v * width + u;
+            if (!points.mask[i]) {
+                run_start = -1;
+                continue;
+            }
+            const bool left = run_start >= 0 && connected(points, i - 1, i, max_gap2);
+            run_start = left ? run_start : i;
+            joined_left[i] = left;
+            parent[i].store(run_start, std::memory_order_relaxed);
+            root_size[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 2. union with the lower neighbors. When the left pixels of both rows
+    //    are joined (to each other and to these two), the pair is already in
+    //    one component and the union is skipped.
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int v = 0; v < height - 1; v++) {
+        bool left_down = false;
+        for (int u = 0; u < width; u++) {
+            const int i = v * width + u;
+            const int j = i + width;
+            const bool down = points.mask[i] && points.mask[j] && connected(points, i, j, max_gap2);
+            if (down && !(left_down && joined_left[i] && joined_left[j])) {
+                unite(i, j);
+            }
+            left_down = down;
+        }
+    }
+
+    // 3. roots of the valid pixels and component sizes at the roots (runs of
+    //    the same root take one add), every block lists its roots in order
+    const int num_blocks = (num_valid + kOBJECT_BLOCK - 1) / kOBJECT_BLOCK;
+    block_roots.resize(num_blocks);
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kOBJECT_BLOCK;
+        const int end = std::min(begin + kOBJECT_BLOCK, num_valid);
+        std::vector<int>& roots = block_roots[block];
+        roots.clear();
+        int run_root = -1, run = 0;
+        for (int n = begin; n < end; n++) {
+            const int i = valid_index[n];
+            // a pixel joined to its left neighbor shares its root
+            const int root = (n > begin && joined_left[i]) ? run_root : find(i);
+            object_map[i] = root;
+            if (root == i) {
+                roots.push_back(i);
+            }
+            if (root != run_root) {
+                if (run) {
+                    root_size[run_root].fetch_add(run, std::memory_order_relaxed);
+                }
+                run_root = root;
+                run = 0;
+            }
+            run++;
+        }
+        if (run) {
+            root_size[run_root].fetch_add(run, std::memory_order_relaxed);
+        }
+    }
+
+    // 4. object ids for the large enough roots, in pixel order. The root keeps
+    //    its id in root_size (as -id - 2), the small ones get -1.
+    int num_objects = 0;
+    for (int block = 0; block < num_blocks; block++) {
+        for (size_t r = 0; r < block_roots[block].size(); r++) {
+            std::atomic<int>& code = root_size[block_roots[block][r]];
+            const bool kept = code.load(std::memory_order_relaxed) >= min_pixels;
+            code.store(kept ? -(num_objects++) - 2 : -1, std::memory_order_relaxed);
+        }
+    }
+
+    // 5. per-thread object sums, a thread only touches the objects of its rows
+    const int num_threads = omp_get_max_threads();
+    ObjectSums empty;
+    empty.label = -1;
+    empty.count = 0;
+    empty.min_u = empty.min_v = INT_MAX;
+    empty.max_u = empty.max_v = -1;
+    for (int c = 0; c < 3; c++) {
+        empty.min[c] = FLT_MAX;
+        empty.max[c] = -FLT_MAX;
+        empty.sum[c] = 0;
+    }
+    partial.assign((size_t)num_threads * num_objects, empty);
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        ObjectSums* local = partial.empty() ? NULL : &partial[(size_t)omp_get_thread_num() * num_objects];
+        #pragma omp for
+        for (int n = 0; n < num_valid; n++) {
+            const int i = valid_index[n];
+            const int code = root_size[object_map[i]].load(std::memory_order_relaxed);
+            const int id = (code <= -2) ? -code - 2 : -1;
+            object_map[i] = id;
+            if (id < 0) {
+                continue;
+            }
+            ObjectSums& object = local[id];
+            const int u = i % width;
+            const int v = i / width;
+            const float p[3] = { points.x[i], points.y[i], points.z[i] };
+            object.label = points.label[i];
+            object.count++;
+            object.min_u = std::min(object.min_u, u);
+            object.max_u = std::max(object.max_u, u);
+            object.min_v = std::min(object.min_v, v);
+            object.max_v = std::max(object.max_v, v);
+            for (int c = 0; c < 3; c++) {
+                object.min[c] = std::min(object.min[c], p[c]);
+                object.max[c] = std::max(object.max[c], p[c]);
+                object.sum[c] += p[c];
+            }
+        }
+    }
+
+    // 6. merge the threads in order
+    objects.resize(num_objects);
+    for (int id = 0; id < num_objects; id++) {
+        ObjectSums total = empty;
+        for (int t = 0; t < num_threads; t++) {
+            const ObjectSums& part = partial[(size_t)t * num_objects + id];
+            if (part.count == 0) {
+                continue;
+            }
+            total.label = part.label;
+            total.count += part.count;
+            total.min_u = std::min(total.min_u, part.min_u);
+            total.max_u = std::max(total.max_u, part.max_u);
+            total.min_v = std::min(total.min_v, part.min_v);
+            total.max_v = std::max(total.max_v, part.max_v);
+            for (int c = 0; c < 3; c++) {
+                total.min[c] = std::min(total.min[c], part.min[c]);
+                total.max[c] = std::max(total.max[c], part.max[c]);
+                total.sum[c] += part.sum[c];
+            }
+        }
+        SceneObject& object = objects[id];
+        object.label = total.label;
+        object.pixel_count = total.count;
+        object.min_u = total.min_u;
+        object.min_v = total.min_v;
+        object.max_u = total.max_u;
+        object.max_v = total.max_v;
+        object.centroid = vec3(float(total.sum[0] / total.count), float(total.sum[1] / total.count), float(total.sum[2] / total.count));
+        object.min_corner = vec3(total.min[0], total.min[1], total.min[2]);
+        object.max_corner = vec3(total.max[0], total.max[1], total.max[2]);
+    }
+}
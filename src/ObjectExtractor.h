@@ -0,0 +1,109 @@
+//============================================================================
+// Name        : ObjectExtractor.h
+// Copyright   : GWU Research
+// Description : Connected-component objects of the clustered frame
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+#include "vec3.h"
+
+// C/C++
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+// One connected part of a cluster
+struct SceneObject {
+    int     label;              // Cluster label
+    int     pixel_count;        // Number of pixels
+    int     min_u, min_v;       // 2D bounding box (pixels, inclusive)
+    int     max_u, max_v;
+    vec3    centroid;           // 3D centroid
+    vec3    min_corner;         // 3D axis aligned bounding box
+    vec3    max_corner;
+};
+
+
+// Splits every cluster label into spatially connected components. Two grid
+// neighbors are connected when they have the same label and are closer than
+// max_gap in 3D (so labels do not connect across depth edges). The components
+// are found by a lock-free union-find over the image grid, with the lowest
+// pixel index as the root of each component.
+class ObjectExtractor {
+
+public:
+
+    /**
+     * @brief ObjectExtractor constructor
+     *
+     * @param max_points   Maximum number of points (frame size)
+     * @param max_gap_     Largest 3D distance between connected neighbors (meters)
+     * @param min_pixels_  Smallest component reported as an object
+     */
+    ObjectExtractor(int max_points, float max_gap_ = 0.02f, int min_pixels_ = 100);
+
+
+    /**
+     * @brief Finds the objects of a clustered frame
+     *
+     * @param points  Registered frame with labels
+     */
+    void extract(const FrameStore& points);
+
+
+    /**
+     * @brief Objects of the last frame, ordered by their first pixel
+     */
+    inline const std::vector<SceneObject>& get_objects() const { return objects; }
+
+
+    /**
+     * @brief Object of each pixel of the last frame (-1: invalid or too small)
+     */
+    inline const int* get_object_map() const { return object_map.data(); }
+
+
+    inline void set_max_gap(float max_gap_) { max_gap = max_gap_; }
+    inline void set_min_pixels(int min_pixels_) { min_pixels = min_pixels_; }
+
+private:
+
+    /**
+     * @brief Root of a pixel, halving the path on the way (lock-free)
+     */
+    int find(int i);
+
+
+    /**
+     * @brief Links the components of two pixels, the larger root goes under
+     *        the smaller one (lock-free)
+     */
+    void unite(int a, int b);
+
+
+    // Running sums of one object
+    struct ObjectSums {
+        int     label;
+        int     count;
+        int     min_u, min_v, max_u, max_v;
+        float   min[3], max[3];
+        double  sum[3];
+    };
+
+    float   max_gap;
+    int     min_pixels;
+
+    std::unique_ptr<std::atomic<int>[]> parent;         // Union-find forest over the pixels
+    std::unique_ptr<std::atomic<int>[]> root_size;      // Pixels of each component (at its root), then its object
+    std::vector<int>                object_map;         // Object of each pixel
+    std::vector<unsigned char>      joined_left;        // Pixel joined to its left neighbor
+    std::vector<std::vector<int> >  block_roots;        // Component roots of each block, in pixel order
+    std::vector<ObjectSums>         partial;            // Per-thread object sums
+    std::vector<SceneObject>        objects;
+
+    ObjectExtractor(const ObjectExtractor&);
+    ObjectExtractor& operator=(const ObjectExtractor&);
+};
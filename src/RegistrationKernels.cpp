@@ -0,0 +1,180 @@
+//============================================================================
+// Name        : RegistrationKernels.cpp
+// Copyright   : GWU Research
+// Description : Fused camera space to frame point registration kernels
+//============================================================================
+
+#include "RegistrationKernels.h"
+
+// C/C++
+#include <cstring>
+#include <immintrin.h>
+
+
+/**
+ * @brief Scalar registration, also handles the unaligned head and the tail
+ *        of the SIMD kernels
+ */
+static void register_scalar(const float* camera_xyz, const unsigned int* color_bgrx,
+                            const float* ray_x, const float* ray_y, float row_slope,
+                            float min_depth, float max_depth,
+                            int begin, int count, FrameStore& points) {
+
+    const int end = begin + count;
+    for (int i = begin; i < end; i++) {
+        const int col = i - begin;
+        const float z = camera_xyz[3 * i + 2];
+        const unsigned int bgrx = color_bgrx[i];
+        // NaN and infinity fail the range check
+        const bool valid = z >= min_depth && z < max_depth;
+        points.x[i] = valid ? z * ray_x[col] : 0;
+        points.y[i] = valid ? z * (ray_y ? ray_y[col] : row_slope) : 0;
+        points.z[i] = valid ? z : 0;
+        points.r[i] = valid ? (float)((bgrx >> 16) & 0xFF) : 0;
+        points.g[i] = valid ? (float)((bgrx >> 8) & 0xFF) : 0;
+        points.b[i] = valid ? (float)(bgrx & 0xFF) : 0;
+        points.mask[i] = valid;
+    }
+}
+
+
+/**
+ * @brief Pixels before the first one aligned for the streaming stores (all
+ *        planes share the alignment of the x plane)
+ */
+static inline int unaligned_head(const FrameStore& points, int begin, int count, int lanes) {
+
+    const size_t misalignment = (reinterpret_cast<size_t>(points.x + begin) / sizeof(float)) % lanes;
+    const int head = misalignment ? lanes - (int)misalignment : 0;
+    return head < count ? head : count;
+}
+
+
+/**
+ * @brief SSE4.2 registration, 4 pixels at once
+ */
+KERNEL_TARGET_SSE42 static void register_sse42(const float* camera_xyz, const unsigned int* color_bgrx,
+                           const float* ray_x, const float* ray_y, float row_slope,
+                           float min_depth, float max_depth,
+                           int begin, int count, FrameStore& points) {
+
+    const int head = unaligned_head(points, begin, count, 4);
+    register_scalar(camera_xyz, color_bgrx, ray_x, ray_y, row_slope, min_depth, max_depth, begin, head, points);
+
+    const __m128 lo = _mm_set1_ps(min_depth);
+    const __m128 hi = _mm_set1_ps(max_depth);
+    const __m128 slope = _mm_set1_ps(row_slope);
+    const __m128i byte_mask = _mm_set1_epi32(0xFF);
+    const __m128i one = _mm_set1_epi32(1);
+    const int end = begin + count;
+
+    int i = begin + head;
+    for (; i + 4 <= end; i += 4) {
+        const int col = i - begin;
+
+        // Z of 4 interleaved points: [x0 y0 z0 x1] [y1 z1 x2 y2] [z2 x3 y3 z3]
+        const float* xyz = camera_xyz + 3 * i;
+        const __m128 a = _mm_loadu_ps(xyz);
+        const __m128 b = _mm_loadu_ps(xyz + 4);
+        const __m128 c = _mm_loadu_ps(xyz + 8);
+        const __m128 ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+        const __m128 cc = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+        const __m128 z = _mm_shuffle_ps(ab, cc, _MM_SHUFFLE(2, 0, 2, 0));
+
+        // ordered compares, so NaN is invalid too
+        const __m128 valid = _mm_and_ps(_mm_cmpge_ps(z, lo), _mm_cmplt_ps(z, hi));
+        const __m128 vz = _mm_and_ps(z, valid);
+        const __m128 ry = ray_y ? _mm_loadu_ps(ray_y + col) : slope;
+        _mm_stream_ps(points.x + i, _mm_mul_ps(vz, _mm_loadu_ps(ray_x + col)));
+        _mm_stream_ps(points.y + i, _mm_mul_ps(vz, ry));
+        _mm_stream_ps(points.z + i, vz);
+
+        const __m128i bgrx = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(color_bgrx + i)),
+                                           _mm_castps_si128(valid));
+        _mm_stream_ps(points.r + i, _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(bgrx, 16), byte_mask)));
+        _mm_stream_ps(points.g + i, _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(bgrx, 8), byte_mask)));
+        _mm_stream_ps(points.b + i, _mm_cvtepi32_ps(_mm_and_si128(bgrx, byte_mask)));
+
+        // lane mask to bool bytes
+        const __m128i flags = _mm_and_si128(_mm_castps_si128(valid), one);
+        const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(flags, flags), _mm_setzero_si128());
+        const int mask_bytes = _mm_cvtsi128_si32(bytes);
+        memcpy(points.mask + i, &mask_bytes, sizeof(mask_bytes));
+    }
+    _mm_sfence();
+    register_scalar(camera_xyz, color_bgrx, ray_x + (i - begin), ray_y ? ray_y + (i - begin) : NULL, row_slope,
+                    min_depth, max_depth, i, end - i, points);
+}
+
+
+/**
+ * @brief AVX2 registration, 8 pixels at once
+ */
+KERNEL_TARGET_AVX2 static void register_avx2(const float* camera_xyz, const unsigned int* color_bgrx,
+                          const float* ray_x, const float* ray_y, float row_slope,
+                          float min_depth, float max_depth,
+                          int begin, int count, FrameStore& points) {
+
+    const int head = unaligned_head(points, begin, count, 8);
+    register_scalar(camera_xyz, color_bgrx, ray_x, ray_y, row_slope, min_depth, max_depth, begin, head, points);
+
+    const __m256 lo = _mm256_set1_ps(min_depth);
+    const __m256 hi = _mm256_set1_ps(max_depth);
+    const __m256 slope = _mm256_set1_ps(row_slope);
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i one = _mm256_set1_epi32(1);
+    // Z of 8 interleaved points sits in lanes 2, 5 of the first load, 0, 3, 6
+    // of the second and 1, 4, 7 of the third: two blends and one permute
+    const __m256i z_order = _mm256_setr_epi32(2, 5, 0, 3, 6, 1, 4, 7);
+    const int end = begin + count;
+
+    int i = begin + head;
+    for (; i + 8 <= end; i += 8) {
+        const int col = i - begin;
+
+        const float* xyz = camera_xyz + 3 * i;
+        const __m256 a = _mm256_loadu_ps(xyz);
+        const __m256 b = _mm256_loadu_ps(xyz + 8);
+        const __m256 c = _mm256_loadu_ps(xyz + 16);
+        const __m256 abc = _mm256_blend_ps(_mm256_blend_ps(a, b, 0x49), c, 0x92);
+        const __m256 z = _mm256_permutevar8x32_ps(abc, z_order);
+
+        // ordered compares, so NaN is invalid too
+        const __m256 valid = _mm256_and_ps(_mm256_cmp_ps(z, lo, _CMP_GE_OQ), _mm256_cmp_ps(z, hi, _CMP_LT_OQ));
+        const __m256 vz = _mm256_and_ps(z, valid);
+        const __m256 ry = ray_y ? _mm256_loadu_ps(ray_y + col) : slope;
+        _mm256_stream_ps(points.x + i, _mm256_mul_ps(vz, _mm256_loadu_ps(ray_x + col)));
+        _mm256_stream_ps(points.y + i, _mm256_mul_ps(vz, ry));
+        _mm256_stream_ps(points.z + i, vz);
+
+        const __m256i bgrx = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(color_bgrx + i)),
+                                              _mm256_castps_si256(valid));
+        _mm256_stream_ps(points.r + i, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(bgrx, 16), byte_mask)));
+        _mm256_stream_ps(points.g + i, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(bgrx, 8), byte_mask)));
+        _mm256_stream_ps(points.b + i, _mm256_cvtepi32_ps(_mm256_and_si256(bgrx, byte_mask)));
+
+        // lane mask to bool bytes
+        const __m256i flags = _mm256_and_si256(_mm256_castps_si256(valid), one);
+        const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(flags), _mm256_extracti128_si256(flags, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(points.mask + i), _mm_packus_epi16(words, words));
+    }
+    _mm_sfence();
+    register_scalar(camera_xyz, color_bgrx, ray_x + (i - begin), ray_y ? ray_y + (i - begin) : NULL, row_slope,
+                    min_depth, max_depth, i, end - i, points);
+}
+
+
+/**
+ * @brief Returns the registration kernel for the given instruction set
+ */
+RegistrationKernel select_registration_kernel(KERNEL_ISA isa) {
+
+    switch (isa) {
+    case KERNEL_AVX2:
+        return register_avx2;
+    case KERNEL_SSE42:
+        return register_sse42;
+    default:
+        return register_scalar;
+    }
+}
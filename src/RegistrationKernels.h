@@ -0,0 +1,41 @@
+//============================================================================
+// Name        : RegistrationKernels.h
+// Copyright   : GWU Research
+// Description : Fused camera space to frame point registration kernels
+//============================================================================
+
+#pragma once
+
+#include "ClusteringKernels.h"
+#include "FrameStore.h"
+
+
+/**
+ * @brief Turns a range of mapped color pixels into frame points in one
+ *        pass: depth range check (which also rejects the infinite, unmapped
+ *        pixels), back-projection along the camera rays, BGRX to float color
+ *        and the mask. Invalid pixels are zeroed. The position and color
+ *        planes are written with non-temporal stores, the caller must not
+ *        read them back before the parallel region ends.
+ *
+ * @param camera_xyz  Camera space points (X, Y, Z per pixel), indexed by pixel
+ * @param color_bgrx  Color frame in RGBQUAD byte order, indexed by pixel
+ * @param ray_x       Horizontal ray slope of each pixel of the range
+ * @param ray_y       Vertical ray slope of each pixel of the range (NULL: row_slope)
+ * @param row_slope   Vertical ray slope of the whole range
+ * @param min_depth   Closest valid depth (meters)
+ * @param max_depth   Farthest valid depth (meters, exclusive)
+ * @param begin       First pixel
+ * @param count       Number of pixels
+ * @param points      Output frame
+ */
+typedef void (*RegistrationKernel)(const float* camera_xyz, const unsigned int* color_bgrx,
+                                   const float* ray_x, const float* ray_y, float row_slope,
+                                   float min_depth, float max_depth,
+                                   int begin, int count, FrameStore& points);
+
+
+/**
+ * @brief Returns the registration kernel for the given instruction set
+ */
+RegistrationKernel select_registration_kernel(KERNEL_ISA isa);
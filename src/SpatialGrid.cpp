@@ -0,0 +1,210 @@
+//============================================================================
+// Name        : SpatialGrid.cpp
+// Copyright   : GWU Research
+// Description : Uniform voxel grid over the valid 3D points of a frame
+//============================================================================
+
+#include "SpatialGrid.h"
+
+// C/C++
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+// Upper limit of the number of cells, the cell edge grows to fit it
+static const int kMAX_CELLS = 1 << 21;
+
+// Valid points per task of the bounding box pass
+static const int kGRID_BLOCK = 16384;
+
+
+/**
+ * @brief SpatialGrid constructor
+ *
+ * @param max_points  Maximum number of points (frame size)
+ * @param cell_size_  Cell edge (meters)
+ */
+SpatialGrid::SpatialGrid(int max_points, float cell_size_) :
+sorted_x(max_points),
+sorted_y(max_points),
+sorted_z(max_points),
+sorted_index(max_points),
+cell_size(cell_size_),
+grid_cell_size(cell_size_),
+inv_cell_size(1.0f / cell_size_),
+origin(0, 0, 0),
+dim_x(1), dim_y(1), dim_z(1),
+num_cells(1),
+num_points(0),
+cell_start(kMAX_CELLS + 1, 0),
+point_cell(max_points),
+cell_fill(new std::atomic<int>[kMAX_CELLS]) {
+}
+
+
+/**
+ * @brief Sorts the valid points of the frame into the grid
+ *
+ * @param points  Registered frame (valid_index must be built)
+ */
+void SpatialGrid::build(const FrameStore& points) {
+
+    const int* valid_index = points.valid_index;
+    num_points = points.num_valid;
+    if (num_points == 0) {
+        dim_x = dim_y = dim_z = num_cells = 1;
+        cell_start[0] = cell_start[1] = 0;
+        return;
+    }
+
+    // 1. bounding box, per block then merged
+    const int num_blocks = (num_points + kGRID_BLOCK - 1) / kGRID_BLOCK;
+    block_bounds.resize(num_blocks * 6);
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kGRID_BLOCK;
+        const int end = std::min(begin + kGRID_BLOCK, num_points);
+        float* bounds = &block_bounds[block * 6];
+        bounds[0] = bounds[1] = bounds[2] = FLT_MAX;
+        bounds[3] = bounds[4] = bounds[5] = -FLT_MAX;
+        for (int n = begin; n < end; n++) {
+            const int i = valid_index[n];
+            bounds[0] = std::min(bounds[0], points.x[i]);
+            bounds[1] = std::min(bounds[1], points.y[i]);
+            bounds[2] = std::min(bounds[2], points.z[i]);
+            bounds[3] = std::max(bounds[3], points.x[i]);
+            bounds[4] = std::max(bounds[4], points.y[i]);
+            bounds[5] = std::max(bounds[5], points.z[i]);
+        }
+    }
+    float min_x = FLT_MAX, min_y = FLT_MAX, min_z = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX, max_z = -FLT_MAX;
+    for (int block = 0; block < num_blocks; block++) {
+        const float* bounds = &block_bounds[block * 6];
+        min_x = std::min(min_x, bounds[0]);
+        min_y = std::min(min_y, bounds[1]);
+        min_z = std::min(min_z, bounds[2]);
+        max_x = std::max(max_x, bounds[3]);
+        max_y = std::max(max_y, bounds[4]);
+        max_z = std::max(max_z, bounds[5]);
+    }
+
+    // 2. grid layout, coarser cells when the box is too large
+    origin = vec3(min_x, min_y, min_z);
+    grid_cell_size = cell_size;
+    for (;;) {
+        dim_x = (int)((max_x - min_x) / grid_cell_size) + 1;
+        dim_y = (int)((max_y - min_y) / grid_cell_size) + 1;
+        dim_z = (int)((max_z - min_z) / grid_cell_size) + 1;
+        if ((double)dim_x * dim_y * dim_z <= kMAX_CELLS) {
+            break;
+        }
+        grid_cell_size *= 1.26f;    // ~2x fewer cells
+    }
+    inv_cell_size = 1.0f / grid_cell_size;
+    num_cells = dim_x * dim_y * dim_z;
+
+    // 3. counting sort: cell of each point and cell sizes
+    #pragma omp parallel for
+    for (int cell = 0; cell < num_cells; cell++) {
+        cell_fill[cell].store(0, std::memory_order_relaxed);
+    }
+    #pragma omp parallel for
+    for (int n = 0; n < num_points; n++) {
+        const int i = valid_index[n];
+        int cx, cy, cz;
+        cell_of(points.x[i], points.y[i], points.z[i], cx, cy, cz);
+        const int cell = (cz * dim_y + cy) * dim_x + cx;
+        point_cell[n] = cell;
+        cell_fill[cell].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 4. cell offsets
+    cell_start[0] = 0;
+    for (int cell = 0; cell < num_cells; cell++) {
+        const int count = cell_fill[cell].load(std::memory_order_relaxed);
+        cell_start[cell + 1] = cell_start[cell] + count;
+        cell_fill[cell].store(cell_start[cell], std::memory_order_relaxed);
+    }
+
+    // 5. scatter (the order inside a cell does not matter)
+    #pragma omp parallel for
+    for (int n = 0; n < num_points; n++) {
+        const int i = valid_index[n];
+        const int slot = cell_fill[point_cell[n]].fetch_add(1, std::memory_order_relaxed);
+        sorted_x[slot] = points.x[i];
+        sorted_y[slot] = points.y[i];
+        sorted_z[slot] = points.z[i];
+        sorted_index[slot] = i;
+    }
+}
+
+
+/**
+ * @brief Nearest valid point to a 3D position (ties go to the lowest
+ *        point index, as a linear scan would)
+ *
+ * @param query  3D position
+ *
+ * @returns Point index in the frame, -1 if the grid is empty
+ */
+int SpatialGrid::nearest(const vec3& query) const {
+
+    if (num_points == 0) {
+        return -1;
+    }
+
+    int qx, qy, qz;
+    cell_of(query.x, query.y, query.z, qx, qy, qz);
+
+    float best = FLT_MAX;
+    int best_index = -1;
+    const int max_ring = std::max(dim_x, std::max(dim_y, dim_z));
+    for (int ring = 0; ring <= max_ring; ring++) {
+
+        // every point of ring s is at least (s-1) cells away from the query
+        if (best_index >= 0 && ring > 1) {
+            const float reach = (ring - 1) * grid_cell_size;
+            if (reach * reach > best) {
+                break;
+            }
+        }
+
+        for (int dz = -ring; dz <= ring; dz++) {
+            const int cz = qz + dz;
+            if (cz < 0 || cz >= dim_z) {
+                continue;
+            }
+            for (int dy = -ring; dy <= ring; dy++) {
+                const int cy = qy + dy;
+                if (cy < 0 || cy >= dim_y) {
+                    continue;
+                }
+                // inner rows of the shell only have the two end cells
+                const bool full_row = (dz == -ring || dz == ring || dy == -ring || dy == ring);
+                const int step = (full_row || ring == 0) ? 1 : 2 * ring;
+                for (int dx = -ring; dx <= ring; dx += step) {
+                    const int cx = qx + dx;
+                    if (cx < 0 || cx >= dim_x) {
+                        continue;
+                    }
+
+                    int begin, end;
+                    cell_range(cx, cy, cz, begin, end);
+                    for (int n = begin; n < end; n++) {
+                        const float ex = sorted_x[n] - query.x;
+                        const float ey = sorted_y[n] - query.y;
+                        const float ez = sorted_z[n] - query.z;
+                        const float dist = ex*ex + ey*ey + ez*ez;
+                        if (dist < best || (dist == best && sorted_index[n] < best_index)) {
+                            best = dist;
+                            best_index = sorted_index[n];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return best_index;
+}
@@ -0,0 +1,100 @@
+//============================================================================
+// Name        : SpatialGrid.h
+// Copyright   : GWU Research
+// Description : Uniform voxel grid over the valid 3D points of a frame
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+#include "vec3.h"
+
+// C/C++
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+// Uniform grid over the bounding box of the valid points. The points are
+// counting-sorted by cell, so each cell is a contiguous run of the sorted
+// arrays and a nearest neighbor query only visits the cells around the query.
+class SpatialGrid {
+
+public:
+
+    /**
+     * @brief SpatialGrid constructor
+     *
+     * @param max_points  Maximum number of points (frame size)
+     * @param cell_size_  Cell edge (meters)
+     */
+    SpatialGrid(int max_points, float cell_size_ = 0.05f);
+
+
+    /**
+     * @brief Sorts the valid points of the frame into the grid
+     *
+     * @param points  Registered frame (valid_index must be built)
+     */
+    void build(const FrameStore& points);
+
+
+    /**
+     * @brief Nearest valid point to a 3D position (ties go to the lowest
+     *        point index, as a linear scan would)
+     *
+     * @param query  3D position
+     *
+     * @returns Point index in the frame, -1 if the grid is empty
+     */
+    int nearest(const vec3& query) const;
+
+
+    /**
+     * @brief Cell of a 3D position, clamped to the grid
+     */
+    inline void cell_of(float x, float y, float z, int& cx, int& cy, int& cz) const {
+        cx = clamp_cell((x - origin.x) * inv_cell_size, dim_x);
+        cy = clamp_cell((y - origin.y) * inv_cell_size, dim_y);
+        cz = clamp_cell((z - origin.z) * inv_cell_size, dim_z);
+    }
+
+
+    /**
+     * @brief Range of the sorted arrays holding the points of a cell
+     */
+    inline void cell_range(int cx, int cy, int cz, int& begin, int& end) const {
+        const int cell = (cz * dim_y + cy) * dim_x + cx;
+        begin = cell_start[cell];
+        end = cell_start[cell + 1];
+    }
+
+
+    inline bool  empty() const { return num_points == 0; }
+    inline float get_cell_size() const { return cell_size; }
+
+    std::vector<float>  sorted_x;       // Point positions in cell order
+    std::vector<float>  sorted_y;
+    std::vector<float>  sorted_z;
+    std::vector<int>    sorted_index;   // Point index (frame) in cell order
+
+private:
+
+    static inline int clamp_cell(float c, int dim) {
+        const int cell = (int)c;
+        return (c < 0) ? 0 : ((cell >= dim) ? dim - 1 : cell);
+    }
+
+    float   cell_size;          // Requested cell edge
+    float   grid_cell_size;     // Cell edge of the current frame (grown to fit kMAX_CELLS)
+    float   inv_cell_size;
+    vec3    origin;             // Minimum corner of the grid
+    int     dim_x, dim_y, dim_z;
+    int     num_cells;
+    int     num_points;
+
+    std::vector<int>                cell_start;     // First sorted point of each cell (+ end)
+    std::vector<int>                point_cell;     // Cell of each valid point
+    std::unique_ptr<std::atomic<int>[]> cell_fill;  // Scatter cursor of each cell
+    std::vector<float>              block_bounds;   // Per-block min/max of the bounding box pass
+};
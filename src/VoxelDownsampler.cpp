@@ -0,0 +1,328 @@
+//============================================================================
+// Name        : VoxelDownsampler.cpp
+// Copyright   : GWU Research
+// Description : Voxel grid downsampling of the registered frame
+//============================================================================
+
+#include "VoxelDownsampler.h"
+
+// C/C++
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+
+// Key of an empty hash slot (voxel keys only use 63 bits)
+static const unsigned long long kEMPTY_KEY = ~0ull;
+
+// Bits per voxel coordinate in the key, coordinates are offset by half the range
+static const int kKEY_BITS = 21;
+static const int kKEY_OFFSET = 1 << (kKEY_BITS - 1);
+static const unsigned long long kKEY_MASK = (1ull << kKEY_BITS) - 1;
+
+// Valid points per task of the voxel id scan
+static const int kVOXEL_BLOCK = 16384;
+
+
+/**
+ * @brief Packs the voxel coordinates of a position into a 63 bit key
+ */
+static inline unsigned long long voxel_key(float x, float y, float z, float inv_size) {
+
+    const unsigned long long vx = (unsigned long long)((int)floorf(x * inv_size) + kKEY_OFFSET) & kKEY_MASK;
+    const unsigned long long vy = (unsigned long long)((int)floorf(y * inv_size) + kKEY_OFFSET) & kKEY_MASK;
+    const unsigned long long vz = (unsigned long long)((int)floorf(z * inv_size) + kKEY_OFFSET) & kKEY_MASK;
+    return vx | (vy << kKEY_BITS) | (vz << (2 * kKEY_BITS));
+}
+
+
+/**
+ * @brief Slot of a key in the hash table, claims an empty slot with a CAS
+ *        when the key is not there yet (linear probing)
+ */
+static inline int find_or_insert(std::atomic<unsigned long long>* table, int table_bits, unsigned long long key) {
+
+    const int table_mask = (1 << table_bits) - 1;
+    int slot = (int)((key * 0x9E3779B97F4A7C15ull) >> (64 - table_bits));
+    for (;;) {
+        unsigned long long current = table[slot].load(std::memory_order_acquire);
+        if (current == kEMPTY_KEY &&
+            table[slot].compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+            return slot;
+        }
+        // a failed claim leaves the key of the winner in current
+        if (current == key) {
+            return slot;
+        }
+        slot = (slot + 1) & table_mask;
+    }
+}
+
+
+/**
+ * @brief VoxelDownsampler constructor
+ *
+ * @param voxel_size_  Voxel edge (meters)
+ */
+VoxelDownsampler::VoxelDownsampler(float voxel_size_) :
+voxel_size(voxel_size_),
+voxels(NULL),
+num_voxels(0),
+table_bits(0),
+point_capacity(0) {
+}
+
+
+/**
+ * @brief Releases the voxel cloud
+ */
+VoxelDownsampler::~VoxelDownsampler() {
+
+    if (voxels) {
+        delete voxels;
+        voxels = NULL;
+    }
+}
+
+
+/**
+ * @brief Grows the hash table to at least twice the number of points
+ */
+void VoxelDownsampler::reserve_table(int num_points) {
+
+    if (num_points <= point_capacity) {
+        return;
+    }
+    point_capacity = num_points;
+    table_bits = 1;
+    while ((1 << table_bits) < 2 * num_points) {
+        table_bits++;
+    }
+    table_key.reset(new std::atomic<unsigned long long>[(size_t)1 << table_bits]);
+    table_first.reset(new std::atomic<int>[(size_t)1 << table_bits]);
+    voxel_fill.reset(new std::atomic<int>[num_points]);
+}
+
+
+/**
+ * @brief Hashes the valid points of the frame into voxels and fills the
+ *        voxel cloud (voxel ids follow the first pixel of each voxel)
+ *
+ * @param points          Registered frame (valid_index must be built)
+ * @param num_membership  Membership planes of the voxel cloud (clusters)
+ */
+void VoxelDownsampler::build(const FrameStore& points, int num_membership) {
+
+    const int num_valid = points.num_valid;
+    const int* valid_index = points.valid_index;
+    num_voxels = 0;
+    if (num_valid == 0) {
+        if (voxels) {
+            voxels->num_valid = 0;
+        }
+        return;
+    }
+
+    reserve_table(num_valid);
+    const int table_size = 1 << table_bits;
+    const float inv_size = 1.0f / voxel_size;
+
+    // 1. empty table
+    #pragma omp parallel for
+    for (int slot = 0; slot < table_size; slot++) {
+        table_key[slot].store(kEMPTY_KEY, std::memory_order_relaxed);
+        table_first[slot].store(INT_MAX, std::memory_order_relaxed);
+    }
+
+    // 2. parallel insert, each slot also keeps its lowest valid point. Neighbor
+    //    pixels mostly share a voxel, so a run of equal keys probes the table once.
+    const int num_blocks = (num_valid + kVOXEL_BLOCK - 1) / kVOXEL_BLOCK;
+    point_slot.resize(num_valid);
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kVOXEL_BLOCK;
+        const int end = std::min(begin + kVOXEL_BLOCK, num_valid);
+        unsigned long long last_key = kEMPTY_KEY;
+        int last_slot = 0;
+        for (int n = begin; n < end; n++) {
+            const int i = valid_index[n];
+            const unsigned long long key = voxel_key(points.x[i], points.y[i], points.z[i], inv_size);
+            if (key != last_key) {
+                last_key = key;
+                last_slot = find_or_insert(table_key.get(), table_bits, key);
+                int first = table_first[last_slot].load(std::memory_order_relaxed);
+                while (n < first && !table_first[last_slot].compare_exchange_weak(first, n, std::memory_order_relaxed)) {
+                }
+            }
+            point_slot[n] = last_slot;
+        }
+    }
+
+    // 3. voxel ids: the first point of each voxel, numbered in valid list order
+    //    (point_slot now holds the first point of the voxel of each point)
+    block_count.resize(num_blocks + 1);
+    point_voxel.resize(num_valid);
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kVOXEL_BLOCK;
+        const int end = std::min(begin + kVOXEL_BLOCK, num_valid);
+        int count = 0;
+        int last_slot = -1, last_first = 0;
+        for (int n = begin; n < end; n++) {
+            if (point_slot[n] != last_slot) {
+                last_slot = point_slot[n];
+                last_first = table_first[last_slot].load(std::memory_order_relaxed);
+            }
+            point_slot[n] = last_first;
+            count += (last_first == n);
+        }
+        block_count[block + 1] = count;
+    }
+    block_count[0] = 0;
+    for (int block = 0; block < num_blocks; block++) {
+        block_count[block + 1] += block_count[block];
+    }
+    num_voxels = block_count[num_blocks];
+
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kVOXEL_BLOCK;
+        const int end = std::min(begin + kVOXEL_BLOCK, num_valid);
+        int id = block_count[block];
+        for (int n = begin; n < end; n++) {
+            if (point_slot[n] == n) {
+                point_voxel[n] = id++;
+            }
+        }
+    }
+    #pragma omp parallel for
+    for (int n = 0; n < num_valid; n++) {
+        const int first = point_slot[n];
+        if (first != n) {
+            point_voxel[n] = point_voxel[first];
+        }
+    }
+
+    // 4. counting sort of the points by voxel
+    #pragma omp parallel for
+    for (int v = 0; v < num_voxels; v++) {
+        voxel_fill[v].store(0, std::memory_order_relaxed);
+    }
+    // runs of equal voxels take one atomic add
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kVOXEL_BLOCK;
+        const int end = std::min(begin + kVOXEL_BLOCK, num_valid);
+        for (int n = begin; n < end;) {
+            const int v = point_voxel[n];
+            int run = n + 1;
+            while (run < end && point_voxel[run] == v) {
+                run++;
+            }
+            voxel_fill[v].fetch_add(run - n, std::memory_order_relaxed);
+            n = run;
+        }
+    }
+    voxel_start.resize(num_voxels + 1);
+    voxel_start[0] = 0;
+    for (int v = 0; v < num_voxels; v++) {
+        const int count = voxel_fill[v].load(std::memory_order_relaxed);
+        voxel_start[v + 1] = voxel_start[v] + count;
+        voxel_fill[v].store(voxel_start[v], std::memory_order_relaxed);
+    }
+    voxel_points.resize(num_valid);
+    #pragma omp parallel for
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * kVOXEL_BLOCK;
+        const int end = std::min(begin + kVOXEL_BLOCK, num_valid);
+        for (int n = begin; n < end;) {
+            const int v = point_voxel[n];
+            int run = n + 1;
+            while (run < end && point_voxel[run] == v) {
+                run++;
+            }
+            int slot = voxel_fill[v].fetch_add(run - n, std::memory_order_relaxed);
+            for (; n < run; n++) {
+                voxel_points[slot++] = n;
+            }
+        }
+    }
+
+    // 5. voxel cloud, grown by half when too small
+    if (voxels == NULL || voxels->size < num_voxels) {
+        delete voxels;
+        voxels = new FrameStore(num_voxels + num_voxels / 2, 1, num_membership);
+        voxels->enable_weight();
+    }
+    voxels->set_num_membership(num_membership);
+    FrameStore& cloud = *voxels;
+
+    // 6. mean position, color and normal of each voxel
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int v = 0; v < num_voxels; v++) {
+        double x = 0, y = 0, z = 0, r = 0, g = 0, b = 0;
+        float nx = 0, ny = 0, nz = 0;
+        for (int e = voxel_start[v]; e < voxel_start[v + 1]; e++) {
+            const int i = valid_index[voxel_points[e]];
+            x += points.x[i];
+            y += points.y[i];
+            z += points.z[i];
+            r += points.r[i];
+            g += points.g[i];
+            b += points.b[i];
+            nx += points.nx[i];
+            ny += points.ny[i];
+            nz += points.nz[i];
+        }
+        const int count = voxel_start[v + 1] - voxel_start[v];
+        cloud.x[v] = (float)(x / count);
+        cloud.y[v] = (float)(y / count);
+        cloud.z[v] = (float)(z / count);
+        cloud.r[v] = (float)(r / count);
+        cloud.g[v] = (float)(g / count);
+        cloud.b[v] = (float)(b / count);
+
+        // pixels without a normal add nothing, no normal at all stays zero
+        const float length = sqrtf(nx*nx + ny*ny + nz*nz);
+        cloud.nx[v] = (length > 0) ? nx / length : 0;
+        cloud.ny[v] = (length > 0) ? ny / length : 0;
+        cloud.nz[v] = (length > 0) ? nz / length : 0;
+
+        cloud.weight[v] = (float)count;
+        cloud.mask[v] = true;
+        cloud.valid_index[v] = v;
+    }
+    memset(cloud.mask + num_voxels, 0, (cloud.size - num_voxels) * sizeof(bool));
+    cloud.num_valid = num_voxels;
+}
+
+
+/**
+ * @brief Gives every valid pixel the label (and optionally the
+ *        memberships) of its voxel
+ *
+ * @param points       Frame the voxels were built from
+ * @param memberships  Copy the membership planes as well
+ */
+void VoxelDownsampler::scatter_labels(FrameStore& points, bool memberships) const {
+
+    if (num_voxels == 0) {
+        return;
+    }
+    const FrameStore& cloud = *voxels;
+    const int* valid_index = points.valid_index;
+    const int num_planes = memberships ? std::min(points.num_membership, cloud.num_membership) : 0;
+    const size_t plane = points.size;
+    const size_t cloud_plane = cloud.size;
+
+    #pragma omp parallel for
+    for (int n = 0; n < points.num_valid; n++) {
+        const int i = valid_index[n];
+        const int v = point_voxel[n];
+        points.label[i] = cloud.label[v];
+        for (int j = 0; j < num_planes; j++) {
+            points.membership[j * plane + i] = cloud.membership[j * cloud_plane + v];
+        }
+    }
+}
@@ -0,0 +1,95 @@
+//============================================================================
+// Name        : VoxelDownsampler.h
+// Copyright   : GWU Research
+// Description : Voxel grid downsampling of the registered frame
+//============================================================================
+
+#pragma once
+
+#include "FrameStore.h"
+
+// C/C++
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+// Voxel grid downsampling. The valid points of a frame are hashed into a
+// sparse voxel grid (parallel open addressing hash), every occupied voxel
+// becomes one point with the mean position, color and normal of its pixels
+// and their count as weight, and the labels of the voxels are scattered
+// back to the pixels through the pixel-to-voxel map.
+class VoxelDownsampler {
+
+public:
+
+    /**
+     * @brief VoxelDownsampler constructor
+     *
+     * @param voxel_size_  Voxel edge (meters)
+     */
+    VoxelDownsampler(float voxel_size_ = 0.005f);
+
+
+    /**
+     * @brief Releases the voxel cloud
+     */
+    ~VoxelDownsampler();
+
+
+    /**
+     * @brief Hashes the valid points of the frame into voxels and fills the
+     *        voxel cloud (voxel ids follow the first pixel of each voxel)
+     *
+     * @param points          Registered frame (valid_index must be built)
+     * @param num_membership  Membership planes of the voxel cloud (clusters)
+     */
+    void build(const FrameStore& points, int num_membership);
+
+
+    /**
+     * @brief Gives every valid pixel the label (and optionally the
+     *        memberships) of its voxel
+     *
+     * @param points       Frame the voxels were built from
+     * @param memberships  Copy the membership planes as well
+     */
+    void scatter_labels(FrameStore& points, bool memberships) const;
+
+
+    /**
+     * @brief Voxel cloud of the last frame (NULL before the first build)
+     */
+    inline FrameStore* get_voxels() { return voxels; }
+
+
+    inline int   get_num_voxels() const { return num_voxels; }
+    inline void  set_voxel_size(float voxel_size_) { voxel_size = voxel_size_; }
+    inline float get_voxel_size() const { return voxel_size; }
+
+private:
+
+    /**
+     * @brief Grows the hash table to at least twice the number of points
+     */
+    void reserve_table(int num_points);
+
+
+    float       voxel_size;
+    FrameStore* voxels;             // One point per occupied voxel, weight = pixels in the voxel
+    int         num_voxels;
+
+    int                                         table_bits;     // log2 of the table size
+    int                                         point_capacity; // Points the table is sized for
+    std::unique_ptr<std::atomic<unsigned long long>[]> table_key; // Voxel key of each slot
+    std::unique_ptr<std::atomic<int>[]>         table_first;    // First valid point of each slot
+    std::unique_ptr<std::atomic<int>[]>         voxel_fill;     // Scatter cursor of each voxel
+    std::vector<int>    point_slot;     // Table slot of each valid point
+    std::vector<int>    point_voxel;    // Voxel of each valid point (pixel-to-voxel map)
+    std::vector<int>    block_count;    // Per-block voxel counts of the id scan
+    std::vector<int>    voxel_start;    // First entry of each voxel in voxel_points (+ end)
+    std::vector<int>    voxel_points;   // Valid point positions grouped by voxel
+
+    VoxelDownsampler(const VoxelDownsampler&);
+    VoxelDownsampler& operator=(const VoxelDownsampler&);
+};
@@ -0,0 +1,1346 @@
+//============================================================================
+// Name        : PipelineTests.cpp
+// Copyright   : GWU Research
+// Description : Console checks of the portable frame pipeline modules
+//============================================================================
+
+#include "../CenterSeeding.h"
+#include "../ClusterColoring.h"
+#include "../Clustering.h"
+#include "../ClusteringKernels.h"
+#include "../DepthRegistration.h"
+#include "../FrameStore.h"
+#include "../NormalEstimator.h"
+#include "../ObjectExtractor.h"
+#include "../RegistrationKernels.h"
+#include "../SpatialGrid.h"
+#include "../VoxelDownsampler.h"
+
+// C/C++
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+#include <omp.h>
+
+
+// Number of failed checks of the run
+static int failures = 0;
+
+// Reports a failed check, the run goes on with the next one
+#define CHECK(condition, ...)                                           \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            failures++;                                                 \
+            printf("[Fail][%s] ", __FUNCTION__);                        \
+            printf(__VA_ARGS__);                                        \
+            printf("\n");                                               \
+        }                                                               \
+    } while (0)
+
+
+typedef std::chrono::steady_clock TestClock;
+
+static double elapsed_ms(const TestClock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(TestClock::now() - start).count();
+}
+
+
+static const char* isa_name(KERNEL_ISA isa) {
+
+    switch (isa) {
+    case KERNEL_AVX2:
+        return "AVX2";
+    case KERNEL_SSE42:
+        return "SSE4.2";
+    default:
+        return "scalar";
+    }
+}
+
+
+/**
+ * @brief Fills a frame with num_blobs noisy blobs side by side (position,
+ *        color and a normal per blob), the last column is left invalid
+ *
+ * @param points     Frame to fill
+ * @param num_blobs  Number of blobs
+ * @param seed       Seed of the noise
+ */
+static void fill_blobs(FrameStore& points, int num_blobs, unsigned int seed) {
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    const int band = (points.width + num_blobs - 1) / num_blobs;
+    for (int v = 0; v < points.height; v++) {
+        for (int u = 0; u < points.width; u++) {
+            const int i = v * points.width + u;
+            const int blob = u / band;
+            points.x[i] = 0.4f * blob + 0.03f * noise(rng);
+            points.y[i] = 0.002f * (v - points.height / 2) + 0.03f * noise(rng);
+            points.z[i] = 1.0f + 0.25f * (blob % 3) + 0.03f * noise(rng);
+            points.r[i] = (float)((60 * blob) % 256) + 8 * noise(rng);
+            points.g[i] = (float)((150 + 90 * blob) % 256) + 8 * noise(rng);
+            points.b[i] = (float)((40 * blob * blob) % 256) + 8 * noise(rng);
+            const float tilt = 0.3f * (blob % 2);
+            points.nx[i] = tilt;
+            points.ny[i] = 0;
+            points.nz[i] = -sqrtf(1 - tilt * tilt);
+            points.mask[i] = u + 1 < points.width;
+        }
+    }
+    points.build_valid_index();
+}
+
+
+/**
+ * @brief Centers at num_clusters points of the frame (spread over the
+ *        valid list)
+ */
+static KernelCenters pick_centers(const FrameStore& points, int num_clusters) {
+
+    KernelCenters centers(num_clusters);
+    for (int j = 0; j < num_clusters; j++) {
+        const int i = points.valid_index[(int)((j + 0.5) * points.num_valid / num_clusters)];
+        centers.px[j] = points.x[i]; centers.py[j] = points.y[i]; centers.pz[j] = points.z[i];
+        centers.cr[j] = points.r[i]; centers.cg[j] = points.g[i]; centers.cb[j] = points.b[i];
+        centers.nx[j] = points.nx[i]; centers.ny[j] = points.ny[i]; centers.nz[j] = points.nz[i];
+    }
+    return centers;
+}
+
+
+/**
+ * @brief Every non-empty cluster center is the mean of the listed points
+ *        with its label (what the centroid update leaves behind)
+ *
+ * @param clustering  Clustering of the last frame
+ * @param points      Clustered frame
+ * @param index       Points summed by the last frame
+ * @param what        Name of the run in the failure messages
+ */
+static void check_centers_are_label_means(const Clustering& clustering, const FrameStore& points,
+                                          const std::vector<int>& index, const char* what) {
+
+    const int k = clustering.get_num_clusters();
+    std::vector<double> sx(k, 0.0), sy(k, 0.0), sz(k, 0.0);
+    std::vector<int> count(k, 0);
+    for (size_t n = 0; n < index.size(); n++) {
+        const int i = index[n];
+        const int j = points.label[i];
+        sx[j] += points.x[i];
+        sy[j] += points.y[i];
+        sz[j] += points.z[i];
+        count[j]++;
+    }
+    const vec3* centers = clustering.get_centers();
+    for (int j = 0; j < k; j++) {
+        if (count[j] == 0) {
+            continue;
+        }
+        const double dx = centers[j].x - sx[j] / count[j];
+        const double dy = centers[j].y - sy[j] / count[j];
+        const double dz = centers[j].z - sz[j] / count[j];
+        const double error = sqrt(dx * dx + dy * dy + dz * dz);
+        CHECK(error < 1e-3, "%s: center %d is %.4f m away from the mean of its %d points (z %.3f, mean z %.3f)",
+              what, j, error, count[j], centers[j].z, sz[j] / count[j]);
+    }
+}
+
+
+// Point of the array-of-structs frame the assignment used to walk (the old
+// Image_buffer layout)
+struct LegacyPoint {
+    vec3 Pos3D;
+    vec3 color;
+    vec3 normal;
+    float Label_c[4];
+    int Label;
+    vec3 color_buffer;
+};
+
+
+/**
+ * @brief The assignment pass over the structure-of-arrays frame gives the
+ *        labels of the array-of-structs loop it replaced, and both are timed
+ *        on a full HD frame with the default weights
+ */
+static void test_frame_layout() {
+
+    const int k = 4;
+    FrameStore points(1920, 1080, k);
+    fill_blobs(points, k, 7);
+    KernelParams params;
+    params.position_weight2 = 0.99f * 0.99f;
+    params.color_weight2 = 0.0033f * 0.0033f;
+    params.normal_weight = 0.0001f;
+    const KernelCenters centers = pick_centers(points, k);
+
+    std::vector<LegacyPoint> legacy(points.size);
+    for (int i = 0; i < points.size; i++) {
+        legacy[i].Pos3D = vec3(points.x[i], points.y[i], points.z[i]);
+        legacy[i].color = vec3(points.r[i], points.g[i], points.b[i]);
+        legacy[i].normal = vec3(points.nx[i], points.ny[i], points.nz[i]);
+        for (int j = 0; j < 4; j++) {
+            legacy[i].Label_c[j] = 0;
+        }
+        legacy[i].Label = 0;
+    }
+
+    const int repeats = 3;
+    TestClock::time_point start = TestClock::now();
+    for (int n = 0; n < repeats; n++) {
+        for (int m = 0; m < points.num_valid; m++) {
+            LegacyPoint& point = legacy[points.valid_index[m]];
+            float best = 100000.0f;
+            int best_label = 0;
+            for (int j = 0; j < k; j++) {
+                const float dx = point.Pos3D.x - centers.px[j];
+                const float dy = point.Pos3D.y - centers.py[j];
+                const float dz = point.Pos3D.z - centers.pz[j];
+                const float dr = point.color.x - centers.cr[j];
+                const float dg = point.color.y - centers.cg[j];
+                const float db = point.color.z - centers.cb[j];
+                float dist = sqrtf(params.position_weight2 * (dx*dx + dy*dy + dz*dz) +
+                                   params.color_weight2 * (dr*dr + dg*dg + db*db));
+                const vec3& normal = point.normal;
+                if (!((normal.x == 0) && (normal.y == 0) && (normal.z == 0))) {
+                    dist += params.normal_weight *
+                            (1 - (normal.x*centers.nx[j] + normal.y*centers.ny[j] + normal.z*centers.nz[j]));
+                }
+                if (dist < best) {
+                    best = dist;
+                    best_label = j;
+                }
+            }
+            point.Label = best_label;
+            point.Label_c[best_label] += 1.0f;
+            for (int j = 0; j < k; j++) {
+                point.Label_c[j] /= 2.0f;
+            }
+        }
+    }
+    const double legacy_ms = elapsed_ms(start) / repeats;
+
+    const KERNEL_ISA best = detect_kernel_isa();
+    for (int isa = KERNEL_SCALAR; isa <= best; isa++) {
+        const AssignKernel kernel = select_assign_kernel((KERNEL_ISA)isa, k);
+        start = TestClock::now();
+        for (int n = 0; n < repeats; n++) {
+            kernel(points, centers, params, points.valid_index, points.num_valid, points.label, NULL, NULL);
+        }
+        const double soa_ms = elapsed_ms(start) / repeats;
+        printf("assignment, k = %d, 1920x1080: array of structs %.2f ms, %s structure of arrays %.2f ms (%.1fx)\n",
+               k, legacy_ms, isa_name((KERNEL_ISA)isa), soa_ms, legacy_ms / soa_ms);
+
+        if (isa == KERNEL_SCALAR) {
+            int mismatches = 0;
+            for (int m = 0; m < points.num_valid; m++) {
+                const int i = points.valid_index[m];
+                mismatches += points.label[i] != legacy[i].Label;
+            }
+            CHECK(mismatches == 0, "%d of %d points differ from the array-of-structs loop",
+                  mismatches, points.num_valid);
+        }
+    }
+}
+
+
+/**
+ * @brief Per-frame time of the valid index and of a k-means frame against
+ *        the fraction of valid points of a full HD frame
+ */
+static void test_valid_density_sweep() {
+
+    const int k = 4;
+    FrameStore points(1920, 1080, k);
+    fill_blobs(points, k, 9);
+    Clustering clustering(k);
+    clustering.set_frame(&points);
+    clustering.update();    // Seeds the centers, not timed
+    std::mt19937 rng(900);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    const float densities[] = { 0.1f, 0.25f, 0.5f, 0.75f, 1.0f };
+    for (int n = 0; n < (int)(sizeof(densities) / sizeof(densities[0])); n++) {
+        for (int i = 0; i < points.size; i++) {
+            points.mask[i] = uniform(rng) < densities[n];
+        }
+        const int num_frames = 3;
+        double index_ms = 0, frame_ms = 0;
+        for (int frame = 0; frame < num_frames; frame++) {
+            const TestClock::time_point start = TestClock::now();
+            points.build_valid_index();
+            index_ms += elapsed_ms(start);
+            clustering.update();
+            frame_ms += clustering.get_telemetry().time_ms;
+        }
+        printf("%3.0f%% valid (%d points): valid index %.2f ms, k-means %.2f ms/frame\n", 100 * densities[n],
+               points.num_valid, index_ms / num_frames, frame_ms / num_frames);
+
+        int expected = 0;
+        for (int i = 0; i < points.size; i++) {
+            expected += points.mask[i];
+        }
+        CHECK(points.num_valid == expected, "%.0f%% valid: %d indices for %d valid points",
+              100 * densities[n], points.num_valid, expected);
+    }
+}
+
+
+/**
+ * @brief The SIMD assignment and fuzzy kernels agree with the scalar ones
+ *        for every specialized k and for the generic kernel. Labels may
+ *        only differ on near ties (rounding of the distance sums).
+ */
+static void test_kernel_isa_agreement() {
+
+    FrameStore points(203, 61, 20);
+    fill_blobs(points, 7, 1);
+    KernelParams params;
+    params.position_weight2 = 0.99f * 0.99f;
+    params.color_weight2 = 0.0033f * 0.0033f;
+    params.normal_weight = 0.0001f;
+    const int num_valid = points.num_valid;
+    const KERNEL_ISA best = detect_kernel_isa();
+    printf("kernel ISA: %s\n", isa_name(best));
+
+    const int ks[] = { 2, 3, 4, 5, 7, 8, 9, 16, 20 };
+    for (int n = 0; n < (int)(sizeof(ks) / sizeof(ks[0])); n++) {
+        const int k = ks[n];
+        const KernelCenters centers = pick_centers(points, k);
+
+        std::vector<int> scalar_label(points.size, -1);
+        std::vector<float> scalar_dist(points.size), scalar_second(points.size);
+        select_assign_kernel(KERNEL_SCALAR, k)(points, centers, params, points.valid_index, num_valid,
+                                               &scalar_label[0], &scalar_dist[0], &scalar_second[0]);
+
+        for (int isa = KERNEL_SSE42; isa <= best; isa++) {
+            std::vector<int> label(points.size, -1);
+            std::vector<float> dist(points.size), second(points.size);
+            select_assign_kernel((KERNEL_ISA)isa, k)(points, centers, params, points.valid_index, num_valid,
+                                                     &label[0], &dist[0], &second[0]);
+            int mismatches = 0;
+            for (int m = 0; m < num_valid; m++) {
+                const int i = points.valid_index[m];
+                const bool tie = fabsf(scalar_second[i] - scalar_dist[i]) <= 1e-5f * scalar_dist[i];
+                if ((label[i] != scalar_label[i] && !tie) ||
+                    fabsf(dist[i] - scalar_dist[i]) > 1e-5f * scalar_dist[i] + 1e-6f ||
+                    fabsf(second[i] - scalar_second[i]) > 1e-5f * scalar_second[i] + 1e-6f) {
+                    mismatches++;
+                }
+            }
+            CHECK(mismatches == 0, "%s assignment, k = %d: %d of %d points differ from the scalar kernel",
+                  isa_name((KERNEL_ISA)isa), k, mismatches, num_valid);
+        }
+
+        std::vector<float> scalar_membership((size_t)points.size * k);
+        std::vector<float> scalar_objective(points.size);
+        select_fuzzy_kernel(KERNEL_SCALAR)(points, centers, params, 2.0f, points.valid_index, num_valid,
+                                           &scalar_membership[0], &scalar_label[0], &scalar_objective[0]);
+        for (int isa = KERNEL_SSE42; isa <= best; isa++) {
+            std::vector<float> membership((size_t)points.size * k);
+            std::vector<float> objective(points.size);
+            std::vector<int> label(points.size, -1);
+            select_fuzzy_kernel((KERNEL_ISA)isa)(points, centers, params, 2.0f, points.valid_index, num_valid,
+                                                 &membership[0], &label[0], &objective[0]);
+            float worst = 0;
+            for (int m = 0; m < num_valid; m++) {
+                const int i = points.valid_index[m];
+                for (int j = 0; j < k; j++) {
+                    const size_t at = (size_t)j * points.size + i;
+                    worst = std::max(worst, fabsf(membership[at] - scalar_membership[at]));
+                }
+            }
+            CHECK(worst < 1e-4f, "%s fuzzy, k = %d: memberships differ by %g from the scalar kernel",
+                  isa_name((KERNEL_ISA)isa), k, worst);
+        }
+    }
+}
+
+
+/**
+ * @brief Sweeps k and times the compile-time specialized assignment kernels
+ *        against the generic one (select_assign_kernel(isa, 0)) with the
+ *        default weights, then with fWeight = 0 (squared distances); both
+ *        instances must give the same labels
+ */
+static void test_kernel_k_sweep() {
+
+    FrameStore points(640, 480, 20);
+    fill_blobs(points, 7, 3);
+    const KERNEL_ISA best = detect_kernel_isa();
+    const float normal_weights[] = { 0.0001f, 0.0f };
+    const int ks[] = { 2, 3, 4, 6, 8, 12, 16, 20 };
+    const int repeats = 5;
+
+    for (int w = 0; w < 2; w++) {
+        KernelParams params;
+        params.position_weight2 = 0.99f * 0.99f;
+        params.color_weight2 = 0.0033f * 0.0033f;
+        params.normal_weight = normal_weights[w];
+
+        for (int n = 0; n < (int)(sizeof(ks) / sizeof(ks[0])); n++) {
+            const int k = ks[n];
+            const KernelCenters centers = pick_centers(points, k);
+            std::vector<int> generic_label(points.size, -1), label(points.size, -1);
+
+            const AssignKernel generic = select_assign_kernel(best, 0);
+            TestClock::time_point start = TestClock::now();
+            for (int r = 0; r < repeats; r++) {
+                generic(points, centers, params, points.valid_index, points.num_valid, &generic_label[0], NULL, NULL);
+            }
+            const double generic_ms = elapsed_ms(start) / repeats;
+
+            const AssignKernel specialized = select_assign_kernel(best, k);
+            start = TestClock::now();
+            for (int r = 0; r < repeats; r++) {
+                specialized(points, centers, params, points.valid_index, points.num_valid, &label[0], NULL, NULL);
+            }
+            const double specialized_ms = elapsed_ms(start) / repeats;
+
+            if (k <= kMAX_SPECIALIZED_K) {
+                printf("%s assignment, fWeight %g, k = %d: specialized %.2f ms, generic %.2f ms\n",
+                       isa_name(best), params.normal_weight, k, specialized_ms, generic_ms);
+            }
+            else {
+                printf("%s assignment, fWeight %g, k = %d: generic %.2f ms\n",
+                       isa_name(best), params.normal_weight, k, generic_ms);
+            }
+            CHECK(label == generic_label, "fWeight %g, k = %d: the specialized kernel labels differ from the generic ones",
+                  params.normal_weight, k);
+        }
+    }
+}
+
+
+/**
+ * @brief The SIMD membership blends match the scalar one (rounding: one
+ *        unit per channel), the label kernel matches the palette, and the
+ *        throughput of every kernel is reported
+ */
+static void test_coloring_kernels() {
+
+    const int k = 6;
+    FrameStore points(963, 541, k);
+    std::mt19937 rng(500);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (int i = 0; i < points.size; i++) {
+        float total = 0;
+        for (int j = 0; j < k; j++) {
+            points.membership_plane(j)[i] = uniform(rng);
+            total += points.membership_plane(j)[i];
+        }
+        for (int j = 0; j < k; j++) {
+            points.membership_plane(j)[i] /= total;
+        }
+        points.label[i] = (int)(uniform(rng) * k) % k;
+        points.mask[i] = uniform(rng) < 0.9f;
+    }
+    vec3 colors[k];
+    for (int j = 0; j < k; j++) {
+        colors[j] = vec3((float)(40 * j), (float)(255 - 30 * j), (float)((90 * j) % 256));
+    }
+    ClusterPalette palette;
+    palette.set(colors, k);
+
+    std::vector<unsigned int> scalar(points.size), output(points.size);
+    select_coloring_kernel(KERNEL_SCALAR, true)(points, palette, 0, points.size, &scalar[0]);
+    select_coloring_kernel(KERNEL_SCALAR, false)(points, palette, 0, points.size, &output[0]);
+    int mismatches = 0;
+    for (int i = 0; i < points.size; i++) {
+        mismatches += output[i] != (points.mask[i] ? palette.bgrx[points.label[i]] : 0u);
+    }
+    CHECK(mismatches == 0, "labels: %d pixels differ from the palette", mismatches);
+
+    const KERNEL_ISA best = detect_kernel_isa();
+    for (int isa = KERNEL_SCALAR; isa <= best; isa++) {
+        const ColoringKernel kernel = select_coloring_kernel((KERNEL_ISA)isa, true);
+        kernel(points, palette, 0, points.size, &output[0]);
+        int worst = 0;
+        for (int i = 0; i < points.size; i++) {
+            for (int shift = 0; shift < 32; shift += 8) {
+                const int a = (output[i] >> shift) & 0xFF, b = (scalar[i] >> shift) & 0xFF;
+                worst = std::max(worst, std::abs(a - b));
+            }
+        }
+        CHECK(worst <= 1, "%s blend: a channel differs by %d from the scalar kernel", isa_name((KERNEL_ISA)isa), worst);
+
+        const int repeats = 5;
+        const TestClock::time_point start = TestClock::now();
+        for (int n = 0; n < repeats; n++) {
+            kernel(points, palette, 0, points.size, &output[0]);
+        }
+        printf("%s blend, k = %d: %.1f MP/s\n", isa_name((KERNEL_ISA)isa), k,
+               repeats * points.size / (1000 * elapsed_ms(start)));
+    }
+}
+
+
+/**
+ * @brief The bound-accelerated k-means gives the labels of the plain loop
+ *        over several iterations and frames, and skips distance evaluations
+ */
+static void test_accelerated_labels() {
+
+    const int k = 6;
+    FrameStore plain_points(320, 240, k), accelerated_points(320, 240, k);
+    Clustering plain(k), accelerated(k);
+    accelerated.set_accelerated(true);
+    TerminationPolicy policy;
+    policy.max_iterations = 8;
+    plain.set_termination_policy(policy);
+    accelerated.set_termination_policy(policy);
+    plain.set_frame(&plain_points);
+    accelerated.set_frame(&accelerated_points);
+
+    for (int frame = 0; frame < 3; frame++) {
+        fill_blobs(plain_points, 5, 70 + frame);
+        fill_blobs(accelerated_points, 5, 70 + frame);
+        plain.update();
+        accelerated.update();
+
+        int mismatches = 0;
+        for (int m = 0; m < plain_points.num_valid; m++) {
+            const int i = plain_points.valid_index[m];
+            mismatches += plain_points.label[i] != accelerated_points.label[i];
+        }
+        long long skipped = 0;
+        const FrameTelemetry& telemetry = accelerated.get_telemetry();
+        for (size_t n = 0; n < telemetry.records.size(); n++) {
+            skipped += telemetry.records[n].skipped_evaluations;
+        }
+        printf("accelerated k-means, frame %d: %d iterations, %lld of %lld distance evaluations skipped\n",
+               frame, telemetry.iterations, skipped, (long long)telemetry.iterations * k * plain_points.num_valid);
+        CHECK(mismatches == 0, "frame %d: %d of %d labels differ from the plain loop",
+              frame, mismatches, plain_points.num_valid);
+        CHECK(skipped > 0, "frame %d: no distance evaluation was skipped", frame);
+    }
+}
+
+
+/**
+ * @brief SpatialGrid::nearest returns the point of the linear scan of
+ *        GetNearestNeighborIndex (lowest index on ties) for random queries,
+ *        and the time of both center snapping paths is reported
+ */
+static void test_spatial_grid_nearest() {
+
+    FrameStore points(640, 480, 4);
+    fill_blobs(points, 5, 80);
+    // duplicated positions, the snapping must keep the lowest point index
+    for (int n = 0; n < 50; n++) {
+        const int from = points.valid_index[n * 97], to = points.valid_index[n * 97 + 40];
+        points.x[to] = points.x[from]; points.y[to] = points.y[from]; points.z[to] = points.z[from];
+    }
+    Clustering clustering(4);
+    clustering.set_frame(&points);
+    SpatialGrid grid(points.size);
+    TestClock::time_point start = TestClock::now();
+    grid.build(points);
+    const double build_ms = elapsed_ms(start);
+
+    std::mt19937 rng(800);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::normal_distribution<float> noise(0.0f, 0.05f);
+    std::vector<vec3> queries;
+    for (int n = 0; n < 50; n++) {
+        const int i = points.valid_index[n * 97 + 40];
+        queries.push_back(vec3(points.x[i], points.y[i], points.z[i]));
+    }
+    while (queries.size() < 400) {
+        const int i = points.valid_index[(int)(uniform(rng) * points.num_valid) % points.num_valid];
+        queries.push_back(vec3(points.x[i] + noise(rng), points.y[i] + noise(rng), points.z[i] + noise(rng)));
+    }
+    queries.push_back(vec3(-5.0f, 3.0f, 9.0f));    // far outside the grid
+
+    const int num_queries = (int)queries.size();
+    std::vector<int> linear(num_queries), indexed(num_queries);
+    start = TestClock::now();
+    for (int n = 0; n < num_queries; n++) {
+        linear[n] = clustering.GetNearestNeighborIndex(queries[n]);
+    }
+    const double linear_ms = elapsed_ms(start);
+    start = TestClock::now();
+    for (int n = 0; n < num_queries; n++) {
+        indexed[n] = grid.nearest(queries[n]);
+    }
+    const double grid_ms = elapsed_ms(start);
+
+    int mismatches = 0;
+    for (int n = 0; n < num_queries; n++) {
+        mismatches += indexed[n] != linear[n];
+    }
+    printf("center snapping, %d points: linear scan %.1f us/query, grid %.2f us/query (build %.2f ms)\n",
+           points.num_valid, 1000 * linear_ms / num_queries, 1000 * grid_ms / num_queries, build_ms);
+    CHECK(mismatches == 0, "%d of %d queries differ from the linear scan", mismatches, num_queries);
+}
+
+
+/**
+ * @brief Cost of the fuzzy c-means frame (m = 2 vectorized, m = 2.5
+ *        generic) against the hard k-means frame on the same synthetic
+ *        frames; the largest memberships pick the hard labels
+ */
+static void test_fuzzy_against_hard() {
+
+    const int k = 5;
+    const float fuzzifiers[] = { 0.0f, 2.0f, 2.5f };    // 0: hard k-means
+    TerminationPolicy policy;
+    policy.max_iterations = 5;
+    std::vector<int> hard_label;
+
+    for (int n = 0; n < 3; n++) {
+        FrameStore points(960, 540, k);
+        Clustering clustering(k);
+        clustering.set_termination_policy(policy);
+        if (fuzzifiers[n] > 0) {
+            clustering.set_fuzzy(true);
+            clustering.set_fuzzifier(fuzzifiers[n]);
+        }
+        clustering.set_frame(&points);
+
+        const int num_frames = 3;
+        double frame_ms = 0;
+        for (int frame = 0; frame < num_frames; frame++) {
+            fill_blobs(points, k, 90 + frame);
+            clustering.update();
+            frame_ms += clustering.get_telemetry().time_ms;
+        }
+        if (fuzzifiers[n] == 0) {
+            hard_label.assign(points.label, points.label + points.size);
+            printf("hard k-means: %.2f ms/frame\n", frame_ms / num_frames);
+            continue;
+        }
+
+        int agree = 0;
+        for (int m = 0; m < points.num_valid; m++) {
+            const int i = points.valid_index[m];
+            agree += points.label[i] == hard_label[i];
+        }
+        const double agreement = (double)agree / points.num_valid;
+        printf("fuzzy c-means, m = %.1f: %.2f ms/frame, label agreement with the hard run %.4f\n",
+               fuzzifiers[n], frame_ms / num_frames, agreement);
+        CHECK(agreement > 0.95, "m = %.1f: only %.4f of the labels agree with the hard run", fuzzifiers[n], agreement);
+    }
+}
+
+
+/**
+ * @brief The parallel voxel hash gives the voxels of a serial map over the
+ *        valid list (ids in first pixel order, mean attributes, pixel
+ *        counts), and the labels scatter back through the pixel-to-voxel map
+ */
+static void test_voxel_downsampler() {
+
+    FrameStore points(640, 480, 4);
+    fill_blobs(points, 5, 110);
+    VoxelDownsampler downsampler(0.01f);
+    const TestClock::time_point start = TestClock::now();
+    downsampler.build(points, 4);
+    const double build_ms = elapsed_ms(start);
+
+    // serial reference
+    std::map<std::tuple<int, int, int>, int> voxel_id;
+    std::vector<int> point_voxel(points.num_valid);
+    std::vector<double> sum(6 * points.num_valid, 0.0);
+    std::vector<int> count;
+    for (int n = 0; n < points.num_valid; n++) {
+        const int i = points.valid_index[n];
+        const std::tuple<int, int, int> key((int)floorf(points.x[i] * (1.0f / 0.01f)),
+                                            (int)floorf(points.y[i] * (1.0f / 0.01f)),
+                                            (int)floorf(points.z[i] * (1.0f / 0.01f)));
+        std::map<std::tuple<int, int, int>, int>::iterator found = voxel_id.find(key);
+        const int v = (found == voxel_id.end()) ? (voxel_id[key] = (int)count.size()) : found->second;
+        if (v == (int)count.size()) {
+            count.push_back(0);
+        }
+        point_voxel[n] = v;
+        count[v]++;
+        const float attributes[6] = { points.x[i], points.y[i], points.z[i], points.r[i], points.g[i], points.b[i] };
+        for (int a = 0; a < 6; a++) {
+            sum[6 * v + a] += attributes[a];
+        }
+    }
+    const int num_voxels = (int)count.size();
+    printf("voxel grid (1 cm), %d points: %d voxels, build %.2f ms\n", points.num_valid, num_voxels, build_ms);
+    CHECK(downsampler.get_num_voxels() == num_voxels, "%d voxels, the serial reference has %d",
+          downsampler.get_num_voxels(), num_voxels);
+    if (downsampler.get_num_voxels() != num_voxels) {
+        return;
+    }
+
+    FrameStore& cloud = *downsampler.get_voxels();
+    int mismatches = 0;
+    for (int v = 0; v < num_voxels; v++) {
+        const float attributes[6] = { cloud.x[v], cloud.y[v], cloud.z[v], cloud.r[v], cloud.g[v], cloud.b[v] };
+        bool same = cloud.weight[v] == (float)count[v];
+        for (int a = 0; a < 6; a++) {
+            const double mean = sum[6 * v + a] / count[v];
+            same = same && fabs(attributes[a] - mean) <= 1e-5 * (1 + fabs(mean));
+        }
+        mismatches += !same;
+    }
+    CHECK(mismatches == 0, "%d of %d voxels differ from the serial reference", mismatches, num_voxels);
+
+    for (int v = 0; v < num_voxels; v++) {
+        cloud.label[v] = v % 7;
+    }
+    downsampler.scatter_labels(points, false);
+    mismatches = 0;
+    for (int n = 0; n < points.num_valid; n++) {
+        mismatches += points.label[points.valid_index[n]] != point_voxel[n] % 7;
+    }
+    CHECK(mismatches == 0, "%d of %d pixels did not get the label of their voxel", mismatches, points.num_valid);
+}
+
+
+/**
+ * @brief The union-find object extraction gives the components of a serial
+ *        4-neighbor BFS (same label, 3D gap below max_gap) with their pixel
+ *        counts, boxes and centroids, in first pixel order
+ */
+static void test_object_extraction() {
+
+    FrameStore points(320, 240, 3);
+    std::mt19937 rng(120);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (int v = 0; v < points.height; v++) {
+        for (int u = 0; u < points.width; u++) {
+            const int i = v * points.width + u;
+            // label stripes, a raised box splits them by depth and a few
+            // scattered invalid pixels leave small fragments behind
+            const bool raised = u >= 100 && u < 180 && v >= 60 && v < 150;
+            points.x[i] = 0.003f * u;
+            points.y[i] = 0.003f * v;
+            points.z[i] = raised ? 0.9f : 1.0f;
+            points.label[i] = (u / 40 + v / 60) % 3;
+            points.mask[i] = uniform(rng) > 0.05f;
+        }
+    }
+    points.build_valid_index();
+    const float max_gap = 0.02f;
+    const int min_pixels = 100;
+    ObjectExtractor extractor(points.size, max_gap, min_pixels);
+    const TestClock::time_point start = TestClock::now();
+    extractor.extract(points);
+    const double extract_ms = elapsed_ms(start);
+
+    // serial reference
+    std::vector<int> component(points.size, -1);
+    std::vector<SceneObject> expected;
+    std::vector<int> queue;
+    for (int m = 0; m < points.num_valid; m++) {
+        const int seed = points.valid_index[m];
+        if (component[seed] >= 0) {
+            continue;
+        }
+        SceneObject object;
+        object.label = points.label[seed];
+        object.pixel_count = 0;
+        object.min_u = object.min_v = INT_MAX;
+        object.max_u = object.max_v = -1;
+        object.min_corner = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        object.max_corner = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        double sx = 0, sy = 0, sz = 0;
+        const int id = (int)expected.size();
+        queue.assign(1, seed);
+        component[seed] = id;
+        for (size_t q = 0; q < queue.size(); q++) {
+            const int i = queue[q];
+            const int u = i % points.width, v = i / points.width;
+            object.pixel_count++;
+            object.min_u = std::min(object.min_u, u); object.max_u = std::max(object.max_u, u);
+            object.min_v = std::min(object.min_v, v); object.max_v = std::max(object.max_v, v);
+            object.min_corner = vec3(std::min(object.min_corner.x, points.x[i]), std::min(object.min_corner.y, points.y[i]),
+                                     std::min(object.min_corner.z, points.z[i]));
+            object.max_corner = vec3(std::max(object.max_corner.x, points.x[i]), std::max(object.max_corner.y, points.y[i]),
+                                     std::max(object.max_corner.z, points.z[i]));
+            sx += points.x[i]; sy += points.y[i]; sz += points.z[i];
+
+            const int neighbors[4] = { u > 0 ? i - 1 : -1, u + 1 < points.width ? i + 1 : -1,
+                                       v > 0 ? i - points.width : -1, v + 1 < points.height ? i + points.width : -1 };
+            for (int n = 0; n < 4; n++) {
+                const int j = neighbors[n];
+                if (j < 0 || !points.mask[j] || component[j] >= 0 || points.label[j] != points.label[i]) {
+                    continue;
+                }
+                const float dx = points.x[j] - points.x[i], dy = points.y[j] - points.y[i], dz = points.z[j] - points.z[i];
+                if (dx*dx + dy*dy + dz*dz <= max_gap * max_gap) {
+                    component[j] = id;
+                    queue.push_back(j);
+                }
+            }
+        }
+        object.centroid = vec3((float)(sx / object.pixel_count), (float)(sy / object.pixel_count),
+                               (float)(sz / object.pixel_count));
+        expected.push_back(object);
+    }
+    std::vector<int> object_id(expected.size(), -1);
+    std::vector<SceneObject> kept;
+    for (size_t c = 0; c < expected.size(); c++) {
+        if (expected[c].pixel_count >= min_pixels) {
+            object_id[c] = (int)kept.size();
+            kept.push_back(expected[c]);
+        }
+    }
+
+    const std::vector<SceneObject>& objects = extractor.get_objects();
+    printf("object extraction, %d points: %d objects (%d components), %.3f ms\n",
+           points.num_valid, (int)objects.size(), (int)expected.size(), extract_ms);
+    CHECK(objects.size() == kept.size(), "%d objects, the BFS reference has %d", (int)objects.size(), (int)kept.size());
+    if (objects.size() != kept.size()) {
+        return;
+    }
+    int mismatches = 0;
+    for (size_t n = 0; n < kept.size(); n++) {
+        const SceneObject& a = objects[n];
+        const SceneObject& b = kept[n];
+        const vec3 d = a.centroid - b.centroid;
+        mismatches += a.label != b.label || a.pixel_count != b.pixel_count ||
+                      a.min_u != b.min_u || a.max_u != b.max_u || a.min_v != b.min_v || a.max_v != b.max_v ||
+                      a.min_corner.x != b.min_corner.x || a.min_corner.y != b.min_corner.y || a.min_corner.z != b.min_corner.z ||
+                      a.max_corner.x != b.max_corner.x || a.max_corner.y != b.max_corner.y || a.max_corner.z != b.max_corner.z ||
+                      sqrtf(d.x*d.x + d.y*d.y + d.z*d.z) > 1e-5f;
+    }
+    CHECK(mismatches == 0, "%d of %d objects differ from the BFS reference", mismatches, (int)kept.size());
+
+    const int* object_map = extractor.get_object_map();
+    mismatches = 0;
+    for (int m = 0; m < points.num_valid; m++) {
+        const int i = points.valid_index[m];
+        mismatches += object_map[i] != object_id[component[i]];
+    }
+    CHECK(mismatches == 0, "%d of %d pixels are in another object than in the BFS reference", mismatches, points.num_valid);
+}
+
+
+/**
+ * @brief Uniform seeding draws distinct valid points, and a uniformly
+ *        seeded k-means frame keeps its centers on the valid points' means
+ */
+static void test_uniform_seeding() {
+
+    const int k = 8;
+    FrameStore points(160, 96, k);
+    fill_blobs(points, 4, 50);
+    CenterSeeding seeding(11);
+    vec3 centers[k];
+    seeding.uniform(points, k, centers);
+    for (int j = 0; j < k; j++) {
+        int matches = 0;
+        for (int m = 0; m < points.num_valid; m++) {
+            const int i = points.valid_index[m];
+            matches += points.x[i] == centers[j].x && points.y[i] == centers[j].y && points.z[i] == centers[j].z;
+        }
+        CHECK(matches == 1, "center %d matches %d valid points", j, matches);
+        for (int l = 0; l < j; l++) {
+            CHECK(centers[l].x != centers[j].x || centers[l].y != centers[j].y || centers[l].z != centers[j].z,
+                  "centers %d and %d are the same point", l, j);
+        }
+    }
+
+    Clustering clustering(k);
+    clustering.set_seeding_type(2);
+    clustering.set_frame(&points);
+    clustering.update();
+    check_centers_are_label_means(clustering, points,
+                                  std::vector<int>(points.valid_index, points.valid_index + points.num_valid),
+                                  "uniform seeding");
+}
+
+
+/**
+ * @brief k-means frames with 1..N threads (N: the cores, at least 4): the
+ *        time per frame of each count is reported, and in deterministic
+ *        mode every count gives bit-identical centers
+ */
+static void test_thread_scaling() {
+
+    const int k = 6;
+    FrameStore points(960, 540, k);
+    fill_blobs(points, k, 60);
+    TerminationPolicy policy;
+    policy.max_iterations = 5;
+    const int max_threads = std::max(4, omp_get_num_procs());
+
+    std::vector<vec3> reference(k);
+    double single_ms = 0;
+    for (int threads = 1; threads <= max_threads; threads++) {
+        Clustering clustering(k);
+        clustering.set_num_threads(threads);
+        clustering.set_deterministic(true);
+        clustering.set_termination_policy(policy);
+        clustering.set_frame(&points);
+        clustering.update();    // Seeds the centers, not timed
+
+        const int num_frames = 3;
+        double frame_ms = 0;
+        for (int frame = 0; frame < num_frames; frame++) {
+            clustering.update();
+            frame_ms += clustering.get_telemetry().time_ms;
+        }
+        frame_ms /= num_frames;
+        if (threads == 1) {
+            single_ms = frame_ms;
+            std::copy(clustering.get_centers(), clustering.get_centers() + k, reference.begin());
+        }
+        printf("k-means, %d thread(s): %.2f ms/frame (%.2fx of 1 thread)\n", threads, frame_ms, single_ms / frame_ms);
+        CHECK(memcmp(clustering.get_centers(), &reference[0], k * sizeof(vec3)) == 0,
+              "deterministic mode, %d threads: the centers differ from the single thread run", threads);
+    }
+}
+
+
+/**
+ * @brief Pyramid mode with the temporal mode on: the coarse frames leave
+ *        no full resolution reference behind, so the centers stay the means
+ *        of the coarse points of every frame of a moving sequence
+ */
+static void test_pyramid_temporal() {
+
+    FrameStore points(160, 96, 4);
+    Clustering clustering(4);
+    clustering.set_temporal(true);
+    clustering.set_pyramid_levels(1);
+    clustering.set_frame(&points);
+    for (int frame = 0; frame < 5; frame++) {
+        fill_blobs(points, 4, 100 + frame);
+        clustering.update();
+
+        std::vector<int> coarse;
+        for (int v = 0; v < points.height; v += 2) {
+            for (int u = 0; u < points.width; u += 2) {
+                if (points.mask[v * points.width + u]) {
+                    coarse.push_back(v * points.width + u);
+                }
+            }
+        }
+        check_centers_are_label_means(clustering, points, coarse, "pyramid + temporal");
+    }
+}
+
+
+/**
+ * @brief Temporal mode with the cluster statistics on: the incremental
+ *        frames patch the sums summed with the statistics moments, and the
+ *        centers stay the means of the points of each label while the
+ *        valid area shrinks
+ */
+static void test_temporal_cluster_stats() {
+
+    FrameStore points(160, 96, 4);
+    Clustering clustering(4);
+    clustering.set_temporal(true);
+    clustering.set_temporal_tolerance(0.0f);
+    clustering.set_cluster_stats(true);
+    clustering.set_frame(&points);
+    for (int frame = 0; frame < 6; frame++) {
+        fill_blobs(points, 4, 200);
+        for (int v = 0; v < points.height; v++) {
+            for (int u = 0; u < 8 * frame; u++) {
+                points.mask[v * points.width + u] = false;
+            }
+        }
+        points.build_valid_index();
+        clustering.update();
+
+        const std::vector<int> valid(points.valid_index, points.valid_index + points.num_valid);
+        check_centers_are_label_means(clustering, points, valid, "temporal + stats");
+    }
+    CHECK(clustering.get_telemetry().inertia < 0, "the last frame did not run the incremental mode");
+}
+
+
+/**
+ * @brief Frame of a mostly static replayed sequence: fixed blobs and a
+ *        box moving across them in front (4 pixels per frame)
+ */
+static void fill_moving_box(FrameStore& points, int frame) {
+
+    fill_blobs(points, 4, 300);
+    for (int v = points.height / 4; v < points.height / 2; v++) {
+        for (int u = 4 * frame; u < 4 * frame + 24 && u < points.width; u++) {
+            const int i = v * points.width + u;
+            points.z[i] -= 0.3f;
+            points.r[i] = 250;
+            points.g[i] = 20;
+            points.b[i] = 20;
+        }
+    }
+}
+
+
+/**
+ * @brief Temporal mode against a full recompute on the same replayed
+ *        sequence (one cluster per blob and one for the box): the labels
+ *        may only drift slightly from the full k-means, whose centers snap
+ *        to their nearest point. Reports the time of both per frame.
+ */
+static void test_temporal_against_full() {
+
+    FrameStore temporal_points(320, 120, 5), full_points(320, 120, 5);
+    Clustering temporal(5), full(5);
+    temporal.set_temporal(true);
+    temporal.set_frame(&temporal_points);
+    full.set_frame(&full_points);
+
+    double temporal_ms = 0, full_ms = 0;
+    float worst_agreement = 1;
+    const int num_frames = 12;
+    for (int frame = 0; frame < num_frames; frame++) {
+        fill_moving_box(temporal_points, frame);
+        fill_moving_box(full_points, frame);
+        temporal.update();
+        full.update();
+        if (frame == 0) {
+            continue;
+        }
+        temporal_ms += temporal.get_telemetry().time_ms;
+        full_ms += full.get_telemetry().time_ms;
+
+        int agree = 0;
+        for (int n = 0; n < full_points.num_valid; n++) {
+            const int i = full_points.valid_index[n];
+            agree += temporal_points.label[i] == full_points.label[i];
+        }
+        worst_agreement = std::min(worst_agreement, (float)agree / full_points.num_valid);
+    }
+    printf("temporal: %.3f ms/frame, full: %.3f ms/frame, worst label agreement %.4f\n",
+           temporal_ms / (num_frames - 1), full_ms / (num_frames - 1), worst_agreement);
+    CHECK(worst_agreement > 0.97f, "temporal labels drifted from the full recompute (agreement %.4f)", worst_agreement);
+}
+
+
+/**
+ * @brief The SIMD registration kernels write the same points as the scalar
+ *        one, with the separable slopes and with per-pixel rays, on rows
+ *        whose start is not aligned (head and tail paths); reports the
+ *        throughput of every kernel
+ */
+static void test_registration_kernels() {
+
+    const int width = 1917, height = 200, size = width * height;
+    std::mt19937 rng(600);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> camera_xyz(3 * (size_t)size);
+    std::vector<unsigned int> color_bgrx(size);
+    std::vector<float> slope_x(width), slope_y(height), map_x(size), map_y(size);
+    for (int i = 0; i < size; i++) {
+        const float pick = uniform(rng);
+        float z = 0.3f + 3.0f * uniform(rng);
+        if (pick < 0.05f) {
+            z = -std::numeric_limits<float>::infinity();
+        }
+        else if (pick < 0.1f) {
+            z = std::numeric_limits<float>::quiet_NaN();
+        }
+        camera_xyz[3 * i] = uniform(rng);
+        camera_xyz[3 * i + 1] = uniform(rng);
+        camera_xyz[3 * i + 2] = z;
+        color_bgrx[i] = (unsigned int)rng();
+        map_x[i] = uniform(rng) - 0.5f;
+        map_y[i] = uniform(rng) - 0.5f;
+    }
+    for (int u = 0; u < width; u++) {
+        slope_x[u] = (u - width / 2) * 0.001f;
+    }
+    for (int v = 0; v < height; v++) {
+        slope_y[v] = (v - height / 2) * 0.001f;
+    }
+
+    FrameStore scalar(width, height, 0), points(width, height, 0);
+    float* const planes[] = { points.x, points.y, points.z, points.r, points.g, points.b };
+    float* const scalar_planes[] = { scalar.x, scalar.y, scalar.z, scalar.r, scalar.g, scalar.b };
+    const KERNEL_ISA best = detect_kernel_isa();
+    for (int distorted = 0; distorted < 2; distorted++) {
+        for (int isa = KERNEL_SCALAR; isa <= best; isa++) {
+            const RegistrationKernel kernel = select_registration_kernel((KERNEL_ISA)isa);
+            FrameStore& output = (isa == KERNEL_SCALAR) ? scalar : points;
+            const TestClock::time_point start = TestClock::now();
+            #pragma omp parallel for
+            for (int row = 0; row < height; row++) {
+                const float* ray_x = distorted ? &map_x[(size_t)row * width] : &slope_x[0];
+                const float* ray_y = distorted ? &map_y[(size_t)row * width] : NULL;
+                kernel(&camera_xyz[0], &color_bgrx[0], ray_x, ray_y, distorted ? 0.0f : slope_y[row],
+                       0.5f, 2.69f, row * width, width, output);
+            }
+            printf("%s registration (%s rays): %.1f MP/s\n", isa_name((KERNEL_ISA)isa),
+                   distorted ? "per-pixel" : "separable", size / (1000 * elapsed_ms(start)));
+            if (isa == KERNEL_SCALAR) {
+                continue;
+            }
+
+            int mismatches = 0;
+            for (int i = 0; i < size; i++) {
+                bool same = points.mask[i] == scalar.mask[i];
+                for (int plane = 0; plane < 6; plane++) {
+                    same = same && planes[plane][i] == scalar_planes[plane][i];
+                }
+                mismatches += !same;
+            }
+            CHECK(mismatches == 0, "%s (%s rays): %d points differ from the scalar kernel",
+                  isa_name((KERNEL_ISA)isa), distorted ? "per-pixel" : "separable", mismatches);
+        }
+    }
+}
+
+
+/**
+ * @brief Portable registration of a flat wall: every hit color pixel lies
+ *        on the wall along its color ray, also after the color calibration
+ *        changed under the registration (shared ray table)
+ */
+static void test_registration_color_rays() {
+
+    const PinholeIntrinsics depth = PinholeIntrinsics::from_fov(64, 48, 1.2f, 0.9f);
+    RayTable color_rays;
+    color_rays.update(PinholeIntrinsics::from_fov(128, 96, 1.0f, 0.75f));
+    DepthRegistration registration(depth, color_rays, RigidTransform::identity());
+
+    std::vector<unsigned short> depth_mm((size_t)depth.width * depth.height, 1500);
+    std::vector<unsigned char> color_bgrx((size_t)128 * 96 * 4, 128);
+    FrameStore points(128, 96, 0);
+
+    const float fovs[] = { 1.0f, 0.8f };
+    for (int n = 0; n < 2; n++) {
+        color_rays.update(PinholeIntrinsics::from_fov(128, 96, fovs[n], 0.75f * fovs[n]));
+        registration.register_frame(&depth_mm[0], &color_bgrx[0], points);
+
+        const float* slope_x = color_rays.get_slope_x();
+        const float* slope_y = color_rays.get_slope_y();
+        int hits = 0, off_ray = 0;
+        for (int v = 0; v < points.height; v++) {
+            for (int u = 0; u < points.width; u++) {
+                const int i = v * points.width + u;
+                if (!points.mask[i]) {
+                    continue;
+                }
+                hits++;
+                if (fabsf(points.z[i] - 1.5f) > 1e-4f ||
+                    fabsf(points.x[i] - 1.5f * slope_x[u]) > 1e-4f ||
+                    fabsf(points.y[i] - 1.5f * slope_y[v]) > 1e-4f) {
+                    off_ray++;
+                }
+            }
+        }
+        CHECK(hits > points.size * 9 / 10, "horizontal fov %.1f: only %d of %d color pixels were hit",
+              fovs[n], hits, points.size);
+        CHECK(off_ray == 0, "horizontal fov %.1f: %d pixels are off the wall or off their color ray",
+              fovs[n], off_ray);
+    }
+}
+
+
+/**
+ * @brief Mini-batch k-means against the full k-means on the same scene and
+ *        seeds: the mini-batch inertia stays close to the full one. Reports
+ *        the accuracy against the time of both.
+ */
+static void test_minibatch_against_full() {
+
+    FrameStore minibatch_points(640, 240, 5), full_points(640, 240, 5);
+    fill_blobs(minibatch_points, 5, 400);
+    fill_blobs(full_points, 5, 400);
+    Clustering minibatch(5), full(5);
+    minibatch.set_minibatch(true);
+    minibatch.set_batch_size(2048);
+    minibatch.set_batch_iterations(30);
+    TerminationPolicy policy;
+    policy.max_iterations = 10;
+    full.set_termination_policy(policy);
+    minibatch.set_frame(&minibatch_points);
+    full.set_frame(&full_points);
+
+    double minibatch_ms = 0, full_ms = 0;
+    const int num_frames = 3;
+    for (int frame = 0; frame < num_frames; frame++) {
+        minibatch.update();
+        full.update();
+        minibatch_ms += minibatch.get_telemetry().time_ms;
+        full_ms += full.get_telemetry().time_ms;
+    }
+    const double minibatch_inertia = minibatch.get_telemetry().inertia / minibatch_points.num_valid;
+    const double full_inertia = full.get_telemetry().inertia / full_points.num_valid;
+    printf("mini-batch: %.3f ms/frame, inertia %.5f per point; full: %.3f ms/frame, inertia %.5f per point\n",
+           minibatch_ms / num_frames, minibatch_inertia, full_ms / num_frames, full_inertia);
+    CHECK(minibatch_inertia < 1.25 * full_inertia, "mini-batch inertia %.5f, full %.5f",
+          minibatch_inertia, full_inertia);
+}
+
+
+/**
+ * @brief Frame of a pinhole camera (90 x 70 degrees) looking at a plane
+ *        n.p = d or, with radius > 0, at a sphere of that radius around
+ *        (0, 0, d); pixels that miss the surface are invalid. The expected
+ *        normal of every pixel goes to the n planes.
+ */
+static void fill_surface(FrameStore& points, const vec3& n, float d, float radius) {
+
+    const float slope_x = tanf(0.785f) / (points.width / 2);
+    const float slope_y = tanf(0.611f) / (points.height / 2);
+    for (int v = 0; v < points.height; v++) {
+        for (int u = 0; u < points.width; u++) {
+            const int i = v * points.width + u;
+            const vec3 ray((u - points.width / 2) * slope_x, (v - points.height / 2) * slope_y, 1.0f);
+            float t = -1;
+            vec3 normal;
+            if (radius > 0) {
+                // |t ray - c|^2 = radius^2, nearest root
+                const float a = ray.x * ray.x + ray.y * ray.y + 1;
+                const float b = -2 * d;
+                const float c = d * d - radius * radius;
+                const float disc = b * b - 4 * a * c;
+                if (disc > 0) {
+                    t = (-b - sqrtf(disc)) / (2 * a);
+                    normal = vec3(t * ray.x / radius, t * ray.y / radius, (t - d) / radius);
+                }
+            }
+            else {
+                t = d / (n.x * ray.x + n.y * ray.y + n.z);
+                normal = n;
+            }
+            points.mask[i] = t > 0;
+            points.x[i] = t * ray.x;
+            points.y[i] = t * ray.y;
+            points.z[i] = t;
+            points.nx[i] = normal.x;
+            points.ny[i] = normal.y;
+            points.nz[i] = normal.z;
+        }
+    }
+}
+
+
+/**
+ * @brief Estimated normals of a frame against the expected ones (n planes
+ *        as filled by fill_surface), over the points whose surface faces the
+ *        camera within max_view_deg (steeper windows cross depth edges)
+ */
+static void check_normals(const char* what, FrameStore& points, int window_radius, float max_view_deg,
+                          float max_mean_error_deg, float min_coverage) {
+
+    std::vector<float> expected_x(points.nx, points.nx + points.size);
+    std::vector<float> expected_y(points.ny, points.ny + points.size);
+    std::vector<float> expected_z(points.nz, points.nz + points.size);
+    NormalEstimator normals;
+    normals.compute(points, window_radius);
+
+    const float min_view_cosine = cosf(max_view_deg * 3.14159265f / 180);
+    int valid = 0, estimated = 0;
+    double error_sum = 0;
+    for (int i = 0; i < points.size; i++) {
+        if (!points.mask[i]) {
+            continue;
+        }
+        const float distance = sqrtf(points.x[i] * points.x[i] + points.y[i] * points.y[i] + points.z[i] * points.z[i]);
+        const float view_cosine = -(expected_x[i] * points.x[i] + expected_y[i] * points.y[i] + expected_z[i] * points.z[i]) / distance;
+        if (view_cosine < min_view_cosine) {
+            continue;
+        }
+        valid++;
+        if (points.nx[i] == 0 && points.ny[i] == 0 && points.nz[i] == 0) {
+            continue;
+        }
+        estimated++;
+        const float cosine = points.nx[i] * expected_x[i] + points.ny[i] * expected_y[i] + points.nz[i] * expected_z[i];
+        error_sum += acos(std::min(std::max(cosine, -1.0f), 1.0f)) * 180 / 3.14159265358979;
+    }
+    const float coverage = valid ? (float)estimated / valid : 0;
+    const float mean_error = estimated ? (float)(error_sum / estimated) : 180;
+    printf("%s normals: mean error %.4f deg, %.1f%% of the points\n", what, mean_error, 100 * coverage);
+    CHECK(mean_error < max_mean_error_deg, "%s: mean normal error %.3f deg", what, mean_error);
+    CHECK(coverage > min_coverage, "%s: only %.1f%% of the points got a normal", what, 100 * coverage);
+}
+
+
+/**
+ * @brief Windowed covariance normals of a tilted plane and of a sphere
+ *        (normals towards the camera)
+ */
+static void test_plane_and_sphere_normals() {
+
+    FrameStore points(160, 120, 0);
+    const float length = sqrtf(0.3f * 0.3f + 0.2f * 0.2f + 1.0f);
+    const vec3 tilted(0.3f / length, -0.2f / length, -1.0f / length);
+    fill_surface(points, tilted, -1.5f, 0);
+    check_normals("plane", points, 3, 90, 0.05f, 0.99f);
+
+    fill_surface(points, vec3(), 1.2f, 0.8f);
+    check_normals("sphere", points, 3, 60, 0.2f, 0.98f);
+}
+
+
+/**
+ * @brief The row bands of the normal estimator give bit-identical normals
+ *        with 1..N threads (N: the cores, at least 4), and the full HD frame
+ *        time of each count is reported
+ */
+static void test_normal_threads() {
+
+    FrameStore points(1920, 1080, 0);
+    fill_surface(points, vec3(), 1.2f, 0.8f);
+    const int default_threads = omp_get_max_threads();
+    const int max_threads = std::max(4, omp_get_num_procs());
+    NormalEstimator normals;
+    std::vector<float> reference;
+
+    for (int threads = 1; threads <= max_threads; threads++) {
+        omp_set_num_threads(threads);
+        normals.compute(points, 3);     // Sizes the scratch buffers, not timed
+        const TestClock::time_point start = TestClock::now();
+        normals.compute(points, 3);
+        const double frame_ms = elapsed_ms(start);
+
+        std::vector<float> result(points.nx, points.nx + points.size);
+        result.insert(result.end(), points.ny, points.ny + points.size);
+        result.insert(result.end(), points.nz, points.nz + points.size);
+        if (threads == 1) {
+            reference = result;
+        }
+        printf("normals, 1920x1080, %d thread(s): %.1f ms/frame\n", threads, frame_ms);
+        CHECK(result == reference, "%d threads: the normals differ from the single thread run", threads);
+    }
+    omp_set_num_threads(default_threads);
+}
+
+
+int main() {
+
+    test_frame_layout();
+    test_valid_density_sweep();
+    test_kernel_isa_agreement();
+    test_kernel_k_sweep();
+    test_coloring_kernels();
+    test_thread_scaling();
+    test_accelerated_labels();
+    test_spatial_grid_nearest();
+    test_fuzzy_against_hard();
+    test_voxel_downsampler();
+    test_object_extraction();
+    test_uniform_seeding();
+    test_pyramid_temporal();
+    test_temporal_cluster_stats();
+    test_temporal_against_full();
+    test_minibatch_against_full();
+    test_registration_kernels();
+    test_registration_color_rays();
+    test_plane_and_sphere_normals();
+    test_normal_threads();
+
+    if (failures) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -22,7 +22,7 @@ public:
 		return vec3(this->x / f, this->y / f, this->z / f);
 	}
 
-	vec3 &vec3::set(float x, float y, float z) {
+	vec3 &set(float x, float y, float z) {
 		this->x = x;
 		this->y = y;
 		this->z = z;
@@ -31,7 +31,7 @@ public:
 		return *this;
 	}
 
-	vec3 &vec3::zero(void) {
+	vec3 &zero(void) {
 		x = y = z = 0;
 
 		return *this;